@@ -0,0 +1,175 @@
+/*
+ * 视频帧压缩基准测试
+ * 用法: compress-bench [iterations] [yuv420p文件 宽 高]
+ * 对比permessage-deflate的整帧压缩(单个raw deflate流，上下文保留，io线程串行)和SliceCompressor的分片并行压缩，
+ * 输出每帧耗时、吞吐(压缩前的字节数)和压缩比，并校验分片解压后和原始数据一致
+ * 不指定文件时使用合成的720p/1080p/4K画面(平滑渐变加少量噪声，接近解码后的监控画面)
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <zlib.h>
+
+#include "common/helper/singleton.h"
+#include "common/helper/work_stealing_pool.h"
+#include "server/frame_header.h"
+#include "server/frame_payload.h"
+#include "server/slice_compressor.h"
+
+using decoder::FrameHeader;
+using decoder::FramePayload;
+using decoder::SliceCompressor;
+
+struct Frame {
+    const char *name;
+    int32_t width;
+    int32_t height;
+    std::vector<uint8_t> data; // 紧凑排列的yuv420p
+};
+
+static Frame makeFrame(const char *name, int32_t width, int32_t height) {
+    Frame frame{name, width, height, std::vector<uint8_t>((size_t)width * height * 3 / 2)};
+    uint32_t seed = 1;
+    uint8_t *p    = frame.data.data();
+    for (int32_t y = 0; y < height; y++) {
+        for (int32_t x = 0; x < width; x++) {
+            seed = seed * 1103515245 + 12345;
+            *p++ = (uint8_t)(16 + (x * 160 / width + y * 60 / height) + ((seed >> 16) & 3));
+        }
+    }
+    for (int32_t plane = 0; plane < 2; plane++) {
+        for (int32_t y = 0; y < height / 2; y++) {
+            for (int32_t x = 0; x < width / 2; x++) {
+                *p++ = (uint8_t)(plane == 0 ? 128 - y * 32 / height : 128 + x * 32 / width);
+            }
+        }
+    }
+    return frame;
+}
+
+static bool loadFrame(Frame &frame, const char *file) {
+    FILE *fp = fopen(file, "rb");
+    if (fp == nullptr) {
+        return false;
+    }
+    size_t n = fread(frame.data.data(), 1, frame.data.size(), fp);
+    fclose(fp);
+    return n == frame.data.size();
+}
+
+// 返回每次的平均耗时(us)
+static double measure(int32_t iterations, const std::function<void()> &fn) {
+    fn();
+    auto begin = std::chrono::steady_clock::now();
+    for (int32_t i = 0; i < iterations; i++) {
+        fn();
+    }
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - begin).count() / iterations;
+}
+
+// 和websocketpp permessage-deflate相同的参数: raw deflate，窗口15位，上下文在消息之间保留，每条消息Z_SYNC_FLUSH
+class WholeMessageDeflate {
+public:
+    explicit WholeMessageDeflate(int32_t level) {
+        memset(&stream_, 0, sizeof(stream_));
+        deflateInit2(&stream_, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+    }
+
+    ~WholeMessageDeflate() { deflateEnd(&stream_); }
+
+    size_t compress(const std::vector<uint8_t> &src, std::vector<uint8_t> &dst) {
+        dst.resize(deflateBound(&stream_, src.size()) + 16);
+        stream_.next_in   = (Bytef *)src.data();
+        stream_.avail_in  = (uInt)src.size();
+        stream_.next_out  = dst.data();
+        stream_.avail_out = (uInt)dst.size();
+        deflate(&stream_, Z_SYNC_FLUSH);
+        return dst.size() - stream_.avail_out;
+    }
+
+private:
+    z_stream stream_;
+};
+
+// 按分片表解压，和原始数据比较
+static bool verifySlices(const std::string &msg, size_t headerSize, const std::vector<uint8_t> &raw) {
+    const uint8_t *p = (const uint8_t *)msg.data() + headerSize;
+    uint32_t count   = FrameHeader::get32(p);
+    uint32_t total   = FrameHeader::get32(p + 4);
+    if (total != raw.size()) {
+        return false;
+    }
+    std::vector<uint8_t> out(total);
+    const uint8_t *src = p + 8 + 8 * count;
+    size_t dst         = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        uLongf rawBytes   = FrameHeader::get32(p + 8 + 8 * i);
+        uint32_t zipBytes = FrameHeader::get32(p + 12 + 8 * i);
+        if (uncompress(out.data() + dst, &rawBytes, src, zipBytes) != Z_OK) {
+            return false;
+        }
+        src += zipBytes;
+        dst += rawBytes;
+    }
+    return dst == total && memcmp(out.data(), raw.data(), total) == 0;
+}
+
+int main(int argc, char *argv[]) {
+    int32_t iterations = argc >= 2 ? atoi(argv[1]) : 20;
+    std::vector<Frame> frames;
+    if (argc >= 5) {
+        frames.push_back(Frame{argv[2], atoi(argv[3]), atoi(argv[4]), {}});
+        frames[0].data.resize((size_t)frames[0].width * frames[0].height * 3 / 2);
+        if (!loadFrame(frames[0], argv[2])) {
+            fprintf(stderr, "read %s failed\n", argv[2]);
+            return 1;
+        }
+    } else {
+        frames.push_back(makeFrame("720p", 1280, 720));
+        frames.push_back(makeFrame("1080p", 1920, 1080));
+        frames.push_back(makeFrame("4K", 3840, 2160));
+    }
+
+    auto &pool = common::Singleton<common::WorkStealingPool>::getInstance();
+    printf("%d iterations, %u pool workers, %zu KB slices\n", iterations, pool.size(), SliceCompressor::INSTANCE().kSliceBytes / 1024);
+    printf("%8s %-22s %10s %10s %8s\n", "", "", "us/frame", "MB/s", "ratio");
+
+    for (auto &f : frames) {
+        FrameHeader header;
+        header.width  = f.width;
+        header.height = f.height;
+        header.format = 0;
+        uint8_t headerData[FrameHeader::kMaxSize];
+        FramePayload payload;
+        payload.setHeader(headerData, header.encode(headerData, FrameHeader::kVersion_Binary));
+        payload.addRegion(f.data.data(), (int32_t)f.data.size(), (int32_t)f.data.size(), 1);
+        size_t headerSize = payload.header().size();
+
+        for (int32_t level : {Z_DEFAULT_COMPRESSION, Z_BEST_SPEED}) {
+            WholeMessageDeflate deflater(level);
+            std::vector<uint8_t> dst;
+            size_t size = 0;
+            double us   = measure(iterations, [&]() { size = deflater.compress(f.data, dst); });
+            printf("%8s %-22s %10.1f %10.1f %8.2f\n", f.name, level == Z_BEST_SPEED ? "whole deflate, lvl 1" : "whole deflate, default", us,
+                   f.data.size() / us, (double)f.data.size() / size);
+        }
+
+        for (int32_t level : {1, 6}) {
+            std::string msg;
+            bool compressed = false;
+            double us       = measure(iterations, [&]() {
+                msg.clear();
+                compressed = SliceCompressor::INSTANCE().appendTo(payload, msg, level);
+            });
+            bool ok = compressed && verifySlices(msg, headerSize, f.data);
+            printf("%8s slices, lvl %-11d %10.1f %10.1f %8.2f%s\n", f.name, level, us, f.data.size() / us,
+                   (double)f.data.size() / (msg.size() - headerSize), ok ? "" : "  MISMATCH");
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,165 @@
+/*
+ * 打包内核基准测试
+ * 用法: pack-bench [iterations]
+ * 对比原来的逐行memcpy/逐采样memcpy和PackKernels各指令集实现，720p/1080p/4K的YUV420带stride填充的平面打包，以及1024采样的立体声PCM交织
+ * 以及各指令集的输出格式转换: YUV420转NV12、YUV420转RGBA
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+#include "server/pack_kernels.h"
+
+using decoder::PackKernels;
+
+struct Plane {
+    std::vector<uint8_t> data;
+    int32_t stride;
+    int32_t width;
+    int32_t height;
+};
+
+// 和ffmpeg默认分配器类似，stride对齐到64字节再留出填充
+static Plane makePlane(int32_t width, int32_t height) {
+    Plane plane;
+    plane.width  = width;
+    plane.height = height;
+    plane.stride = (width + 63) / 64 * 64 + 64;
+    plane.data.resize((size_t)plane.stride * height);
+    for (size_t i = 0; i < plane.data.size(); i++) {
+        plane.data[i] = (uint8_t)(i * 31);
+    }
+    return plane;
+}
+
+// 返回每次的平均耗时(us)
+static double measure(int32_t iterations, const std::function<void()> &fn) {
+    fn();
+    auto begin = std::chrono::steady_clock::now();
+    for (int32_t i = 0; i < iterations; i++) {
+        fn();
+    }
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - begin).count() / iterations;
+}
+
+// 原来copyYuvData的做法，每行一次memcpy
+static void packByRow(uint8_t *dst, const Plane *planes) {
+    for (int32_t p = 0; p < 3; p++) {
+        for (int32_t y = 0; y < planes[p].height; y++) {
+            memcpy(dst, planes[p].data.data() + (size_t)y * planes[p].stride, planes[p].width);
+            dst += planes[p].width;
+        }
+    }
+}
+
+static void packByKernel(uint8_t *dst, const Plane *planes) {
+    auto &kernels = PackKernels::INSTANCE();
+    for (int32_t p = 0; p < 3; p++) {
+        kernels.copyRows(dst, planes[p].width, planes[p].data.data(), planes[p].stride, planes[p].width, planes[p].height);
+        dst += (size_t)planes[p].width * planes[p].height;
+    }
+}
+
+// 原来copyPcmData的做法，每个采样一次memcpy
+static void interleaveBySample(uint8_t *dst, const uint8_t *const *planes, int32_t channels, int32_t samples, int32_t sampleSize) {
+    uint32_t offset = 0;
+    for (int32_t i = 0; i < samples; i++) {
+        for (int32_t ch = 0; ch < channels; ch++) {
+            memcpy(dst + offset, planes[ch] + sampleSize * i, sampleSize);
+            offset += sampleSize;
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    int32_t iterations = argc >= 2 ? atoi(argv[1]) : 200;
+    auto &kernels      = PackKernels::INSTANCE();
+    auto supported     = kernels.supported();
+    printf("cpu supports %s, %d iterations\n", PackKernels::levelName(supported), iterations);
+
+    struct Resolution {
+        const char *name;
+        int32_t width;
+        int32_t height;
+    } resolutions[] = {{"720p", 1280, 720}, {"1080p", 1920, 1080}, {"4K", 3840, 2160}};
+
+    printf("\nyuv420p plane packing (us/frame, GB/s)\n");
+    printf("%8s %18s", "", "memcpy per row");
+    for (int32_t level = PackKernels::kLevel_Scalar; level <= supported; level++) {
+        printf(" %18s", PackKernels::levelName((PackKernels::Level)level));
+    }
+    printf("\n");
+    for (auto &r : resolutions) {
+        Plane planes[3] = {makePlane(r.width, r.height), makePlane(r.width / 2, r.height / 2), makePlane(r.width / 2, r.height / 2)};
+        size_t bytes    = (size_t)r.width * r.height * 3 / 2;
+        std::vector<uint8_t> dst(bytes);
+
+        double us = measure(iterations, [&]() { packByRow(dst.data(), planes); });
+        printf("%8s %10.1f %6.2f", r.name, us, bytes / us / 1000);
+        for (int32_t level = PackKernels::kLevel_Scalar; level <= supported; level++) {
+            kernels.select((PackKernels::Level)level);
+            us = measure(iterations, [&]() { packByKernel(dst.data(), planes); });
+            printf(" %10.1f %6.2f", us, bytes / us / 1000);
+        }
+        printf("\n");
+        kernels.select(supported);
+    }
+
+    printf("\nyuv420p output conversion (us/frame)\n");
+    printf("%14s", "");
+    for (int32_t level = PackKernels::kLevel_Scalar; level <= supported; level++) {
+        printf(" %10s", PackKernels::levelName((PackKernels::Level)level));
+    }
+    printf("\n");
+    for (auto &r : resolutions) {
+        Plane planes[3]          = {makePlane(r.width, r.height), makePlane(r.width / 2, r.height / 2), makePlane(r.width / 2, r.height / 2)};
+        const uint8_t *data[3]   = {planes[0].data.data(), planes[1].data.data(), planes[2].data.data()};
+        int32_t strides[3]       = {planes[0].stride, planes[1].stride, planes[2].stride};
+        PackKernels::YuvMatrix m = PackKernels::yuvMatrix(r.height >= 720, false);
+        std::vector<uint8_t> dst((size_t)r.width * r.height * 4);
+
+        printf("%8s %5s", r.name, "nv12");
+        for (int32_t level = PackKernels::kLevel_Scalar; level <= supported; level++) {
+            kernels.select((PackKernels::Level)level);
+            double us = measure(iterations, [&]() {
+                kernels.interleaveRows(dst.data(), r.width, data[1], strides[1], data[2], strides[2], r.width / 2, r.height / 2);
+            });
+            printf(" %10.1f", us);
+        }
+        printf("\n%8s %5s", r.name, "rgba");
+        for (int32_t level = PackKernels::kLevel_Scalar; level <= supported; level++) {
+            kernels.select((PackKernels::Level)level);
+            double us = measure(iterations, [&]() { kernels.yuvToRgba(dst.data(), r.width * 4, data, strides, r.width, r.height, 0, m); });
+            printf(" %10.1f", us);
+        }
+        printf("\n");
+        kernels.select(supported);
+    }
+
+    printf("\nplanar to interleaved pcm, 2 channels, 1024 samples (ns/frame)\n");
+    printf("%8s %18s", "", "memcpy per sample");
+    for (int32_t level = PackKernels::kLevel_Scalar; level <= supported; level++) {
+        printf(" %18s", PackKernels::levelName((PackKernels::Level)level));
+    }
+    printf("\n");
+    for (int32_t sampleSize : {2, 4}) {
+        const int32_t samples = 1024;
+        std::vector<uint8_t> left(samples * sampleSize, 1), right(samples * sampleSize, 2), dst(samples * sampleSize * 2);
+        const uint8_t *planes[2] = {left.data(), right.data()};
+        int32_t pcmIterations    = iterations * 100;
+
+        double us = measure(pcmIterations, [&]() { interleaveBySample(dst.data(), planes, 2, samples, sampleSize); });
+        printf("%6s%2d %18.1f", "s", sampleSize * 8, us * 1000);
+        for (int32_t level = PackKernels::kLevel_Scalar; level <= supported; level++) {
+            kernels.select((PackKernels::Level)level);
+            us = measure(pcmIterations, [&]() { kernels.interleave(dst.data(), planes, 2, samples, sampleSize); });
+            printf(" %18.1f", us * 1000);
+        }
+        printf("\n");
+        kernels.select(supported);
+    }
+    return 0;
+}
@@ -0,0 +1,145 @@
+/*
+ * 解码线程预算基准测试
+ * 用法: thread-budget-bench <h264/h265 file> [seconds]
+ * 分别用固定threads=4和全局线程预算(CodecThreadBudget)同时打开1/8/32/128个会话循环解码，统计总的解码帧率
+ */
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "server/codec_thread_budget.h"
+#include "server/nal_units.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include "libavformat/avformat.h"
+#ifdef __cplusplus
+}
+#endif
+
+using decoder::CodecThreadBudget;
+
+static std::vector<AVPacket *> loadPackets(const char *file, AVCodecParameters **par) {
+    std::vector<AVPacket *> packets;
+    AVFormatContext *fmtCtx = nullptr;
+    if (avformat_open_input(&fmtCtx, file, nullptr, nullptr) != 0 || avformat_find_stream_info(fmtCtx, nullptr) < 0) {
+        fprintf(stderr, "open %s failed\n", file);
+        exit(1);
+    }
+
+    int32_t streamIdx = av_find_best_stream(fmtCtx, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+    if (streamIdx < 0) {
+        fprintf(stderr, "no video stream in %s\n", file);
+        exit(1);
+    }
+    *par = fmtCtx->streams[streamIdx]->codecpar;
+
+    AVPacket pkt;
+    av_init_packet(&pkt);
+    while (av_read_frame(fmtCtx, &pkt) == 0) {
+        if (pkt.stream_index == streamIdx) {
+            packets.push_back(av_packet_clone(&pkt));
+        }
+        av_packet_unref(&pkt);
+    }
+    // fmtCtx is kept open, codecpar is owned by it
+    return packets;
+}
+
+static AVCodecContext *openDecoder(AVCodecParameters *par, const CodecThreadBudget::ThreadConfig &config) {
+    AVCodec *dec        = avcodec_find_decoder(par->codec_id);
+    AVCodecContext *ctx = avcodec_alloc_context3(dec);
+    AVDictionary *opts  = nullptr;
+    avcodec_parameters_to_context(ctx, par);
+    av_dict_set(&opts, "threads", std::to_string(config.threads).c_str(), 0);
+    av_dict_set(&opts, "thread_type", config.typeName().c_str(), 0);
+    if (avcodec_open2(ctx, dec, &opts) != 0) {
+        fprintf(stderr, "avcodec_open2 failed\n");
+        exit(1);
+    }
+    av_dict_free(&opts);
+    return ctx;
+}
+
+static double runSessions(AVCodecParameters *par, const std::vector<AVPacket *> &packets, int32_t sessions, bool useBudget, bool live, int32_t seconds) {
+    auto &budget = CodecThreadBudget::INSTANCE();
+    std::vector<uint64_t> ids;
+    std::vector<AVCodecContext *> contexts;
+
+    auto codec     = par->codec_id == AV_CODEC_ID_HEVC ? decoder::NalUnits::kCodec_HEVC : decoder::NalUnits::kCodec_H264;
+    bool wavefront = decoder::NalUnits::wavefrontEnabled(codec, par->extradata, par->extradata_size);
+    for (int32_t i = 0; i < sessions; i++) {
+        ids.push_back(useBudget ? budget.registerSession(par->width, par->height, par->codec_id, live, wavefront) : 0);
+    }
+    // 集中注册时后面的会话只分到剩余的核，等预算稳定后按重新分配的线程数打开
+    if (useBudget) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(budget.kSettleMs));
+        budget.getGeneration();
+    }
+    for (int32_t i = 0; i < sessions; i++) {
+        contexts.push_back(openDecoder(par, useBudget ? budget.getConfig(ids[i]) : CodecThreadBudget::ThreadConfig{4, FF_THREAD_FRAME}));
+    }
+
+    std::atomic<bool> stop{false};
+    std::atomic<uint64_t> frames{0};
+    std::vector<std::thread> threads;
+    auto begin = std::chrono::steady_clock::now();
+    for (int32_t i = 0; i < sessions; i++) {
+        threads.emplace_back([&, i]() {
+            AVCodecContext *ctx = contexts[i];
+            AVFrame *frame      = av_frame_alloc();
+            while (!stop) {
+                for (size_t n = 0; n < packets.size() && !stop; n++) {
+                    avcodec_send_packet(ctx, packets[n]);
+                    while (avcodec_receive_frame(ctx, frame) == 0) {
+                        frames++;
+                    }
+                }
+                avcodec_flush_buffers(ctx);
+            }
+            av_frame_free(&frame);
+        });
+    }
+
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    stop = true;
+    for (auto &t : threads) {
+        t.join();
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    for (int32_t i = 0; i < sessions; i++) {
+        avcodec_free_context(&contexts[i]);
+        if (useBudget) {
+            budget.unregisterSession(ids[i]);
+        }
+    }
+    return frames / elapsed;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <h264/h265 file> [seconds]\n", argv[0]);
+        return -1;
+    }
+    int32_t seconds = argc >= 3 ? atoi(argv[2]) : 10;
+
+    av_log_set_level(AV_LOG_QUIET);
+    AVCodecParameters *par = nullptr;
+    auto packets           = loadPackets(argv[1], &par);
+    printf("%s %dx%d, %zu packets, %u cores\n", avcodec_get_name(par->codec_id), par->width, par->height, packets.size(),
+           std::thread::hardware_concurrency());
+
+    printf("%10s %16s %16s %16s\n", "sessions", "threads=4 fps", "budget vod fps", "budget live fps");
+    for (int32_t sessions : {1, 8, 32, 128}) {
+        double fixed = runSessions(par, packets, sessions, false, false, seconds);
+        double vod   = runSessions(par, packets, sessions, true, false, seconds);
+        double live  = runSessions(par, packets, sessions, true, true, seconds);
+        printf("%10d %16.1f %16.1f %16.1f\n", sessions, fixed, vod, live);
+    }
+    return 0;
+}
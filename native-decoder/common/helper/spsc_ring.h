@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+namespace common {
+
+/*
+ * 单生产者单消费者无锁环形队列
+ * push只能在一个线程调用，pop只能在另一个线程调用，两者都是wait-free的
+ * 容量向上取整为2的幂
+ */
+template <typename T> class SpscRing {
+public:
+    explicit SpscRing(uint32_t capacity) {
+        uint32_t size = 1;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        slots_.resize(size);
+        mask_ = size - 1;
+    }
+
+    SpscRing(const SpscRing &) = delete;
+    SpscRing &operator=(const SpscRing &) = delete;
+
+    // 生产者调用，队列满时返回false
+    bool push(T &&value) {
+        uint64_t head = head_.load(std::memory_order_relaxed);
+        if (head - tail_.load(std::memory_order_acquire) > mask_) {
+            return false;
+        }
+        slots_[head & mask_] = std::move(value);
+        head_.store(head + 1);
+        return true;
+    }
+
+    // 消费者调用，队列空时返回false
+    bool pop(T &value) {
+        uint64_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail == head_.load(std::memory_order_acquire)) {
+            return false;
+        }
+        value = std::move(slots_[tail & mask_]);
+        slots_[tail & mask_] = T();
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const { return head_.load() == tail_.load(); }
+
+    uint64_t size() const { return head_.load() - tail_.load(); }
+
+    uint64_t capacity() const { return mask_ + 1; }
+
+private:
+    std::vector<T> slots_;
+    uint64_t mask_;
+    alignas(64) std::atomic<uint64_t> head_{0}; // 下一个写入位置，生产者独占写
+    alignas(64) std::atomic<uint64_t> tail_{0}; // 下一个读取位置，消费者独占写
+};
+
+} // namespace common
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
 
 namespace common {
@@ -18,6 +19,40 @@ public:
         std::copy(wstr.begin(), wstr.end(), str.begin());
         return str;
     }
+
+    //标准base64解码，忽略非法字符，遇到'='结束
+    static std::string Base64Decode(const std::string &in) {
+        std::string out;
+        out.reserve(in.size() * 3 / 4);
+        uint32_t bits = 0;
+        int32_t nbits = 0;
+        for (char c : in) {
+            int32_t v = -1;
+            if (c >= 'A' && c <= 'Z') {
+                v = c - 'A';
+            } else if (c >= 'a' && c <= 'z') {
+                v = c - 'a' + 26;
+            } else if (c >= '0' && c <= '9') {
+                v = c - '0' + 52;
+            } else if (c == '+' || c == '-') {
+                v = 62;
+            } else if (c == '/' || c == '_') {
+                v = 63;
+            } else if (c == '=') {
+                break;
+            }
+            if (v < 0) {
+                continue;
+            }
+            bits = (bits << 6) | v;
+            nbits += 6;
+            if (nbits >= 8) {
+                nbits -= 8;
+                out.push_back((char)((bits >> nbits) & 0xff));
+            }
+        }
+        return out;
+    }
 };
 
 } // namespace common
\ No newline at end of file
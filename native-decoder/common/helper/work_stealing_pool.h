@@ -0,0 +1,235 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+    #include <pthread.h>
+    #include <sched.h>
+#endif
+
+#ifdef WIN32
+    #include <windows.h>
+#endif
+
+namespace common {
+
+/*
+ * 固定线程数的work-stealing线程池(M:N)
+ * 每个worker绑定一个cpu核，拥有自己的任务队列，任务按priority从小到大执行(EDF，priority一般是截止时间)，
+ * worker空闲时从其他worker偷priority最小的任务，全部为空时休眠，直到有新任务提交
+ */
+class WorkStealingPool {
+public:
+    using Task = std::function<void()>;
+
+    typedef struct tagWorkerStats {
+        uint64_t executed; // 执行的任务数
+        uint64_t steals;   // 从其他worker偷到的任务数
+        uint64_t busyUs;   // 执行任务的时间
+        uint64_t aliveUs;  // worker运行时间
+    } WorkerStats;
+
+    explicit WorkStealingPool(uint32_t size = std::thread::hardware_concurrency(), bool pinned = true) {
+        if (size == 0) {
+            size = 1;
+        }
+        startTime_ = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < size; i++) {
+            workers_.emplace_back(new Worker());
+        }
+        for (uint32_t i = 0; i < size; i++) {
+            workers_[i]->thread = std::thread([this, i]() { workerLoop(i); });
+            if (pinned) {
+                pinThread(workers_[i]->thread, i);
+            }
+        }
+    }
+
+    ~WorkStealingPool() { shutdown(); }
+
+    void shutdown() {
+        {
+            std::unique_lock<std::mutex> lock(sleepMutex_);
+            if (!run_) {
+                return;
+            }
+            run_ = false;
+        }
+        sleepCond_.notify_all();
+        for (auto &w : workers_) {
+            if (w->thread.joinable()) {
+                w->thread.join();
+            }
+        }
+    }
+
+    // 提交任务，不指定priority时以提交时间为priority，即先进先出
+    void submit(Task task) { submit(std::move(task), nowUs()); }
+
+    // 提交任务，worker线程内提交的任务放到自己的队列，外部线程提交的任务轮询分配
+    void submit(Task task, int64_t priority) {
+        uint32_t idx = (current().pool == this) ? current().index : (nextQueue_++ % workers_.size());
+        {
+            Worker &w = *workers_[idx];
+            std::unique_lock<std::mutex> lock(w.mutex);
+            w.tasks.push_back(Entry{priority, nextSeq_++, std::move(task)});
+            std::push_heap(w.tasks.begin(), w.tasks.end(), Entry::later);
+        }
+        {
+            std::unique_lock<std::mutex> lock(sleepMutex_);
+            pending_++;
+        }
+        sleepCond_.notify_one();
+    }
+
+    uint32_t size() const { return workers_.size(); }
+
+    static int64_t nowUs() {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    std::vector<WorkerStats> getStats() const {
+        std::vector<WorkerStats> stats;
+        uint64_t aliveUs = elapsedUs(startTime_);
+        for (auto &w : workers_) {
+            stats.push_back(WorkerStats{w->executed.load(), w->steals.load(), w->busyUs.load(), aliveUs});
+        }
+        return stats;
+    }
+
+private:
+    struct Entry {
+        int64_t priority;
+        uint64_t seq;
+        Task task;
+
+        // 堆比较函数，priority相同时先提交的先执行
+        static bool later(const Entry &a, const Entry &b) { return a.priority != b.priority ? a.priority > b.priority : a.seq > b.seq; }
+    };
+
+    struct Worker {
+        std::mutex mutex;
+        std::vector<Entry> tasks; // 小顶堆
+        std::thread thread;
+        std::atomic<uint64_t> executed{0};
+        std::atomic<uint64_t> steals{0};
+        std::atomic<uint64_t> busyUs{0};
+    };
+
+    struct CurrentWorker {
+        WorkStealingPool *pool = nullptr;
+        uint32_t index         = 0;
+    };
+
+    static CurrentWorker &current() {
+        static thread_local CurrentWorker cw;
+        return cw;
+    }
+
+    static uint64_t elapsedUs(std::chrono::steady_clock::time_point since) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - since).count();
+    }
+
+    void workerLoop(uint32_t index) {
+        current().pool  = this;
+        current().index = index;
+        Worker &self    = *workers_[index];
+
+        while (true) {
+            Task task;
+            if (popLocal(index, task) || steal(index, task)) {
+                auto begin = std::chrono::steady_clock::now();
+                task();
+                self.busyUs += elapsedUs(begin);
+                self.executed++;
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(sleepMutex_);
+            sleepCond_.wait(lock, [this]() { return !run_ || pending_ > 0; });
+            if (!run_) {
+                break;
+            }
+        }
+    }
+
+    // 调用者需持有w.mutex
+    Task popTop(Worker &w) {
+        std::pop_heap(w.tasks.begin(), w.tasks.end(), Entry::later);
+        Task task = std::move(w.tasks.back().task);
+        w.tasks.pop_back();
+        pending_--;
+        return task;
+    }
+
+    bool popLocal(uint32_t index, Task &task) {
+        Worker &w = *workers_[index];
+        std::unique_lock<std::mutex> lock(w.mutex);
+        if (w.tasks.empty()) {
+            return false;
+        }
+        task = popTop(w);
+        return true;
+    }
+
+    // 从所有worker中选出队首priority最小的偷取，保证全局近似EDF
+    bool steal(uint32_t index, Task &task) {
+        Worker *victim   = nullptr;
+        int64_t priority = 0;
+        for (uint32_t i = 1; i < workers_.size(); i++) {
+            Worker &w = *workers_[(index + i) % workers_.size()];
+            std::unique_lock<std::mutex> lock(w.mutex);
+            if (!w.tasks.empty() && (victim == nullptr || w.tasks.front().priority < priority)) {
+                victim   = &w;
+                priority = w.tasks.front().priority;
+            }
+        }
+        if (victim == nullptr) {
+            return false;
+        }
+
+        std::unique_lock<std::mutex> lock(victim->mutex);
+        if (victim->tasks.empty()) {
+            return false;
+        }
+        task = popTop(*victim);
+        workers_[index]->steals++;
+        return true;
+    }
+
+    static void pinThread(std::thread &t, uint32_t index) {
+        uint32_t cores = std::thread::hardware_concurrency();
+        if (cores == 0) {
+            return;
+        }
+#ifdef __linux__
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        CPU_SET(index % cores, &cpuset);
+        pthread_setaffinity_np(t.native_handle(), sizeof(cpu_set_t), &cpuset);
+#endif
+#ifdef WIN32
+        SetThreadAffinityMask((HANDLE)t.native_handle(), (DWORD_PTR)1 << (index % cores));
+#endif
+    }
+
+private:
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::atomic<uint32_t> nextQueue_{0};
+    std::atomic<uint64_t> nextSeq_{0};
+    std::atomic<int64_t> pending_{0};
+    std::mutex sleepMutex_;
+    std::condition_variable sleepCond_;
+    bool run_ = true;
+    std::chrono::steady_clock::time_point startTime_;
+};
+
+} // namespace common
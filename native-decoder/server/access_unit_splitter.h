@@ -0,0 +1,173 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <vector>
+
+#include "server/nal_units.h"
+
+namespace decoder {
+
+/*
+ * 实况H.264/H.265 Annex-B裸流的访问单元(一帧)切分，代替avformat的h264/hevc demuxer和parser
+ * 解码线程把接收缓冲区的数据直接读到这里，用NalUnits::findStartCode查找起始码，按NAL头判断访问单元的边界:
+ *   AUD、参数集、SEI等非VCL单元出现在VCL单元之后，或者一帧的第一个slice(first_mb_in_slice为0/first_slice_segment_in_pic_flag为1)
+ * 字节流输入时访问单元在下一帧的第一个NAL单元到达时结束；客户端按访问单元发送时消息的结尾也是访问单元的结尾，不用等下一帧
+ * 切分出的访问单元按顺序排队，只有解码线程调用，empty()可以在其他线程调用
+ */
+class AccessUnitSplitter {
+public:
+    const size_t kMaxUnitSize    = 8 * 1024 * 1024; // 超过时丢弃正在拼接的访问单元，避免没有起始码的数据无限增长
+    const int32_t kStartCodeSize = 3;
+
+    typedef struct tagAccessUnit {
+        const uint8_t *data; // 从第一个NAL单元的起始码开始
+        size_t size;
+        bool keyframe; // 包含H.264 IDR或H.265 IRAP
+    } AccessUnit;
+
+    void reset(NalUnits::Codec codec) {
+        codec_   = codec;
+        size_    = 0;
+        scanned_ = 0;
+        floor_   = 0;
+        auBegin_ = -1;
+        auVcl_   = false;
+        auKey_   = false;
+        pending_ = 0;
+        queue_.clear();
+    }
+
+    // 返回可以写入size字节的位置，写入后调用commit，之前front()返回的数据失效
+    uint8_t *prepare(size_t size) {
+        size_t keep = queue_.empty() ? (auBegin_ >= 0 ? (size_t)auBegin_ : scanned_) : queue_.front().begin;
+        if (keep > 0 && (keep >= size_ / 2 || size_ + size > buffer_.size())) {
+            memmove(buffer_.data(), buffer_.data() + keep, size_ - keep);
+            for (auto &unit : queue_) {
+                unit.begin -= keep;
+                unit.end -= keep;
+            }
+            auBegin_ = auBegin_ >= 0 ? auBegin_ - (int64_t)keep : -1;
+            scanned_ -= keep;
+            floor_ = floor_ > keep ? floor_ - keep : 0;
+            size_ -= keep;
+        }
+        if (size_ + size > buffer_.size()) {
+            buffer_.resize(std::max(size_ + size, buffer_.size() * 2));
+        }
+        return buffer_.data() + size_;
+    }
+
+    // 写入了size字节，unitEnd为true表示数据到达访问单元的结尾(客户端按访问单元发送的一条消息结束)
+    void commit(size_t size, bool unitEnd) {
+        size_ += size;
+        scan();
+        if (unitEnd) {
+            // 只有参数集等非VCL单元的消息和下一条消息合并为一个访问单元
+            if (auVcl_) {
+                closeUnit(size_);
+            }
+            scanned_ = size_;
+            floor_   = size_;
+        }
+        if (auBegin_ >= 0 && size_ - auBegin_ > kMaxUnitSize) {
+            dropped_++;
+            auBegin_ = -1;
+            auVcl_   = false;
+            auKey_   = false;
+        }
+    }
+
+    bool empty() const { return pending_ == 0; }
+
+    // 队列中第一个访问单元，在pop或prepare前有效
+    AccessUnit front() const {
+        const Unit &unit = queue_.front();
+        return AccessUnit{buffer_.data() + unit.begin, unit.end - unit.begin, unit.keyframe};
+    }
+
+    void pop() {
+        queue_.pop_front();
+        pending_--;
+    }
+
+    uint64_t getUnits() const { return units_; }
+
+    uint64_t getDropped() const { return dropped_; }
+
+private:
+    struct Unit {
+        size_t begin  = 0;
+        size_t end    = 0;
+        bool keyframe = false;
+    };
+
+    void scan() {
+        // 判断访问单元的边界需要NAL头和slice头的第一个字节
+        const int32_t peekSize = kStartCodeSize + NalUnits::headerSize(codec_) + 1;
+        const uint8_t *base    = buffer_.data();
+        const uint8_t *end     = base + size_;
+        while (true) {
+            const uint8_t *sc = NalUnits::findStartCode(base + scanned_, end);
+            if (end - sc < peekSize) {
+                // 起始码可能跨过本次数据的结尾，从可能的起始位置继续查找；访问单元结束时没有下一个NAL单元
+                scanned_ = sc < end ? sc - base : std::max<size_t>(scanned_, size_ - std::min<size_t>(size_, kStartCodeSize - 1));
+                break;
+            }
+
+            size_t start     = sc - base;
+            size_t unitBegin = start > floor_ && base[start - 1] == 0 ? start - 1 : start; // 4字节起始码
+            onNal(sc + kStartCodeSize, unitBegin);
+            scanned_ = start + kStartCodeSize;
+            floor_   = scanned_;
+        }
+    }
+
+    void onNal(const uint8_t *nal, size_t unitBegin) {
+        int32_t type  = NalUnits::nalType(codec_, nal[0]);
+        bool vcl      = NalUnits::isVcl(codec_, type);
+        bool boundary = vcl ? (nal[NalUnits::headerSize(codec_)] & 0x80) != 0 : NalUnits::startsAccessUnit(codec_, type);
+        if (auVcl_ && boundary) {
+            closeUnit(unitBegin);
+        }
+        if (auBegin_ < 0) {
+            auBegin_ = unitBegin;
+        }
+        if (vcl) {
+            auVcl_ = true;
+            auKey_ = auKey_ || NalUnits::isKeyframe(codec_, type);
+        }
+    }
+
+    void closeUnit(size_t end) {
+        Unit unit;
+        unit.begin    = auBegin_;
+        unit.end      = end;
+        unit.keyframe = auKey_;
+        queue_.push_back(unit);
+        pending_++;
+        units_++;
+        auBegin_ = -1;
+        auVcl_   = false;
+        auKey_   = false;
+    }
+
+private:
+    NalUnits::Codec codec_ = NalUnits::kCodec_None;
+    std::vector<uint8_t> buffer_;
+    size_t size_     = 0;  // buffer_中有效数据的字节数
+    size_t scanned_  = 0;  // 下一次查找起始码的偏移
+    size_t floor_    = 0;  // 上一个起始码的结尾，4字节起始码的第一个0不早于这里
+    int64_t auBegin_ = -1; // 正在拼接的访问单元的偏移，还没有NAL单元时为-1
+    bool auVcl_      = false;
+    bool auKey_      = false;
+    std::deque<Unit> queue_;
+    std::atomic<size_t> pending_{0};
+    std::atomic<uint64_t> units_{0};
+    std::atomic<uint64_t> dropped_{0};
+};
+
+} // namespace decoder
@@ -0,0 +1,312 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "common/helper/singleton.h"
+#include "common/helper/threadpool.h"
+#include "server/codec_thread_budget.h"
+#include "server/frame_buffer_pool.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include "libavcodec/avcodec.h"
+#ifdef __cplusplus
+}
+#endif
+
+namespace decoder {
+
+/*
+ * 已经打开的H.264/H.265视频解码上下文池，会话集中打开(如监控墙页面加载)时不用每个都avcodec_open2创建帧线程
+ * 上下文按编码格式和线程类型分组，会话打开时取出空闲的上下文，用avcodec_parameters_to_context更新参数，关闭时清空缓存后放回
+ * 打开后的解码器不会再解析extradata，所以只用于参数集在码流中的Annex-B输入，Annex-B的extradata作为第一个包送给解码器
+ * 每组的目标空闲数按最近的打开数调整(能满足kWarmSeconds内的打开)，空闲的用完时在后台预先打开，超过目标或空闲太久的上下文释放
+ * 集中打开期间线程预算给新会话的份额不断变小，这时可以取线程数较少的上下文，后台也按单线程预先打开(会话多于核数时的稳定分配)，
+ * 份额更大的会话在预算稳定后的关键帧处按新的线程数重建
+ */
+class CodecContextPool {
+public:
+    const double kWarmSeconds          = 2.0;
+    const int32_t kMaxIdlePerKey       = 64;
+    const int32_t kMaxIdle             = 128; // 所有分组的空闲上下文上限
+    const int64_t kIdleTimeoutMs       = 30 * 1000;
+    const int64_t kRateWindowMs        = 5000; // 统计打开速率的周期
+    const int32_t kWarmAhead           = 4; // 每组同时在后台打开的上限，突发结束后不会多打开很多
+    static const uint16_t kWarmThreads = 2;
+
+    typedef struct tagStats {
+        uint64_t hits;     // 取到空闲上下文的次数
+        uint64_t misses;   // 没有空闲上下文，当场打开的次数
+        uint64_t warmed;   // 后台预先打开的上下文数
+        uint64_t released; // 超过目标或空闲太久释放的上下文数
+        int32_t idle;
+    } Stats;
+
+    static CodecContextPool &INSTANCE() { return common::Singleton<CodecContextPool>::getInstance(); }
+
+    ~CodecContextPool() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (auto &it : groups_) {
+            for (auto &idle : it.second.idle) {
+                avcodec_free_context(&idle.ctx);
+            }
+        }
+    }
+
+    // 只有H.264/H.265，并且extradata为空或者是Annex-B格式时可以使用池
+    static bool eligible(const AVCodecParameters *par) {
+        if (par->codec_id != AV_CODEC_ID_H264 && par->codec_id != AV_CODEC_ID_HEVC) {
+            return false;
+        }
+        const uint8_t *p = par->extradata;
+        int32_t size     = par->extradata_size;
+        return size == 0 || (size >= 3 && p[0] == 0 && p[1] == 0 && (p[2] == 1 || (size >= 4 && p[2] == 0 && p[3] == 1)));
+    }
+
+    // 取出一个上下文并更新参数，失败返回nullptr
+    // burst为true时(集中打开期间)没有相同线程数的上下文可以取线程数较少的，config返回取出的上下文的线程配置
+    AVCodecContext *checkout(const AVCodecParameters *par, CodecThreadBudget::ThreadConfig &config, bool burst) {
+        Key key             = Key(par->codec_id, config.threadType);
+        AVCodecContext *ctx = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            Group &g = groups_[key];
+            updateRateLocked(g, nowMs());
+            g.windowOpens++;
+            auto it = takeLocked(g, config.threads, burst);
+            if (it != g.idle.end()) {
+                ctx            = it->ctx;
+                config.threads = it->threads;
+                g.idle.erase(it);
+                idle_--;
+                hits_++;
+            } else {
+                misses_++;
+            }
+        }
+        // 空闲的上下文用完时说明需求超过了保留的数量，后台补充到目标数量，命中时不补充，会话关闭时会放回
+        if (ctx == nullptr) {
+            warm(key, burst ? 1 : config.threads);
+        }
+
+        if (ctx == nullptr && (ctx = create(par->codec_id, config)) == nullptr) {
+            return nullptr;
+        }
+        if (!reconfigure(ctx, par)) {
+            avcodec_free_context(&ctx);
+            return nullptr;
+        }
+        return ctx;
+    }
+
+    // 会话关闭时放回，config为打开时的线程配置，超过目标数量时释放
+    void checkin(AVCodecContext *ctx, const CodecThreadBudget::ThreadConfig &config) {
+        avcodec_flush_buffers(ctx);
+        ctx->skip_frame = AVDISCARD_DEFAULT;
+
+        Key key = Key(ctx->codec_id, config.threadType);
+        std::vector<AVCodecContext *> released;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            Group &g = groups_[key];
+            g.idle.push_back(Idle{ctx, nowMs(), config.threads});
+            idle_++;
+            trimLocked(released);
+        }
+        release(released);
+    }
+
+    Stats getStats() {
+        std::vector<AVCodecContext *> released;
+        Stats stats;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            trimLocked(released);
+            stats = Stats{hits_, misses_, warmed_, released_, idle_};
+        }
+        release(released);
+        return stats;
+    }
+
+private:
+    typedef std::tuple<int32_t, int32_t> Key; // codec id, thread type
+
+    struct Idle {
+        AVCodecContext *ctx = nullptr;
+        int64_t sinceMs     = 0;
+        int32_t threads     = 1;
+    };
+
+    struct Group {
+        std::deque<Idle> idle; // 后放回的在后面，先取出
+        int32_t warming       = 0;
+        int64_t windowBeginMs = 0;
+        int32_t windowOpens   = 0;
+        int32_t lastOpens     = 0; // 上一个周期的打开数，刚结束的集中打开的规模
+        double rate           = 0; // 每秒打开数
+    };
+
+    static int64_t nowMs() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    static std::threadpool &warmExecutor() {
+        static std::threadpool pool(kWarmThreads);
+        return pool;
+    }
+
+    // 打开一个没有参数的上下文，选项和FFmpegWrapper::openCodecContext一致
+    static AVCodecContext *create(int32_t codecId, const CodecThreadBudget::ThreadConfig &config) {
+        AVCodec *dec = avcodec_find_decoder((enum AVCodecID)codecId);
+        if (dec == nullptr) {
+            return nullptr;
+        }
+        AVCodecContext *ctx = avcodec_alloc_context3(dec);
+        if (ctx == nullptr) {
+            return nullptr;
+        }
+
+        // 视频帧从进程级的帧池分配，复用内存
+        ctx->get_buffer2 = FrameBufferPool::getBuffer2;
+#if LIBAVCODEC_VERSION_MAJOR < 59
+        ctx->thread_safe_callbacks = 1;
+#endif
+
+        AVDictionary *opts = nullptr;
+        av_dict_set(&opts, "refcounted_frames", "0", 0);
+        av_dict_set(&opts, "threads", std::to_string(config.threads).c_str(), 0);
+        av_dict_set(&opts, "thread_type", config.typeName().c_str(), 0);
+        int32_t ret = avcodec_open2(ctx, dec, &opts);
+        av_dict_free(&opts);
+        if (ret != 0) {
+            avcodec_free_context(&ctx);
+            return nullptr;
+        }
+        return ctx;
+    }
+
+    // 更新会话的参数，Annex-B的extradata(参数集)作为一个包送给解码器
+    static bool reconfigure(AVCodecContext *ctx, const AVCodecParameters *par) {
+        if (avcodec_parameters_to_context(ctx, par) != 0) {
+            return false;
+        }
+        if (par->extradata_size > 0) {
+            AVPacket packet;
+            av_init_packet(&packet);
+            packet.data = par->extradata;
+            packet.size = par->extradata_size;
+            if (avcodec_send_packet(ctx, &packet) < 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // 优先取线程数相同、最后放回的上下文，allowFewer时没有相同的取线程数较少的里面最多的
+    static std::deque<Idle>::iterator takeLocked(Group &g, int32_t threads, bool allowFewer) {
+        auto best = g.idle.end();
+        for (auto it = g.idle.rbegin(); it != g.idle.rend(); ++it) {
+            if (it->threads == threads) {
+                return std::next(it).base();
+            }
+            if (allowFewer && it->threads < threads && (best == g.idle.end() || it->threads > best->threads)) {
+                best = std::next(it).base();
+            }
+        }
+        return best;
+    }
+
+    // 最近一个周期的打开速率和当前、上一个周期的打开数，取较大的作为需求，页面在下一个周期内重新加载时都能取到
+    int32_t targetLocked(const Group &g) const {
+        double demand = std::max({g.rate * kWarmSeconds, (double)g.windowOpens, (double)g.lastOpens});
+        return std::min(kMaxIdlePerKey, (int32_t)std::ceil(demand));
+    }
+
+    void updateRateLocked(Group &g, int64_t now) {
+        int64_t elapsed = now - g.windowBeginMs;
+        if (g.windowBeginMs == 0) {
+            g.windowBeginMs = now;
+        } else if (elapsed >= kRateWindowMs) {
+            g.rate          = (g.rate + g.windowOpens * 1000.0 / elapsed) / 2;
+            g.lastOpens     = elapsed < 2 * kRateWindowMs ? g.windowOpens : 0;
+            g.windowOpens   = 0;
+            g.windowBeginMs = now;
+        }
+    }
+
+    // 空闲数低于目标时在后台按threads个线程补充
+    void warm(const Key &key, int32_t threads) {
+        int32_t count = 0;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            Group &g = groups_[key];
+            count    = std::min({targetLocked(g) - (int32_t)g.idle.size() - g.warming, kWarmAhead - g.warming, kMaxIdle - idle_ - warming_});
+            if (count <= 0) {
+                return;
+            }
+            g.warming += count;
+            warming_ += count;
+        }
+
+        for (int32_t i = 0; i < count; i++) {
+            warmExecutor().commit([this, key, threads]() {
+                AVCodecContext *ctx = create(std::get<0>(key), CodecThreadBudget::ThreadConfig{threads, std::get<1>(key)});
+                std::unique_lock<std::mutex> lock(mutex_);
+                Group &g = groups_[key];
+                g.warming--;
+                warming_--;
+                if (ctx != nullptr) {
+                    g.idle.push_back(Idle{ctx, nowMs(), threads});
+                    idle_++;
+                    warmed_++;
+                }
+            });
+        }
+    }
+
+    // 释放超过目标数量(先释放最早放回的)和空闲超过kIdleTimeoutMs的上下文，释放在锁外进行
+    void trimLocked(std::vector<AVCodecContext *> &released) {
+        int64_t now = nowMs();
+        for (auto &it : groups_) {
+            Group &g = it.second;
+            updateRateLocked(g, now);
+            int32_t target = targetLocked(g);
+            while (!g.idle.empty() && ((int32_t)g.idle.size() > target || idle_ > kMaxIdle || now - g.idle.front().sinceMs > kIdleTimeoutMs)) {
+                released.push_back(g.idle.front().ctx);
+                g.idle.pop_front();
+                idle_--;
+                released_++;
+            }
+        }
+    }
+
+    static void release(std::vector<AVCodecContext *> &released) {
+        for (auto ctx : released) {
+            avcodec_free_context(&ctx);
+        }
+    }
+
+private:
+    std::mutex mutex_;
+    std::map<Key, Group> groups_;
+    int32_t idle_      = 0;
+    int32_t warming_   = 0;
+    uint64_t hits_     = 0;
+    uint64_t misses_   = 0;
+    uint64_t warmed_   = 0;
+    uint64_t released_ = 0;
+};
+
+} // namespace decoder
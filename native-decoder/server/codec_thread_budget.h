@@ -0,0 +1,181 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "common/helper/singleton.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include "libavcodec/avcodec.h"
+#ifdef __cplusplus
+}
+#endif
+
+namespace decoder {
+
+/*
+ * 全局解码线程预算
+ * 所有会话的codec线程数之和不超过cpu核数，按分辨率和编码复杂度(hevc约为h264的2倍)分配，
+ * 会话数超过核数时每个会话单线程，会话间并行即可跑满cpu；只有少量大分辨率会话时，分配更多线程
+ * 点播会话使用frame多线程(吞吐高，但每个线程增加一帧延迟)；实况会话只有码流启用了WPP时使用slice多线程(不增加延迟)，
+ * 单slice的码流slice多线程没有并行度，使用frame多线程但最多kMaxLiveFrameThreads个线程，限制增加的延迟
+ * (AV_CODEC_FLAG_LOW_DELAY会关闭frame多线程，不设置)
+ * 线程数取不超过份额的2的幂，只有变化一倍以上才需要重建codec
+ * 新会话按当前的份额打开，但不超过其他会话已分配之外剩余的核数(至少1个)，集中打开时线程数之和不会超过核数；
+ * 已有会话在打开和关闭停止kSettleMs之后才重新分配(集中打开时只调整一次)，generation变化后会话在下一个关键帧重建codec
+ */
+class CodecThreadBudget {
+public:
+    const int32_t kMaxThreadsPerSession = 16;
+    const int32_t kMaxLiveFrameThreads  = 2;
+    const double kReferencePixels       = 1920.0 * 1080.0;
+    const int64_t kSettleMs             = 2000;
+
+    typedef struct tagThreadConfig {
+        int32_t threads;
+        int32_t threadType; // FF_THREAD_FRAME or FF_THREAD_SLICE
+
+        bool operator==(const tagThreadConfig &o) const { return threads == o.threads && threadType == o.threadType; }
+        bool operator!=(const tagThreadConfig &o) const { return !(*this == o); }
+
+        // 转成avcodec_open2的参数
+        std::string typeName() const { return threadType == FF_THREAD_SLICE ? "slice" : "frame"; }
+    } ThreadConfig;
+
+    CodecThreadBudget() {
+        cores_ = std::thread::hardware_concurrency();
+        if (cores_ <= 0) {
+            cores_ = 1;
+        }
+    }
+
+    static CodecThreadBudget &INSTANCE() { return common::Singleton<CodecThreadBudget>::getInstance(); }
+
+    // 注册会话，返回会话id，wavefront为码流启用了WPP(见NalUnits::wavefrontEnabled)
+    uint64_t registerSession(int32_t width, int32_t height, enum AVCodecID codecId, bool live, bool wavefront) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        int32_t free = cores_ - assignedLocked();
+        uint64_t id  = nextId_++;
+        Session &s   = sessions_[id];
+        s.weight     = std::max(1.0, (double)width * height) / kReferencePixels * (codecId == AV_CODEC_ID_HEVC ? 2.0 : 1.0);
+        s.live       = live;
+        s.wavefront  = wavefront;
+        s.config     = targetLocked(s, totalWeightLocked(), std::max(1, free));
+        markChanged();
+        return id;
+    }
+
+    void unregisterSession(uint64_t id) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (sessions_.erase(id) > 0) {
+            markChanged();
+        }
+    }
+
+    ThreadConfig getConfig(uint64_t id) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        auto it = sessions_.find(id);
+        return it == sessions_.end() ? ThreadConfig{1, FF_THREAD_FRAME} : it->second.config;
+    }
+
+    // 每次分配结果变化时递增，会话数稳定了kSettleMs后在这里重新分配已有会话
+    uint64_t getGeneration() {
+        if (pending_ && nowMs() - changedMs_ >= kSettleMs) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (pending_ && nowMs() - changedMs_ >= kSettleMs) {
+                pending_ = false;
+                rebalanceLocked();
+            }
+        }
+        return generation_;
+    }
+
+    // 最近kSettleMs内没有会话打开或关闭，并且已经重新分配
+    bool settled() const { return !pending_ && nowMs() - changedMs_ >= kSettleMs; }
+
+    int32_t getSessionCount() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        return sessions_.size();
+    }
+
+private:
+    struct Session {
+        double weight;
+        bool live;
+        bool wavefront;
+        ThreadConfig config;
+    };
+
+    static int64_t nowMs() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void markChanged() {
+        changedMs_ = nowMs();
+        pending_   = true;
+    }
+
+    double totalWeightLocked() const {
+        double totalWeight = 0;
+        for (auto &it : sessions_) {
+            totalWeight += it.second.weight;
+        }
+        return totalWeight;
+    }
+
+    // 已经分配给各会话的线程数之和
+    int32_t assignedLocked() const {
+        int32_t assigned = 0;
+        for (auto &it : sessions_) {
+            assigned += it.second.config.threads;
+        }
+        return assigned;
+    }
+
+    // 按权重的份额，取不超过份额和available的2的幂
+    ThreadConfig targetLocked(const Session &s, double totalWeight, int32_t available) const {
+        bool slice      = s.live && s.wavefront;
+        int32_t share   = std::min((int32_t)(cores_ * s.weight / totalWeight), available);
+        int32_t limit   = std::min(s.live && !slice ? kMaxLiveFrameThreads : kMaxThreadsPerSession, cores_);
+        int32_t threads = 1;
+        while (threads * 2 <= std::min(share, limit)) {
+            threads *= 2;
+        }
+        return ThreadConfig{threads, slice ? FF_THREAD_SLICE : FF_THREAD_FRAME};
+    }
+
+    void rebalanceLocked() {
+        double totalWeight = totalWeightLocked();
+        bool changed       = false;
+        for (auto &it : sessions_) {
+            Session &s     = it.second;
+            ThreadConfig c = targetLocked(s, totalWeight, cores_);
+            if (c != s.config) {
+                s.config = c;
+                changed  = true;
+            }
+        }
+
+        if (changed) {
+            generation_++;
+        }
+    }
+
+private:
+    std::mutex mutex_;
+    int32_t cores_;
+    uint64_t nextId_ = 1;
+    std::atomic<uint64_t> generation_{0};
+    std::atomic<bool> pending_{false};  // 有会话打开或关闭，已有会话还没有重新分配
+    std::atomic<int64_t> changedMs_{0}; // 最近一次打开或关闭的时间
+    std::map<uint64_t, Session> sessions_;
+};
+
+} // namespace decoder
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+
+#include <zlib.h>
+
+#include "common/helper/singleton.h"
+#include "common/helper/work_stealing_pool.h"
+
+namespace decoder {
+
+/*
+ * 进程的空闲CPU比例，按解码线程池最近一段时间的忙碌时间估算，最多每kSampleUs采样一次
+ */
+class SpareCpu {
+public:
+    const int64_t kSampleUs = 200 * 1000;
+
+    static SpareCpu &INSTANCE() { return common::Singleton<SpareCpu>::getInstance(); }
+
+    double spare() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        int64_t now = common::WorkStealingPool::nowUs();
+        if (now - sampleUs_ < kSampleUs) {
+            return spare_;
+        }
+
+        uint64_t busyUs  = 0;
+        uint64_t aliveUs = 0;
+        for (auto &w : common::Singleton<common::WorkStealingPool>::getInstance().getStats()) {
+            busyUs += w.busyUs;
+            aliveUs += w.aliveUs;
+        }
+        if (aliveUs > aliveUs_) {
+            spare_ = 1.0 - std::min(1.0, (double)(busyUs - busyUs_) / (aliveUs - aliveUs_));
+        }
+        busyUs_   = busyUs;
+        aliveUs_  = aliveUs;
+        sampleUs_ = now;
+        return spare_;
+    }
+
+private:
+    std::mutex mutex_;
+    int64_t sampleUs_ = 0;
+    uint64_t busyUs_  = 0;
+    uint64_t aliveUs_ = 0;
+    double spare_     = 1.0;
+};
+
+/*
+ * 每个连接的压缩策略，按消息类型、大小、最近的压缩比和空闲CPU决定每条消息是否压缩、压缩级别、是否使用保留的上下文
+ *   控制消息(JSON): 小而重复多，使用连接保留的上下文(context takeover)，默认级别
+ *   音频: PCM几乎没有跨消息的重复，不保留上下文，最快级别，压缩比太低时不压缩
+ *   视频: 分片压缩(见SliceCompressor)，级别不超过客户端指定的值，CPU紧张时降到最快级别或不压缩
+ * 压缩比低于kMinRatio的类型暂停压缩，每kProbeInterval条消息试探一次，画面变化后可以恢复
+ */
+class CompressionPolicy {
+public:
+    typedef enum MessageType {
+        kMessage_Control = 0,
+        kMessage_Audio,
+        kMessage_Video,
+        kMessage_Count,
+    } MessageType;
+
+    typedef struct tagDecision {
+        bool compress;
+        int32_t level;
+        bool takeover; // 使用连接保留的上下文
+    } Decision;
+
+    typedef struct tagStats {
+        uint64_t compressed;   // 尝试压缩的消息数，压缩后没有变小时按原样发送
+        uint64_t uncompressed; // 不压缩发送的消息数
+        double ratio;          // 最近的压缩比，还没有压缩过时为0
+    } Stats;
+
+    const size_t kMinBytes        = 256; // 更小的消息压缩后基本不会变小
+    const double kMinRatio        = 1.1;
+    const uint32_t kProbeInterval = 32;
+    const double kLowSpareCpu     = 0.25; // 低于该空闲比例时降到最快级别
+    const double kMinSpareCpu     = 0.1;  // 低于该空闲比例时只压缩控制消息
+    const int32_t kControlLevel   = Z_DEFAULT_COMPRESSION;
+
+    // maxLevel为允许的最高级别，控制消息和音频在没有协商permessage-deflate时为0，视频为客户端指定的级别，0为不压缩
+    Decision decide(MessageType type, size_t size, int32_t maxLevel) {
+        Decision d{false, 0, false};
+        std::unique_lock<std::mutex> lock(mutex_);
+        Stat &s = stats_[type];
+        if (maxLevel <= 0 || size < kMinBytes) {
+            s.uncompressed++;
+            return d;
+        }
+
+        double spare = SpareCpu::INSTANCE().spare();
+        bool poor    = s.ratio > 0 && s.ratio < kMinRatio && ++s.sinceProbe < kProbeInterval;
+        if (poor || (type != kMessage_Control && spare < kMinSpareCpu)) {
+            s.uncompressed++;
+            return d;
+        }
+
+        s.sinceProbe = 0;
+        d.compress   = true;
+        switch (type) {
+            case kMessage_Control:
+                d.level    = kControlLevel;
+                d.takeover = true;
+                break;
+            case kMessage_Audio:
+                d.level = Z_BEST_SPEED;
+                break;
+            default:
+                d.level = spare < kLowSpareCpu ? Z_BEST_SPEED : maxLevel;
+                break;
+        }
+        return d;
+    }
+
+    // 压缩后的结果，compressedBytes不小于rawBytes时表示压缩没有收益(按原样发送)
+    void onCompressed(MessageType type, size_t rawBytes, size_t compressedBytes) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        Stat &s      = stats_[type];
+        double ratio = compressedBytes > 0 ? (double)rawBytes / compressedBytes : 1.0;
+        s.ratio      = s.ratio == 0 ? ratio : (s.ratio * 7 + ratio) / 8;
+        s.compressed++;
+    }
+
+    Stats getStats(MessageType type) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        return Stats{stats_[type].compressed, stats_[type].uncompressed, stats_[type].ratio};
+    }
+
+private:
+    struct Stat {
+        double ratio          = 0;
+        uint32_t sinceProbe   = 0;
+        uint64_t compressed   = 0;
+        uint64_t uncompressed = 0;
+    };
+
+    std::mutex mutex_;
+    Stat stats_[kMessage_Count];
+};
+
+} // namespace decoder
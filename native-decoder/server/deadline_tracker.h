@@ -0,0 +1,95 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+
+#include "common/helper/work_stealing_pool.h"
+
+namespace decoder {
+
+/*
+ * 根据帧pts和客户端上报的播放时钟计算会话下一帧的显示截止时间，用于解码任务的EDF调度
+ * 客户端没有上报时钟时，截止时间为数据就绪时间加上一个延迟预算(实况小，点播大)
+ * 实况会话的priority总是小于点播会话，保证过载时优先解码实况
+ */
+class DeadlineTracker {
+public:
+    const int64_t kLiveBudgetUs        = 100 * 1000;
+    const int64_t kVodBudgetUs         = 1000 * 1000;
+    const int64_t kBackgroundClassUs   = (int64_t)1 << 50; // 点播会话的priority偏移，大于任何截止时间差
+    const double kDefaultFrameDuration = 0.04;
+    const double kMaxFrameDuration     = 1.0;
+
+    void setLive(bool live) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        live_ = live;
+    }
+
+    // 客户端上报当前显示帧的pts(秒)
+    void updateClock(double position) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        clockValid_    = true;
+        clockPosition_ = position;
+        clockUs_       = nowUs();
+    }
+
+    // 会话有数据待解码，开始计算截止时间
+    void onPending() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        pendingUs_ = nowUs();
+    }
+
+    // 解码出一帧视频，统计是否错过截止时间，并推算下一帧pts
+    void onVideoFrame(double pts) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (nowUs() > deadlineOf(pts)) {
+            misses_++;
+        }
+        frames_++;
+
+        if (hasLastPts_ && pts > lastPts_ && pts - lastPts_ < kMaxFrameDuration) {
+            frameDuration_ = pts - lastPts_;
+        }
+        hasLastPts_ = true;
+        lastPts_    = pts;
+    }
+
+    // 下一帧的截止时间，实况会话排在点播会话之前
+    int64_t priority() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        int64_t deadline = hasLastPts_ ? deadlineOf(lastPts_ + frameDuration_) : pendingUs_ + budgetUs();
+        return live_ ? deadline : deadline + kBackgroundClassUs;
+    }
+
+    uint64_t getMisses() const { return misses_; }
+
+    uint64_t getFrames() const { return frames_; }
+
+private:
+    static int64_t nowUs() { return common::WorkStealingPool::nowUs(); }
+
+    int64_t budgetUs() const { return live_ ? kLiveBudgetUs : kVodBudgetUs; }
+
+    // 调用者需持有mutex_
+    int64_t deadlineOf(double pts) const {
+        if (clockValid_) {
+            return clockUs_ + (int64_t)((pts - clockPosition_) * 1000000);
+        }
+        return pendingUs_ + budgetUs();
+    }
+
+private:
+    std::mutex mutex_;
+    bool live_            = false;
+    bool clockValid_      = false;
+    double clockPosition_ = 0;
+    int64_t clockUs_      = 0;
+    int64_t pendingUs_    = 0;
+    bool hasLastPts_      = false;
+    double lastPts_       = 0;
+    double frameDuration_ = kDefaultFrameDuration;
+    std::atomic<uint64_t> misses_{0};
+    std::atomic<uint64_t> frames_{0};
+};
+
+} // namespace decoder
@@ -5,10 +5,14 @@
 #include <websocketpp/server.hpp>
 
 #include "server/ffmpeg_wrapper.h"
+#include "server/message_compressor.h"
+#include "server/parallel_packer.h"
 #include "server/pojo.h"
 #include "server/server_config.h"
+#include "server/slice_compressor.h"
 
 #include "common/helper/logger.h"
+#include "common/helper/stringconv.h"
 #include "common/helper/threadpool.h"
 
 namespace decoder {
@@ -21,6 +25,8 @@ public:
     using WsOpcode         = ws::frame::opcode::value;
     using FFmpegWrapperPtr = std::shared_ptr<FFmpegWrapper>;
     using ConnMap          = std::map<WsConnection, FFmpegWrapperPtr, std::owner_less<WsConnection>>;
+    using CompressorPtr    = std::shared_ptr<MessageCompressor>;
+    using CompressorMap    = std::map<WsConnection, CompressorPtr, std::owner_less<WsConnection>>;
     using TextMsgProc      = std::function<void(FFmpegWrapperPtr ffmpeg, WsConnection hdl, WsServer::message_ptr msg)>;
 
     DecodeServer() {}
@@ -36,6 +42,9 @@ public:
         endpoint_.set_access_channels(ws::log::alevel::access_core);
         endpoint_.set_access_channels(ws::log::alevel::app);
         endpoint_.set_reuse_addr(true);
+        MessagePool::INSTANCE().setCeiling(ws::config::ServerConfig::message_pool_ceiling);
+        ZlibBudget::INSTANCE().setCeiling(ws::config::ServerConfig::zlib_ceiling);
+        LOG_INFO("Pack kernels use {}.", PackKernels::levelName(PackKernels::INSTANCE().level()));
 
         using std::placeholders::_1;
         using std::placeholders::_2;
@@ -53,6 +62,11 @@ public:
         textProcs_["closeDecoder"]  = std::bind(&DecodeServer::closeDecoder, this, _1, _2, _3);
         textProcs_["startDecode"]   = std::bind(&DecodeServer::startDecode, this, _1, _2, _3);
         textProcs_["stopDecode"]    = std::bind(&DecodeServer::stopDecode, this, _1, _2, _3);
+        textProcs_["updateClock"]   = std::bind(&DecodeServer::updateClock, this, _1, _2, _3);
+        textProcs_["setOutputSize"] = std::bind(&DecodeServer::setOutputSize, this, _1, _2, _3);
+        textProcs_["grantCredit"]   = std::bind(&DecodeServer::grantCredit, this, _1, _2, _3);
+        textProcs_["getStats"]      = std::bind(&DecodeServer::getStats, this, _1, _2, _3);
+        textProcs_["openSession"]   = std::bind(&DecodeServer::openSession, this, _1, _2, _3);
 
         std::stringstream ss;
         ss << "Running server on port " << port;
@@ -86,11 +100,25 @@ public:
     void onOpen(WsConnection hdl) {
         LOG_INFO("New connection {}", hdl.lock().get());
         connections_.emplace(hdl, std::make_shared<FFmpegWrapper>());
+
+        // 按握手协商的permessage-deflate参数压缩发送的消息
+        ws::lib::error_code ec;
+        WsServer::connection_ptr con = endpoint_.get_con_from_hdl(hdl, ec);
+        std::string extensions       = ec ? "" : con->get_response_header("Sec-WebSocket-Extensions");
+        std::unique_lock<std::mutex> lock(compressorMutex_);
+        compressors_.emplace(hdl, std::make_shared<MessageCompressor>(extensions));
     }
 
     void onClose(WsConnection hdl) {
         LOG_INFO("Close connection {}", hdl.lock().get());
+        // 正在探测的会话不再等数据，不等待打开任务结束，打开任务持有会话的引用，看到取消后自己释放
+        auto it = connections_.find(hdl);
+        if (it != connections_.end()) {
+            it->second->shutdown();
+        }
         connections_.erase(hdl);
+        std::unique_lock<std::mutex> lock(compressorMutex_);
+        compressors_.erase(hdl);
     }
 
     void onMessage(WsConnection hdl, WsServer::message_ptr msg) {
@@ -124,38 +152,97 @@ private:
     }
 
     void onBinaryMsg(FFmpegWrapperPtr ffmpegWrapper, WsConnection hdl, WsServer::message_ptr msg) {
-        auto data = msg->get_payload();
-        ffmpegWrapper->sendData((uint8_t *)data.c_str(), data.length());
+        // 数据和websocket消息共享引用计数，不拷贝payload
+        const std::string &payload = msg->get_payload();
+        std::shared_ptr<const uint8_t> data(msg, (const uint8_t *)payload.data());
+        ffmpegWrapper->sendData(data, payload.size());
     }
 
     void initDecoder(FFmpegWrapperPtr ffmpegWrapper, WsConnection hdl, WsServer::message_ptr msg) {
         auto j = json::parse(msg->get_payload());
-        auto o = j.get<InitDecoderRequest>();
-        ffmpegWrapper->initDecoder(o.fileSize, o.waitHeaderLength);
+        processInitDecoder(ffmpegWrapper, j.get<InitDecoderRequest>());
+    }
+
+    void processInitDecoder(FFmpegWrapperPtr ffmpegWrapper, const InitDecoderRequest &o) {
+        ffmpegWrapper->initDecoder(o.fileSize, o.waitHeaderLength, (LiveIngestBuffer::OverflowPolicy)o.overflowPolicy, o.maxLatencyMs,
+                                   o.maxBacklogSize, o.codec, common::StringConv::Base64Decode(o.extradata), o.fastOpen,
+                                   (FFmpegWrapper::IngestMode)o.ingestMode);
     }
 
     void uninitDecoder(FFmpegWrapperPtr ffmpegWrapper, WsConnection hdl, WsServer::message_ptr msg) { ffmpegWrapper->uninitDecoder(); }
 
     void openDecoder(FFmpegWrapperPtr ffmpegWrapper, WsConnection hdl, WsServer::message_ptr msg) {
         auto j = json::parse(msg->get_payload());
-        auto o = j.get<OpenDecoderRequest>();
+        processOpenDecoder(ffmpegWrapper, hdl, j.get<OpenDecoderRequest>(), msg->get_opcode(), false);
+    }
 
-        FFmpegWrapper::CodecInfo codecInfo;
-        ffmpegWrapper->openDecoder(
+    // start为true时在回复之后开始解码，保证客户端先收到编码信息再收到帧
+    void processOpenDecoder(FFmpegWrapperPtr ffmpegWrapper, WsConnection hdl, const OpenDecoderRequest &o, WsOpcode opcode, bool start) {
+        FFmpegWrapper::OutputOptions output;
+        output.format          = FFmpegWrapper::selectOutputFormat(o.outputFormats);
+        output.headerVersion   = o.headerVersion;
+        output.highBitDepth    = o.highBitDepth;
+        output.dither          = o.dither;
+        output.maxWidth        = o.outputWidth;
+        output.maxHeight       = o.outputHeight;
+        output.creditWindow    = o.creditWindow;
+        output.dropPolicy      = (OutputCredit::Policy)o.dropPolicy;
+        output.adaptiveQuality = o.adaptiveQuality;
+        // 不使用credit的客户端按连接的发送缓冲区控制，自适应档位也用来判断拥塞
+        output.bufferedAmount = [=]() -> size_t {
+            ws::lib::error_code ec;
+            WsServer::connection_ptr con = endpoint_.get_con_from_hdl(hdl, ec);
+            return ec ? 0 : con->get_buffered_amount();
+        };
+
+        // 视频帧分片压缩的级别，旧版本头部不压缩
+        int32_t compressLevel = o.compressLevel;
+
+        // 打开和探测在FFmpegWrapper的打开线程上执行，不阻塞io线程，完成后回复openDecoder
+        ffmpegWrapper->openDecoderAsync(
             // has video/audio
             o.hasVideo, o.hasAudio,
+            // output options
+            output,
             // video callback
-            [=](uint8_t *buff, int32_t size) { sendMsg(hdl, (const uint8_t *)buff, size, WsOpcode::binary); },
+            [=](const FramePayload &payload) { sendMsg(hdl, payload, WsOpcode::binary, compressLevel); },
             // audio callback
-            [=](uint8_t *buff, int32_t size) { sendMsg(hdl, (const uint8_t *)buff, size, WsOpcode::binary); },
+            [=](uint8_t *buff, int32_t size) {
+                // 音频整条消息可能被压缩，在压缩前写入发送时间
+                FrameHeader::stampSend(buff, size);
+                sendMsg(hdl, (const uint8_t *)buff, size, WsOpcode::binary);
+            },
             // request data callback
             [=](int32_t offset, int32_t available) { sendMsg(hdl, ((json)RequestDataRequest(offset, available)).dump(), WsOpcode::text); },
-            // codec output
-            codecInfo);
+            // open timeout
+            o.openTimeoutMs,
+            // completion callback
+            [=](const FFmpegWrapper::CodecInfo &codecInfo, int32_t code, const std::string &reason) {
+                if (code != kErrorCode_Success) {
+                    sendMsg(hdl, ((json)BaseResponse(o.cmd, code, reason)).dump(), opcode);
+                    return;
+                }
+                OpenDecoderReponse rspObj(/**video*/ codecInfo.duration, codecInfo.videoPixFmt, codecInfo.videoWidth, codecInfo.videoHeight,
+                                          /**audio*/ codecInfo.audioSampleFmt, codecInfo.audioChannels, codecInfo.audioSampleRate);
+                rspObj.headerVersion = codecInfo.headerVersion;
+                rspObj.outputFormat  = FFmpegWrapper::outputFormatName((FFmpegWrapper::OutputFormat)codecInfo.outputFormat);
+                rspObj.probeMs       = codecInfo.probeMs;
+                rspObj.fastOpen      = codecInfo.fastOpen;
+                rspObj.cmd           = o.cmd;
+                sendMsg(hdl, ((json)rspObj).dump(), opcode);
+                if (start) {
+                    ffmpegWrapper->startDecode(true);
+                }
+            });
+    }
 
-        OpenDecoderReponse rspObj(/**video*/ codecInfo.duration, codecInfo.videoPixFmt, codecInfo.videoWidth, codecInfo.videoHeight,
-                                  /**audio*/ codecInfo.audioSampleFmt, codecInfo.audioChannels, codecInfo.audioSampleRate);
-        sendMsg(hdl, ((json)rspObj).dump(), msg->get_opcode());
+    // 一次往返建立会话: 同步完成initDecoder，随后的二进制消息(同一批发出的首段码流)直接进入接收缓冲区，
+    // 打开在打开线程上进行，完成后回复一次openSession(编码信息同openDecoder)并开始解码
+    void openSession(FFmpegWrapperPtr ffmpegWrapper, WsConnection hdl, WsServer::message_ptr msg) {
+        auto j = json::parse(msg->get_payload());
+        auto o = j.get<OpenSessionRequest>();
+        processInitDecoder(ffmpegWrapper, o.init);
+        processOpenDecoder(ffmpegWrapper, hdl, o.open, msg->get_opcode(), o.start);
     }
 
     void closeDecoder(FFmpegWrapperPtr ffmpegWrapper, WsConnection hdl, WsServer::message_ptr msg) { ffmpegWrapper->closeDecoder(); }
@@ -164,26 +251,173 @@ private:
 
     void stopDecode(FFmpegWrapperPtr ffmpegWrapper, WsConnection hdl, WsServer::message_ptr msg) { ffmpegWrapper->startDecode(false); }
 
-    std::string timestamp2str(double timestamp) {
-        char ss[16] = {0};
-        sprintf(ss, "%.6lf", timestamp);
-        return std::string(ss, ss + sizeof(ss));
+    void updateClock(FFmpegWrapperPtr ffmpegWrapper, WsConnection hdl, WsServer::message_ptr msg) {
+        auto j = json::parse(msg->get_payload());
+        auto o = j.get<UpdateClockRequest>();
+        ffmpegWrapper->updateClock(o.position);
+    }
+
+    void setOutputSize(FFmpegWrapperPtr ffmpegWrapper, WsConnection hdl, WsServer::message_ptr msg) {
+        auto j = json::parse(msg->get_payload());
+        auto o = j.get<SetOutputSizeRequest>();
+        ffmpegWrapper->setOutputSize(o.width, o.height);
+    }
+
+    void grantCredit(FFmpegWrapperPtr ffmpegWrapper, WsConnection hdl, WsServer::message_ptr msg) {
+        auto j = json::parse(msg->get_payload());
+        auto o = j.get<GrantCreditRequest>();
+        ffmpegWrapper->grantCredit(o.frames);
     }
 
-    int32_t sendMsg(WsConnection hdl, const uint8_t *buf, int32_t size, WsOpcode opcode) {
-        endpoint_.send(hdl, buf, size, opcode);
-        return size;
+    void getStats(FFmpegWrapperPtr ffmpegWrapper, WsConnection hdl, WsServer::message_ptr msg) {
+        FFmpegWrapper::StageTimings stages = ffmpegWrapper->getStageTimings();
+        MessagePool::Stats pool            = MessagePool::INSTANCE().getStats();
+        OutputCredit::Stats credit         = ffmpegWrapper->getCreditStats();
+        SliceCompressor::Stats compress    = SliceCompressor::INSTANCE().getStats();
+        ZlibBudget::Stats zlib             = ZlibBudget::INSTANCE().getStats();
+
+        GetStatsResponse rspObj;
+        for (auto &w : FFmpegWrapper::getExecutorStats()) {
+            double utilisation = w.aliveUs > 0 ? (double)w.busyUs / w.aliveUs : 0;
+            rspObj.workers.emplace_back(w.executed, w.steals, utilisation);
+        }
+        rspObj.decodeWakeups       = ffmpegWrapper->getDecodeWakeups();
+        rspObj.decodedFrames       = ffmpegWrapper->getDecodedFrames();
+        rspObj.deadlineMisses      = ffmpegWrapper->getDeadlineMisses();
+        rspObj.ingestQueuedBytes   = ffmpegWrapper->getIngestQueuedBytes();
+        rspObj.ingestDroppedBytes  = ffmpegWrapper->getIngestDroppedBytes();
+        rspObj.ingestReceivedBytes = ffmpegWrapper->getIngestReceivedBytes();
+        rspObj.ingestCopiedBytes   = ffmpegWrapper->getIngestCopiedBytes();
+        rspObj.catchUps            = ffmpegWrapper->getCatchUps();
+        rspObj.catchUpBytes        = ffmpegWrapper->getCatchUpBytes();
+        rspObj.framePoolAllocs     = FFmpegWrapper::getFramePoolAllocs();
+        rspObj.framePoolGets       = FFmpegWrapper::getFramePoolGets();
+        auto codecPool             = FFmpegWrapper::getCodecPoolStats();
+        rspObj.codecPoolHits       = codecPool.hits;
+        rspObj.codecPoolMisses     = codecPool.misses;
+        rspObj.codecPoolWarmed     = codecPool.warmed;
+        rspObj.codecPoolIdle       = codecPool.idle;
+        rspObj.codecPoolHitRate    = (double)codecPool.hits / std::max<uint64_t>(1, codecPool.hits + codecPool.misses);
+        rspObj.videoDecodeUs       = stages.decodeUs;
+        rspObj.videoPrepareUs      = stages.prepareUs;
+        rspObj.videoPackUs         = stages.packUs;
+        rspObj.videoScaleUs        = stages.scaleUs;
+        rspObj.videoBytesPerFrame  = ffmpegWrapper->getVideoBytesPerFrame();
+        rspObj.scaledFrames        = ffmpegWrapper->getScaledFrames();
+        rspObj.dropNonRef          = credit.dropNonRef;
+        rspObj.dropOverflow        = credit.dropOverflow;
+        rspObj.dropMailbox         = credit.dropMailbox;
+        rspObj.creditPauses        = credit.pauses;
+        rspObj.credit              = credit.credit;
+        rspObj.qualityLevel        = ffmpegWrapper->getQualityLevel();
+        rspObj.qualitySwitches     = ffmpegWrapper->getQualitySwitches();
+        rspObj.throughput          = ffmpegWrapper->getThroughput();
+        rspObj.parallelPacks       = ParallelPacker::INSTANCE().getParallelPacks();
+        rspObj.packBands           = ParallelPacker::INSTANCE().getBands();
+        rspObj.compressedFrames    = compress.frames;
+        rspObj.compressSkipped     = compress.skipped;
+        rspObj.compressRatio       = compress.compressedBytes > 0 ? (double)compress.rawBytes / compress.compressedBytes : 0;
+        rspObj.compressMBps        = compress.compressUs > 0 ? (double)compress.rawBytes / compress.compressUs : 0;
+        rspObj.zlibBytes           = zlib.bytes;
+        rspObj.zlibPeak            = zlib.peak;
+        rspObj.zlibRefused         = zlib.refused;
+        rspObj.spareCpu            = SpareCpu::INSTANCE().spare();
+        rspObj.probeMs             = ffmpegWrapper->getProbeMs();
+        rspObj.ttffMs              = ffmpegWrapper->getTtffMs();
+        rspObj.fastOpen            = ffmpegWrapper->isFastOpened();
+        rspObj.accessUnits         = ffmpegWrapper->getAccessUnits();
+        rspObj.messagePoolHits     = pool.hits;
+        rspObj.messagePoolMisses   = pool.misses;
+        rspObj.messagePoolDropped  = pool.dropped;
+        rspObj.messagePoolBytes    = pool.pooledBytes;
+        CompressorPtr compressor = compressorOf(hdl);
+        if (compressor) {
+            const char *types[] = {"control", "audio", "video"};
+            for (int32_t t = 0; t < CompressionPolicy::kMessage_Count; t++) {
+                CompressionPolicy::Stats s = compressor->policy().getStats((CompressionPolicy::MessageType)t);
+                rspObj.messageCompress.emplace_back(types[t], s.compressed, s.uncompressed, s.ratio);
+            }
+        }
+        sendMsg(hdl, ((json)rspObj).dump(), msg->get_opcode());
+    }
+
+    CompressorPtr compressorOf(WsConnection hdl) {
+        std::unique_lock<std::mutex> lock(compressorMutex_);
+        auto it = compressors_.find(hdl);
+        return it == compressors_.end() ? nullptr : it->second;
+    }
+
+    // 准备好的消息不经过websocketpp的permessage-deflate，压缩过的消息设置RSV1
+    void sendPrepared(WsServer::connection_ptr con, WsOpcode opcode, const uint8_t *buf, size_t size, bool compressed) {
+        WsServer::message_ptr msg = con->get_message(opcode, size);
+        msg->get_raw_payload().assign((const char *)buf, size);
+
+        // 服务端发送的帧不加掩码
+        ws::frame::basic_header header(opcode, size, true, false, compressed);
+        ws::frame::extended_header extHeader(size);
+        msg->set_header(ws::frame::prepare_header(header, extHeader));
+        msg->set_prepared(true);
+        con->send(msg);
+    }
+
+    // 控制消息和音频按连接的压缩策略压缩
+    int32_t sendMsg(WsConnection hdl, const uint8_t *buf, int32_t size, WsOpcode opcode,
+                    CompressionPolicy::MessageType type = CompressionPolicy::kMessage_Audio) {
+        ws::lib::error_code ec;
+        WsServer::connection_ptr con = endpoint_.get_con_from_hdl(hdl, ec);
+        CompressorPtr compressor     = compressorOf(hdl);
+        if (ec || !compressor) {
+            return -1;
+        }
+        return (int32_t)compressor->send(type, buf, size, [&](const uint8_t *data, size_t bytes, bool compressed) {
+            sendPrepared(con, opcode, data, bytes, compressed);
+        });
+    }
+
+    // 帧头和各区域只拷贝一次到websocket消息中，消息已经准备好(帧头已生成)，websocketpp不会再拷贝payload，
+    // 写socket时websocket帧头和payload一次gather写出
+    // 准备好的消息不经过permessage-deflate，compressLevel大于0时按连接的压缩策略在线程池上分片压缩，
+    // CPU紧张时降低级别或不压缩
+    int32_t sendMsg(WsConnection hdl, const FramePayload &payload, WsOpcode opcode, int32_t compressLevel = 0) {
+        ws::lib::error_code ec;
+        WsServer::connection_ptr con = endpoint_.get_con_from_hdl(hdl, ec);
+        CompressorPtr compressor     = compressorOf(hdl);
+        if (ec || !compressor) {
+            return -1;
+        }
+
+        WsServer::message_ptr msg     = con->get_message(opcode, payload.size());
+        std::string &out              = msg->get_raw_payload();
+        CompressionPolicy::Decision d = compressor->policy().decide(CompressionPolicy::kMessage_Video, payload.size(), compressLevel);
+        if (d.compress) {
+            bool compressed = SliceCompressor::INSTANCE().appendTo(payload, out, d.level);
+            compressor->policy().onCompressed(CompressionPolicy::kMessage_Video, payload.size(), compressed ? out.size() : payload.size());
+        } else {
+            ParallelPacker::INSTANCE().appendTo(payload, out);
+        }
+
+        // 服务端发送的帧不加掩码
+        ws::frame::basic_header header(opcode, out.size(), true, false);
+        ws::frame::extended_header extHeader(out.size());
+        msg->set_header(ws::frame::prepare_header(header, extHeader));
+        msg->set_prepared(true);
+
+        // 帧头不压缩，提交发送前写入发送时间
+        FrameHeader::stampSend((uint8_t *)&out[0], payload.header().size());
+        con->send(msg);
+        return (int32_t)out.size();
     }
 
     int32_t sendMsg(WsConnection hdl, const std::string &msg, WsOpcode opcode) {
-        endpoint_.send(hdl, msg.c_str(), msg.size(), opcode);
-        return msg.size();
+        return sendMsg(hdl, (const uint8_t *)msg.data(), (int32_t)msg.size(), opcode, CompressionPolicy::kMessage_Control);
     }
 
 private:
     std::vector<std::thread> ioThreads_;
     WsServer endpoint_;
     ConnMap connections_;
+    CompressorMap compressors_;
+    std::mutex compressorMutex_;
     std::map<std::string, TextMsgProc> textProcs_;
 };
 
@@ -0,0 +1,201 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "server/nal_units.h"
+
+namespace decoder {
+
+/*
+ * 实况H.264/H.265 Annex-B裸流的快速打开
+ * avformat_find_stream_info要读满探测长度(waitHeaderLength)才返回，实况流的首帧时间主要花在这里
+ * 这里只扫描开头的数据，收集参数集(H.265 VPS/SPS/PPS，H.264 SPS/PPS)，找到参数集之后的第一个关键帧就结束，
+ * 调用者用参数集生成extradata、按SPS填写尺寸和像素格式，从关键帧所在的访问单元开始解码，不再探测
+ * 编码格式和参数集可以由客户端预先给出(InitDecoderRequest)，这时只需要等到第一个关键帧
+ * 扫描的数据超过上限、开头不是Annex-B(如TS流)或SPS解析失败时放弃，调用者退回到完整的探测
+ */
+class FastOpenProbe {
+public:
+    const size_t kDetectBytes       = 64 * 1024; // 超过时还没有识别出编码格式，认为不是Annex-B裸流
+    const size_t kMaxParameterSets  = 16;
+    const int32_t kTsPacketSize     = 188;
+    const uint8_t kTsSyncByte       = 0x47;
+    const int32_t kStartCodeSize    = 3;
+    const int32_t kMaxNalHeaderSize = 2;
+
+    // codec为kCodec_None时按参数集识别，extradata为客户端给出的Annex-B参数集，可以为空，maxBytes为扫描的上限
+    void reset(NalUnits::Codec codec, const std::string &extradata, size_t maxBytes) {
+        codec_       = codec;
+        maxBytes_    = maxBytes;
+        bufferPos_   = -1;
+        scanned_     = 0;
+        nalBegin_    = -1;
+        auBegin_     = -1;
+        keyframePos_ = -1;
+        failed_      = false;
+        spsParsed_   = false;
+        buffer_.clear();
+        paramSets_.clear();
+
+        if (codec_ != NalUnits::kCodec_None && !extradata.empty()) {
+            const uint8_t *p   = (const uint8_t *)extradata.data();
+            const uint8_t *end = p + extradata.size();
+            for (p = NalUnits::findStartCode(p, end); p < end;) {
+                const uint8_t *nal  = p + kStartCodeSize;
+                const uint8_t *next = NalUnits::findStartCode(nal, end);
+                onNalComplete(nal, trimZeros(nal, next));
+                p = next;
+            }
+        }
+    }
+
+    // 输入从流位置pos开始的连续数据，返回true表示可以快速打开
+    bool feed(const uint8_t *data, size_t size, int64_t pos) {
+        if (ready() || failed_) {
+            return ready();
+        }
+        if (bufferPos_ < 0) {
+            bufferPos_ = pos;
+        }
+        buffer_.append((const char *)data, size);
+
+        const uint8_t *base = (const uint8_t *)buffer_.data();
+        const uint8_t *end  = base + buffer_.size();
+        if (isTs(base, buffer_.size())) {
+            failed_ = true;
+            return false;
+        }
+
+        while (!ready()) {
+            const uint8_t *sc = NalUnits::findStartCode(base + scanned_, end);
+            // 起始码和NAL头不完整时等待更多数据
+            if (end - sc < kStartCodeSize + kMaxNalHeaderSize) {
+                scanned_ = std::max<size_t>(scanned_, std::max<int64_t>(0, sc - base - kStartCodeSize));
+                break;
+            }
+
+            size_t start = sc - base;
+            if (nalBegin_ >= 0) {
+                onNalComplete(base + nalBegin_, trimZeros(base + nalBegin_, sc));
+            }
+            // 4字节起始码的第一个0属于这个NAL单元
+            size_t unitBegin = start > 0 && base[start - 1] == 0 ? start - 1 : start;
+            nalBegin_        = start + kStartCodeSize;
+            scanned_         = nalBegin_;
+            onNalHeader(base + nalBegin_, unitBegin);
+        }
+
+        if (!ready() && (buffer_.size() > maxBytes_ || (codec_ == NalUnits::kCodec_None && buffer_.size() > kDetectBytes))) {
+            failed_ = true;
+        }
+        return ready();
+    }
+
+    bool ready() const { return keyframePos_ >= 0 && spsParsed_; }
+
+    bool failed() const { return failed_; }
+
+    NalUnits::Codec codec() const { return codec_; }
+
+    const NalUnits::SpsInfo &sps() const { return sps_; }
+
+    // 第一个关键帧所在访问单元的流位置
+    int64_t keyframePos() const { return keyframePos_; }
+
+    // 收集的参数集，每个前面加4字节起始码，可以直接作为解码器的extradata
+    std::string extradata() const {
+        std::string out;
+        for (auto &ps : paramSets_) {
+            out.append("\x00\x00\x00\x01", 4);
+            out.append(ps);
+        }
+        return out;
+    }
+
+private:
+    bool isTs(const uint8_t *data, size_t size) const {
+        return size > (size_t)kTsPacketSize && data[0] == kTsSyncByte && data[kTsPacketSize] == kTsSyncByte;
+    }
+
+    static const uint8_t *trimZeros(const uint8_t *begin, const uint8_t *end) {
+        while (end > begin && end[-1] == 0) {
+            end--;
+        }
+        return end;
+    }
+
+    bool paramSetsComplete() const {
+        bool vps = codec_ != NalUnits::kCodec_HEVC;
+        bool pps = false;
+        for (auto &ps : paramSets_) {
+            int32_t type = NalUnits::nalType(codec_, (uint8_t)ps[0]);
+            vps          = vps || type == 32;
+            pps          = pps || (codec_ == NalUnits::kCodec_HEVC ? type == 34 : type == 8);
+        }
+        return vps && spsParsed_ && pps;
+    }
+
+    // unitBegin为NAL单元(含起始码)在缓冲区中的偏移
+    void onNalHeader(const uint8_t *nal, size_t unitBegin) {
+        if (codec_ == NalUnits::kCodec_None) {
+            codec_ = NalUnits::detect(nal, kMaxNalHeaderSize);
+            if (codec_ == NalUnits::kCodec_None) {
+                return;
+            }
+        }
+
+        int32_t type = NalUnits::nalType(codec_, nal[0]);
+        if (!NalUnits::isVcl(codec_, type)) {
+            if (auBegin_ < 0) {
+                auBegin_ = unitBegin;
+            }
+            return;
+        }
+
+        // 访问单元从关键帧前的第一个非VCL单元(AUD/参数集/SEI)开始，和KeyframeIndexer一致
+        if (NalUnits::isKeyframe(codec_, type) && paramSetsComplete()) {
+            keyframePos_ = bufferPos_ + (auBegin_ >= 0 ? auBegin_ : unitBegin);
+        }
+        auBegin_ = -1;
+    }
+
+    void onNalComplete(const uint8_t *nal, const uint8_t *end) {
+        if (codec_ == NalUnits::kCodec_None || end - nal < NalUnits::headerSize(codec_)) {
+            return;
+        }
+        int32_t type = NalUnits::nalType(codec_, nal[0]);
+        if (!NalUnits::isParameterSet(codec_, type) || paramSets_.size() >= kMaxParameterSets) {
+            return;
+        }
+
+        std::string ps((const char *)nal, end - nal);
+        for (auto &it : paramSets_) {
+            if (it == ps) {
+                return;
+            }
+        }
+        if (NalUnits::isSps(codec_, type) && !spsParsed_) {
+            spsParsed_ = NalUnits::parseSps(codec_, nal, end - nal, sps_);
+        }
+        paramSets_.push_back(std::move(ps));
+    }
+
+private:
+    std::string buffer_; // 扫描过的数据，从流位置bufferPos_开始
+    std::vector<std::string> paramSets_;
+    NalUnits::Codec codec_ = NalUnits::kCodec_None;
+    NalUnits::SpsInfo sps_ = {0, 0, 8, 1};
+    size_t maxBytes_       = 0;
+    int64_t bufferPos_     = -1;
+    size_t scanned_        = 0;  // 下一次查找起始码的偏移
+    int64_t nalBegin_      = -1; // 当前NAL单元(NAL头)的偏移，下一个起始码出现时结束
+    int64_t auBegin_       = -1; // 当前访问单元中第一个非VCL单元的偏移
+    int64_t keyframePos_   = -1;
+    bool failed_           = false;
+    bool spsParsed_        = false;
+};
+
+} // namespace decoder
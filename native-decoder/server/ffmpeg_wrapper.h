@@ -1,20 +1,35 @@
+#include <atomic>
+#include <condition_variable>
 #include <exception>
 #include <memory>
 #include <mutex>
+#include <thread>
+#include <vector>
 
 #include "common/helper/raii.h"
 #include "common/helper/logger.h"
 #include "common/helper/singleton.h"
 #include "common/helper/threadpool.h"
-#include "common/helper/timer.h"
+#include "common/helper/work_stealing_pool.h"
+#include "server/access_unit_splitter.h"
+#include "server/codec_context_pool.h"
+#include "server/codec_thread_budget.h"
+#include "server/deadline_tracker.h"
+#include "server/fast_open_probe.h"
+#include "server/frame_buffer_pool.h"
+#include "server/frame_header.h"
+#include "server/frame_payload.h"
+#include "server/frame_scaler.h"
+#include "server/ingest_buffer.h"
+#include "server/output_credit.h"
 #include "server/pojo.h"
+#include "server/quality_ladder.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 #include "libavcodec/avcodec.h"
 #include "libavformat/avformat.h"
-#include "libavutil/fifo.h"
 #include "libavutil/imgutils.h"
 #ifdef __cplusplus
 }
@@ -34,7 +49,9 @@ typedef enum ErrorCode {
     kErrorCode_Open_File_Error,
     kErrorCode_Eof,
     kErrorCode_FFmpeg_Error,
-    kErrorCode_Old_Frame
+    kErrorCode_Old_Frame,
+    kErrorCode_Timeout,
+    kErrorCode_Cancelled
 } ErrorCode;
 
 class FFmpegLibrary {
@@ -86,19 +103,20 @@ private:
     int32_t logLevel_;
 };
 
-class FFmpegWrapper {
+class FFmpegWrapper : public std::enable_shared_from_this<FFmpegWrapper> {
 public:
     const int32_t kCustomIoBufferSize    = 32 * 1024;
     const int32_t kInitialPcmBufferSize  = 128 * 1024;
-    const int32_t kDefaultFifoSize       = 8 * 1024 * 1024;
-    const int32_t kMaxFifoSize           = 16 * 1024 * 1024;
-    const int32_t KDecodeTimerInterval   = 5;
-    const int32_t KTimeStampStrLength    = 16; // 时间戳字符串长度，需要和js部分约定一样
-    const int32_t KDecodedDataTypeLength = 1;  // 数据类型长度，需要和js部分约定一样
-    const int8_t KVideoFrameFlag         = 0;
-    const int8_t KAudioFrameFlag         = 1;
-
-    using onVideo       = std::function<void(uint8_t *buff, int32_t size)>;
+    const int32_t kMaxFifoSize           = 16 * 1024 * 1024; // 实况接收缓冲区的硬上限
+    const int32_t kDefaultMaxLatencyMs   = 1000;             // 实况积压超过时跳到最新的关键帧
+    const int32_t kDefaultMaxBacklogSize = 8 * 1024 * 1024;
+    const int32_t kFifoReadTimeoutMs     = 250;
+    const int32_t kPacketsPerDecodeTask  = 8;     // 每次调度最多解码的包数，避免一个会话长期占用worker
+    const int32_t kDefaultOpenTimeoutMs  = 10000; // 异步打开(探测)的默认超时
+    static const uint16_t kOpenThreads   = 16;    // 异步打开的线程数，探测大部分时间在等数据
+    const int32_t kFastOpenMaxIdleMs     = 2000;  // 快速打开等不到数据时退回到完整的探测
+
+    using onVideo       = std::function<void(const FramePayload &payload)>;
     using onAudio       = std::function<void(uint8_t *buff, int32_t size)>;
     using onRequestData = std::function<void(int32_t offset, int32_t available)>;
 
@@ -110,15 +128,70 @@ public:
         int32_t audioSampleFmt;
         int32_t audioChannels;
         int32_t audioSampleRate;
+        int32_t headerVersion; // 协商后的解码数据头部版本
+        int32_t outputFormat;  // 选择的视频输出格式
+        int32_t probeMs;       // 打开输入和探测流信息的耗时
+        bool fastOpen;         // 按参数集快速打开，没有调用avformat_find_stream_info
     } CodecInfo;
 
+    // 异步打开完成(成功、失败、超时或取消)的回调，code为ErrorCode
+    using onOpened = std::function<void(const CodecInfo &codec, int32_t code, const std::string &msg)>;
+
+    // 视频输出格式
+    typedef enum OutputFormat {
+        kOutputFormat_I420 = 0, // Y、U、V三个平面
+        kOutputFormat_NV12,     // Y平面和交织的UV平面
+        kOutputFormat_RGBA,     // canvas 2d等不能渲染yuv的客户端使用
+        kOutputFormat_Y,        // 只有Y平面，分析类客户端使用
+        kOutputFormat_Count,
+    } OutputFormat;
+
+    // 实况流的输入方式
+    typedef enum IngestMode {
+        kIngest_Demux = 0,  // avformat探测和解复用，支持TS/FLV等封装
+        kIngest_AnnexB,     // H.264/H.265 Annex-B字节流，按起始码切分访问单元，直接送给解码器
+        kIngest_AccessUnit, // 和kIngest_AnnexB相同，每条消息是一个完整的访问单元，不用等下一帧确定结尾
+    } IngestMode;
+
+    // 解码输出选项，openDecoder时由客户端指定
+    typedef struct tagOutputOptions {
+        OutputFormat format                         = kOutputFormat_I420;
+        int32_t headerVersion                       = FrameHeader::kVersion_Legacy;
+        bool highBitDepth                           = false;                       // 10位4:2:0直接输出16位小端采样，否则都转换为8位4:2:0
+        bool dither                                 = true;                        // 高位深转8位时使用有序抖动
+        int32_t maxWidth                            = 0;                           // 输出不超过客户端的显示尺寸，0为原始尺寸
+        int32_t maxHeight                           = 0;
+        int32_t creditWindow                        = 0;                           // 视频帧的初始credit，0为不使用credit，按连接的发送缓冲区控制
+        OutputCredit::Policy dropPolicy             = OutputCredit::kPolicy_Pause; // 没有credit时的策略
+        OutputCredit::BufferedAmount bufferedAmount = nullptr;                     // 连接发送缓冲区中的字节数
+        bool adaptiveQuality                        = false;                       // 拥塞时自动降低输出档位(尺寸/只发Y平面)
+    } OutputOptions;
+
+    // 视频每帧各阶段的平均耗时(us): 解码、准备(缩放/格式检查/生成头部)、打包(拷贝到websocket消息并提交发送)
+    // scaleUs为每个缩放帧的平均缩放耗时，包含在prepareUs中
+    typedef struct tagStageTimings {
+        double decodeUs;
+        double prepareUs;
+        double packUs;
+        double scaleUs;
+    } StageTimings;
+
 public:
     FFmpegWrapper() {
         // init ffmpeg library instance
         FFmpegLibrary::INSTANCE().setLogLevel(AV_LOG_WARNING);
     }
 
-    void initDecoder(int32_t fileSize, uint32_t waitHeaderLength = 512 * 1024) {
+    // 解码和打开任务都持有会话的引用，最后一个引用释放时没有任务在执行，
+    // 没有closeDecoder就断开的连接在这里注销线程预算、把池中的上下文放回
+    ~FFmpegWrapper() { releaseDecoder(); }
+
+    // codec/extradata为客户端已知的实况裸流编码格式("h264"/"hevc")和Annex-B参数集，可以为空，fastOpen为false时总是完整探测
+    // ingestMode不是kIngest_Demux时实况流按裸流输入，不使用avformat
+    void initDecoder(int32_t fileSize, uint32_t waitHeaderLength = 512 * 1024,
+                     LiveIngestBuffer::OverflowPolicy overflowPolicy = LiveIngestBuffer::kOverflow_DropBacklog, int32_t maxLatencyMs = -1,
+                     int32_t maxBacklogSize = -1, const std::string &codec = "", const std::string &extradata = "", bool fastOpen = true,
+                     IngestMode ingestMode = kIngest_Demux) {
         LOG_INFO("Start to init decoder, filesize={}, waitHeaderLength={}", fileSize, waitHeaderLength);
 
         if (waitHeaderLength_ > 0) {
@@ -136,62 +209,75 @@ public:
             }
         } else {
             isStream_ = true;
-            fifoSize_ = kDefaultFifoSize;
-            fifo_     = av_fifo_alloc(fifoSize_);
+            deadline_.setLive(true);
+            ingest_.reset(kMaxFifoSize, overflowPolicy);
+            ingest_.setCatchUp(maxLatencyMs < 0 ? kDefaultMaxLatencyMs : maxLatencyMs, maxBacklogSize < 0 ? kDefaultMaxBacklogSize : maxBacklogSize);
+            fastOpenEnabled_ = fastOpen;
+            knownCodec_      = codec == "hevc" || codec == "h265" ? NalUnits::kCodec_HEVC : codec == "h264" ? NalUnits::kCodec_H264 : NalUnits::kCodec_None;
+            knownExtradata_  = extradata;
+            ingestMode_      = ingestMode;
         }
 
         LOG_INFO("Decoder initialized");
     }
 
     void uninitDecoder() {
+        cancelOpen();
+        std::unique_lock<std::mutex> lock(mutex_);
+
         if (fp_ != nullptr) {
             fclose(fp_);
             fp_ = nullptr;
             remove(fileName_.c_str());
         }
 
-        if (fifo_ != nullptr) {
-            av_fifo_freep(&fifo_);
+        if (isStream_) {
+            ingest_.reset(kMaxFifoSize, LiveIngestBuffer::kOverflow_DropBacklog);
         }
 
         LOG_INFO("Decoder uninitialized.");
     }
 
-    void openDecoder(bool hasVideo, bool hasAudio, onVideo videoCallback, onAudio audioCallback, onRequestData requestDataback, CodecInfo &codec) {
-        LOG_INFO("Start open decoder, hasVideo({}), hasAudio({}).", hasVideo, hasAudio);
-
-        avformatContext_ = avformat_alloc_context();
-        customIoBuffer_  = (uint8_t *)av_mallocz(kCustomIoBufferSize);
+    static const char *outputFormatName(OutputFormat format) {
+        static const char *names[] = {"I420", "NV12", "RGBA", "Y"};
+        return names[format];
+    }
 
-        AVIOContext *ioContext = avio_alloc_context(customIoBuffer_, kCustomIoBufferSize, 0, (void *)this, FFmpegWrapper::ffReadCallback, nullptr,
-                                                    FFmpegWrapper::ffSeekCallback);
-        if (ioContext == nullptr) {
-            LOG_INFO("avio_alloc_context failed.");
-            raiseException(kErrorCode_FFmpeg_Error, "avio_alloc_context failed");
+    // 客户端按优先级给出的格式列表中第一个支持的格式，都不支持或没有指定时为I420
+    static OutputFormat selectOutputFormat(const std::vector<std::string> &formats) {
+        for (auto &name : formats) {
+            for (int32_t f = 0; f < kOutputFormat_Count; f++) {
+                if (name == outputFormatName((OutputFormat)f)) {
+                    return (OutputFormat)f;
+                }
+            }
         }
+        return kOutputFormat_I420;
+    }
 
-        avformatContext_->pb    = ioContext;
-        avformatContext_->flags = AVFMT_FLAG_CUSTOM_IO | AVFMT_FLAG_NONBLOCK;
-
-        int32_t r = avformat_open_input(&avformatContext_, nullptr, nullptr, nullptr);
-        if (r != 0) {
-            raiseException(kErrorCode_FFmpeg_Error, "avformat_open_input failed: " + ffmpegError(r));
-        }
+    void openDecoder(bool hasVideo, bool hasAudio, const OutputOptions &output, onVideo videoCallback, onAudio audioCallback,
+                     onRequestData requestDataback, CodecInfo &codec) {
+        LOG_INFO("Start open decoder, hasVideo({}), hasAudio({}), format({}), headerVersion({}), highBitDepth({}), maxSize({}x{}).", hasVideo,
+                 hasAudio, outputFormatName(output.format), output.headerVersion, output.highBitDepth, output.maxWidth, output.maxHeight);
 
-        r = avformat_find_stream_info(avformatContext_, nullptr);
-        if (r != 0) {
-            raiseException(kErrorCode_FFmpeg_Error, "av_find_stream_info failed: " + ffmpegError(r));
-        }
+        // 异步打开在开始前已经被取消时保持中止
+        ingest_.setAborted(openCancelled_);
+        int64_t probeBegin = getTickCount();
+        openBeginMs_       = probeBegin;
+        ttffMs_            = -1;
 
-        for (uint32_t i = 0; i < avformatContext_->nb_streams; i++) {
-            avformatContext_->streams[i]->discard      = AVDISCARD_DEFAULT;
-            avformatContext_->streams[i]->need_parsing = AVSTREAM_PARSE_FULL;
+        if (isStream_ && ingestMode_ != kIngest_Demux) {
+            openElementaryInput(hasVideo, hasAudio);
+        } else {
+            openFormatInput(hasVideo, hasAudio);
         }
-
-        codec.duration = 1000 * (avformatContext_->duration + 5000) / AV_TIME_BASE;
+        probeMs_       = getTickCount() - probeBegin;
+        codec.probeMs  = (int32_t)probeMs_;
+        codec.fastOpen = fastOpened_;
+        codec.duration = avformatContext_ != nullptr ? 1000 * (avformatContext_->duration + 5000) / AV_TIME_BASE : 0;
 
         if (hasVideo) {
-            openCodecContext(avformatContext_, AVMEDIA_TYPE_VIDEO, &videoStreamIdx_, &videoCodecContext_);
+            openVideoCodecContext();
 
             codec.videoPixFmt = videoCodecContext_->pix_fmt;
             codec.videoWidth  = videoCodecContext_->width;
@@ -218,44 +304,139 @@ public:
                      codec.audioSampleRate);
         }
 
-        av_seek_frame(avformatContext_, -1, 0, AVSEEK_FLAG_BACKWARD);
+        // 快速打开和裸流输入时已经定位到第一个关键帧
+        if (!fastOpened_) {
+            av_seek_frame(avformatContext_, -1, 0, AVSEEK_FLAG_BACKWARD);
+        }
 
-        videoSize_       = av_image_get_buffer_size(videoCodecContext_->pix_fmt, videoCodecContext_->width, videoCodecContext_->height, 1);
-        videoBufferSize_ = videoSize_;
-        yuvBuffer_       = (uint8_t *)av_mallocz(KDecodedDataTypeLength + KTimeStampStrLength + videoBufferSize_);
-        pcmBufferSize_   = kInitialPcmBufferSize;
-        pcmBuffer_       = (uint8_t *)av_mallocz(KDecodedDataTypeLength + KTimeStampStrLength + kInitialPcmBufferSize);
-        avFrame_         = av_frame_alloc();
+        // 探测完成，之后不会再回退seek，不再保留已读数据，开始索引关键帧
+        if (isStream_) {
+            ingest_.releaseHistory();
+            setIngestFormat();
+        }
+
+        videoSize_     = av_image_get_buffer_size(videoCodecContext_->pix_fmt, videoCodecContext_->width, videoCodecContext_->height, 1);
+        pcmBufferSize_ = kInitialPcmBufferSize;
+        pcmBuffer_     = (uint8_t *)av_mallocz(FrameHeader::kMaxSize + kInitialPcmBufferSize);
+        avFrame_       = av_frame_alloc();
+        output_        = output;
+        headerVersion_ = FrameHeader::negotiate(output.headerVersion);
+        videoSeq_      = 0;
+        audioSeq_      = 0;
+        scaler_.setTarget(output.maxWidth, output.maxHeight);
+        credit_.reset(output.creditWindow, output.dropPolicy, output.bufferedAmount);
+        // 只有Y平面的档位要求客户端按I420渲染
+        ladder_.reset(output.adaptiveQuality, output.format == kOutputFormat_I420 ? QualityLadder::kLevel_QuarterLuma : QualityLadder::kLevel_Quarter);
+        scaler_.setDivisor(1);
+        rendition_ = QualityLadder::kLevel_Full;
+
+        codec.headerVersion = headerVersion_;
+        codec.outputFormat  = output.format;
 
         // install callback function
         videoCallback_       = videoCallback;
         audioCallback_       = audioCallback;
         requestDataCallback_ = requestDataback;
 
-        // start decode timer
-        decodeTimer_.StartTimer(KDecodeTimerInterval, [=]() {
-            // double check
-            if (decoding_) {
-                if (decoding_) {
-                    try {
-                        decodeOnePacket();
-                    } catch (BizException &e) {
-                        LOG_ERROR("Decode frame error, code={}, reason={}", e.code, e.msg);
-                    } catch (std::exception &e) {
-                        LOG_ERROR("Decode frame error, reason={}", e.what());
-                    }
+        // 之后由sendData()/startDecode()调度解码任务
+        opened_ = true;
+        scheduleDecode();
+
+        LOG_INFO("Decoder opened, duration {}s, picture size {}, probe {}ms.", codec.duration, videoSize_, codec.probeMs);
+    }
+
+    // 打开输入和探测可能要等待数据(每次读最多kFifoReadTimeoutMs)，不能阻塞websocket的io线程，
+    // 在专用的线程池上执行openDecoder，完成后调用openedCallback，失败、超时或取消时释放已经打开的部分
+    // timeoutMs不大于0时使用kDefaultOpenTimeoutMs，closeDecoder/uninitDecoder/cancelOpen/shutdown取消
+    // 排队时已经取消的任务不再打开，打开成功后才看到取消的也释放，取消的一方不用等待
+    void openDecoderAsync(bool hasVideo, bool hasAudio, const OutputOptions &output, onVideo videoCallback, onAudio audioCallback,
+                          onRequestData requestDataback, int32_t timeoutMs, onOpened openedCallback) {
+        {
+            std::unique_lock<std::mutex> lock(openMutex_);
+            if (opening_) {
+                raiseException(kErrorCode_Invalid_State, "Decoder is opening");
+            }
+            opening_       = true;
+            openCancelled_ = false;
+        }
+        openDeadlineMs_ = getTickCount() + (timeoutMs > 0 ? timeoutMs : kDefaultOpenTimeoutMs);
+
+        auto self = shared_from_this();
+        openExecutor().commit([=]() {
+            CodecInfo codec = {};
+            int32_t code    = kErrorCode_Success;
+            std::string msg;
+            try {
+                if (self->openCancelled_) {
+                    self->raiseException(kErrorCode_Cancelled, "Open cancelled");
+                }
+                self->openDecoder(hasVideo, hasAudio, output, videoCallback, audioCallback, requestDataback, codec);
+                if (self->openCancelled_) {
+                    self->raiseException(kErrorCode_Cancelled, "Open cancelled");
                 }
+            } catch (BizException &e) {
+                code = e.code;
+                msg  = e.msg;
+            } catch (std::exception &e) {
+                code = -1;
+                msg  = e.what();
+            }
+
+            if (code != kErrorCode_Success) {
+                LOG_ERROR("Open decoder failed, code={}, reason={}", code, msg);
+                self->releaseDecoder();
+            }
+
+            {
+                std::unique_lock<std::mutex> lock(self->openMutex_);
+                self->opening_ = false;
+                self->openCond_.notify_all();
             }
+            openedCallback(codec, code, msg);
         });
+    }
+
+    // 连接关闭时在io线程上调用，只标记取消并中止接收缓冲区，不等待排队或探测中的打开任务，打开任务自己释放
+    // 之后不再调度解码任务，排队中的任务执行时直接返回，会话在最后一个任务结束后析构
+    void shutdown() {
+        LOG_INFO("Shutdown decoder.");
+        closed_        = true;
+        openCancelled_ = true;
+        ingest_.setAborted(true);
+    }
 
-        LOG_INFO("Decoder opened, duration {}s, picture size {}.", codec.duration, videoSize_);
+    // 取消正在进行的异步打开，等待打开任务结束，closeDecoder/uninitDecoder时调用
+    void cancelOpen() {
+        std::unique_lock<std::mutex> lock(openMutex_);
+        if (!opening_) {
+            return;
+        }
+        LOG_INFO("Cancel opening decoder.");
+        openCancelled_ = true;
+        ingest_.setAborted(true);
+        openCond_.wait(lock, [this]() { return !opening_; });
     }
 
     void closeDecoder() {
-        decodeTimer_.Expire();
+        cancelOpen();
+        releaseDecoder();
+    }
+
+    void releaseDecoder() {
+        stopDecodeTask();
+
+        if (budgetId_ != 0) {
+            CodecThreadBudget::INSTANCE().unregisterSession(budgetId_);
+            budgetId_ = 0;
+        }
 
         if (videoCodecContext_ != nullptr) {
-            closeCodecContext(avformatContext_, videoCodecContext_, videoStreamIdx_);
+            if (videoContextPooled_) {
+                CodecContextPool::INSTANCE().checkin(videoCodecContext_, videoThreadConfig_);
+                videoContextPooled_ = false;
+            } else {
+                closeCodecContext(avformatContext_, videoCodecContext_, videoStreamIdx_);
+            }
             videoCodecContext_ = nullptr;
             LOG_INFO("Video codec context closed.");
         }
@@ -282,8 +463,9 @@ public:
             LOG_INFO("Input closed.");
         }
 
-        if (yuvBuffer_ != nullptr) {
-            av_freep(&yuvBuffer_);
+        if (elementaryPar_ != nullptr) {
+            avcodec_parameters_free(&elementaryPar_);
+            splitter_.reset(NalUnits::kCodec_None);
         }
 
         if (pcmBuffer_ != nullptr) {
@@ -294,23 +476,135 @@ public:
             av_freep(&avFrame_);
         }
 
+        scaler_.release();
+
+        {
+            std::unique_lock<std::mutex> lock(mailboxMutex_);
+            mailboxFull_ = false;
+        }
+
         LOG_INFO("All buffer released.");
     }
 
-    void startDecode(bool start) { decoding_ = start; }
+    void startDecode(bool start) {
+        decoding_ = start;
+        scheduleDecode();
+    }
 
     int32_t sendData(uint8_t *buff, int32_t size) {
         if (buff == nullptr || size == 0) {
             raiseException(kErrorCode_Invalid_Param, "Invalid param");
         }
-        std::unique_lock<std::mutex> lock(mutex_);
-        return (isStream_) ? writeToFifo(buff, size) : writeToFile(buff, size);
+        int32_t ret = 0;
+        if (isStream_) {
+            // 实况数据写入无锁的接收缓冲区，不和解码线程竞争mutex_
+            ret = ingest_.write(buff, size);
+        } else {
+            std::unique_lock<std::mutex> lock(mutex_);
+            ret = writeToFile(buff, size);
+        }
+        scheduleDecode();
+        return ret;
     }
 
+    // data由调用者的对象(如websocket消息)持有，实况数据只保存引用，不拷贝
+    int32_t sendData(std::shared_ptr<const uint8_t> data, int32_t size) {
+        if (data == nullptr || size == 0) {
+            raiseException(kErrorCode_Invalid_Param, "Invalid param");
+        }
+        int32_t ret = 0;
+        if (isStream_) {
+            ret = ingest_.write(std::move(data), size);
+        } else {
+            std::unique_lock<std::mutex> lock(mutex_);
+            ret = writeToFile(data.get(), size);
+        }
+        scheduleDecode();
+        return ret;
+    }
+
+    uint64_t getDecodeWakeups() const { return decodeWakeups_; }
+
+    // 客户端定期上报时钟，同时重新检查按发送缓冲区暂停的解码
+    void updateClock(double position) {
+        deadline_.updateClock(position);
+        scheduleDecode();
+    }
+
+    // 客户端追加视频帧的credit，先发送mailbox中保留的帧，再恢复暂停的解码
+    void grantCredit(int32_t frames) {
+        credit_.grant(frames);
+        flushMailbox();
+        scheduleDecode();
+    }
+
+    OutputCredit::Stats getCreditStats() { return credit_.getStats(); }
+
+    // 客户端窗口大小变化时调整输出尺寸，下一帧生效，0为原始尺寸
+    void setOutputSize(int32_t width, int32_t height) {
+        LOG_INFO("Set output size {}x{}.", width, height);
+        scaler_.setTarget(width, height);
+    }
+
+    uint64_t getDeadlineMisses() const { return deadline_.getMisses(); }
+
+    uint64_t getDecodedFrames() const { return deadline_.getFrames(); }
+
+    int64_t getIngestQueuedBytes() const { return ingest_.getQueuedBytes(); }
+
+    uint64_t getIngestDroppedBytes() const { return ingest_.getDroppedBytes(); }
+
+    uint64_t getIngestReceivedBytes() const { return ingest_.getReceivedBytes(); }
+
+    uint64_t getIngestCopiedBytes() const { return ingest_.getCopiedBytes(); }
+
+    static uint64_t getFramePoolAllocs() { return FrameBufferPool::INSTANCE().getAllocs(); }
+
+    static uint64_t getFramePoolGets() { return FrameBufferPool::INSTANCE().getGets(); }
+
+    static CodecContextPool::Stats getCodecPoolStats() { return CodecContextPool::INSTANCE().getStats(); }
+
+    uint64_t getCatchUps() const { return ingest_.getCatchUps(); }
+
+    uint64_t getCatchUpBytes() const { return ingest_.getCatchUpBytes(); }
+
+    StageTimings getStageTimings() const {
+        uint64_t frames = std::max<uint64_t>(1, stageFrames_.load());
+        uint64_t scaled = std::max<uint64_t>(1, scaler_.getScaledFrames());
+        return StageTimings{(double)decodeStageUs_ / frames, (double)prepareStageUs_ / frames, (double)packStageUs_ / frames,
+                            (double)scaler_.getScaleUs() / scaled};
+    }
+
+    double getVideoBytesPerFrame() const { return (double)videoBytes_ / std::max<uint64_t>(1, stageFrames_.load()); }
+
+    uint64_t getScaledFrames() const { return scaler_.getScaledFrames(); }
+
+    int32_t getQualityLevel() const { return ladder_.level(); }
+
+    uint64_t getQualitySwitches() const { return ladder_.getSwitches(); }
+
+    double getThroughput() const { return ladder_.getThroughput(); }
+
+    int64_t getProbeMs() const { return probeMs_; }
+
+    // 打开到发送第一个视频帧的耗时，还没有发送时为-1
+    int64_t getTtffMs() const { return ttffMs_; }
+
+    bool isFastOpened() const { return fastOpened_; }
+
+    // 裸流输入切分出的访问单元数
+    uint64_t getAccessUnits() const { return splitter_.getUnits(); }
+
+    static std::vector<common::WorkStealingPool::WorkerStats> getExecutorStats() { return decodeExecutor().getStats(); }
+
     void seekTo(int32_t ms, int32_t accurateSeek) {
         int64_t pts   = (int64_t)ms * 1000;
         accurateSeek_ = accurateSeek;
 
+        if (avformatContext_ == nullptr) {
+            raiseException(kErrorCode_Invalid_State, "Seek is not supported by elementary stream ingest");
+        }
+
         int32_t ret = avformat_seek_file(avformatContext_, -1, INT64_MIN, pts, pts, AVSEEK_FLAG_BACKWARD);
         if (ret == -1) {
             raiseException(kErrorCode_FFmpeg_Error, ffmpegError(ret));
@@ -328,6 +622,11 @@ public:
     }
 
     void decodeOnePacket() {
+        if (elementaryPar_ != nullptr) {
+            decodeAccessUnit();
+            return;
+        }
+
         if (avformatContext_ == nullptr) {
             return;
         }
@@ -345,10 +644,24 @@ public:
         packet.size = 0;
 
         int r = av_read_frame(avformatContext_, &packet);
+        // 实况流读到接收缓冲区的结尾时avio返回EAGAIN并标记了结束，清除后等待新的数据，不当作流结束
+        AVIOContext *pb = avformatContext_->pb;
+        if (isStream_ && (r == AVERROR(EAGAIN) || pb->error == AVERROR(EAGAIN))) {
+            pb->eof_reached = 0;
+            pb->error       = 0;
+            if (r != 0) {
+                return;
+            }
+        }
         if (r == AVERROR_EOF) {
             raiseException(kErrorCode_Eof, "Read frame EOF");
         }
 
+        // 线程配置只能在关键帧处切换，避免参考帧丢失
+        if (r == 0 && packet.stream_index == videoStreamIdx_ && (packet.flags & AV_PKT_FLAG_KEY)) {
+            applyThreadBudget();
+        }
+
         while (r == 0 && packet.size > 0) {
             int32_t decodedLen = 0;
             decodePacket(&packet, &decodedLen);
@@ -360,21 +673,364 @@ public:
         }
     }
 
+    // 裸流输入: 取出一个访问单元直接送给解码器，队列为空时从接收缓冲区读取数据切分
+    // 时间戳是访问单元切分出来的时间(us)，实况流按到达的节奏播放
+    void decodeAccessUnit() {
+        while (splitter_.empty()) {
+            if (ingest_.available() <= 0) {
+                return;
+            }
+            bool chunkEnd = false;
+            uint8_t *buff = splitter_.prepare(kCustomIoBufferSize);
+            int32_t n     = ingest_.read(buff, kCustomIoBufferSize, 0, &chunkEnd);
+            if (n <= 0) {
+                return;
+            }
+            splitter_.commit(n, ingestMode_ == kIngest_AccessUnit && chunkEnd);
+        }
+
+        AccessUnitSplitter::AccessUnit unit = splitter_.front();
+        common::RAII unitGuard([&]() { splitter_.pop(); });
+
+        int64_t now = common::WorkStealingPool::nowUs();
+        if (firstUnitUs_ < 0) {
+            firstUnitUs_ = now;
+        }
+
+        AVPacket packet;
+        av_init_packet(&packet);
+        packet.data         = (uint8_t *)unit.data;
+        packet.size         = (int32_t)unit.size;
+        packet.stream_index = videoStreamIdx_;
+        packet.pts          = now - firstUnitUs_;
+        packet.dts          = packet.pts;
+        packet.flags        = unit.keyframe ? AV_PKT_FLAG_KEY : 0;
+
+        // 线程配置只能在关键帧处切换，避免参考帧丢失
+        if (unit.keyframe) {
+            applyThreadBudget();
+        }
+
+        int32_t decodedLen = 0;
+        decodePacket(&packet, &decodedLen);
+    }
+
 private:
+    static common::WorkStealingPool &decodeExecutor() { return common::Singleton<common::WorkStealingPool>::getInstance(); }
+
+    // 异步打开使用独立的线程，探测时等待数据不占用解码worker
+    static std::threadpool &openExecutor() {
+        static std::threadpool pool(kOpenThreads);
+        return pool;
+    }
+
+    // 异步打开被取消或超时，只在打开期间生效
+    bool openInterrupted() { return opening_ && (openCancelled_ || (int64_t)getTickCount() > openDeadlineMs_); }
+
+    // 由avformat打开输入并探测流信息，只有视频的实况流先尝试按Annex-B参数集快速打开
+    void openFormatInput(bool hasVideo, bool hasAudio) {
+        avformatContext_ = avformat_alloc_context();
+        customIoBuffer_  = (uint8_t *)av_mallocz(kCustomIoBufferSize);
+
+        AVIOContext *ioContext = avio_alloc_context(customIoBuffer_, kCustomIoBufferSize, 0, (void *)this, FFmpegWrapper::ffReadCallback, nullptr,
+                                                    FFmpegWrapper::ffSeekCallback);
+        if (ioContext == nullptr) {
+            LOG_INFO("avio_alloc_context failed.");
+            raiseException(kErrorCode_FFmpeg_Error, "avio_alloc_context failed");
+        }
+
+        avformatContext_->pb                          = ioContext;
+        avformatContext_->flags                       = AVFMT_FLAG_CUSTOM_IO | AVFMT_FLAG_NONBLOCK;
+        avformatContext_->interrupt_callback.callback = FFmpegWrapper::ffInterruptCallback;
+        avformatContext_->interrupt_callback.opaque   = (void *)this;
+
+        fastOpened_ = isStream_ && hasVideo && !hasAudio && fastOpenEnabled_ && probeAnnexB(waitHeaderLength_, kFastOpenMaxIdleMs);
+        if (fastOpened_) {
+            ioContext->pos = fastOpen_.keyframePos();
+            openAnnexBInput();
+        } else {
+            int32_t r = avformat_open_input(&avformatContext_, nullptr, nullptr, nullptr);
+            if (r != 0) {
+                raiseOpenError("avformat_open_input failed: " + ffmpegError(r));
+            }
+
+            r = avformat_find_stream_info(avformatContext_, nullptr);
+            if (r != 0) {
+                raiseOpenError("av_find_stream_info failed: " + ffmpegError(r));
+            }
+        }
+
+        for (uint32_t i = 0; i < avformatContext_->nb_streams; i++) {
+            avformatContext_->streams[i]->discard      = AVDISCARD_DEFAULT;
+            avformatContext_->streams[i]->need_parsing = AVSTREAM_PARSE_FULL;
+        }
+    }
+
+    // 裸流输入: 扫描开头的参数集和第一个关键帧，按SPS建立解码参数，之后访问单元直接送给解码器，没有AVFormatContext和avio
+    // 没有退回的探测方式，一直等到参数集和关键帧或打开超时
+    void openElementaryInput(bool hasVideo, bool hasAudio) {
+        if (!hasVideo || hasAudio) {
+            raiseException(kErrorCode_Invalid_Param, "Elementary stream ingest only carries video");
+        }
+        if (!probeAnnexB(kMaxFifoSize, INT32_MAX)) {
+            raiseOpenError("No parameter sets and keyframe in elementary stream", kErrorCode_Invalid_Format);
+        }
+
+        fastOpened_    = true;
+        elementaryPar_ = avcodec_parameters_alloc();
+        if (elementaryPar_ == nullptr) {
+            raiseException(kErrorCode_FFmpeg_Error, "avcodec_parameters_alloc failed");
+        }
+        elementaryPar_->codec_type = AVMEDIA_TYPE_VIDEO;
+        elementaryPar_->codec_id   = fastOpen_.codec() == NalUnits::kCodec_HEVC ? AV_CODEC_ID_HEVC : AV_CODEC_ID_H264;
+        fillAnnexBParameters(elementaryPar_);
+        splitter_.reset(fastOpen_.codec());
+        firstUnitUs_ = -1;
+    }
+
+    // 扫描开头的数据尝试快速打开，成功时接收缓冲区的读位置在第一个关键帧所在的访问单元，否则回到开头
+    // maxBytes为扫描的上限，连续maxIdleMs没有数据时放弃
+    bool probeAnnexB(size_t maxBytes, int32_t maxIdleMs) {
+        fastOpen_.reset(knownCodec_, knownExtradata_, maxBytes);
+        std::vector<uint8_t> chunk(kCustomIoBufferSize);
+        int64_t pos    = 0;
+        int32_t idleMs = 0;
+        while (!fastOpen_.ready() && !fastOpen_.failed() && idleMs < maxIdleMs) {
+            int32_t n = readCallback(chunk.data(), (int32_t)chunk.size());
+            if (n == AVERROR(EAGAIN)) {
+                idleMs += kFifoReadTimeoutMs;
+                continue;
+            }
+            if (n <= 0) {
+                break;
+            }
+            fastOpen_.feed(chunk.data(), n, pos);
+            pos += n;
+            idleMs = 0;
+        }
+
+        bool ready = fastOpen_.ready();
+        if (ingest_.seek(ready ? fastOpen_.keyframePos() : 0) < 0) {
+            return false;
+        }
+        if (ready) {
+            const NalUnits::SpsInfo &sps = fastOpen_.sps();
+            LOG_INFO("Fast open {} {}x{}, {} bits, keyframe at {}, scanned {} bytes.", fastOpen_.codec() == NalUnits::kCodec_HEVC ? "hevc" : "h264",
+                     sps.width, sps.height, sps.bitDepth, fastOpen_.keyframePos(), pos);
+        } else {
+            LOG_INFO("Fast open not available after {} bytes, probe the stream.", pos);
+        }
+        return ready;
+    }
+
+    // 用快速打开得到的参数集和SPS建立输入，不调用avformat_find_stream_info
+    void openAnnexBInput() {
+        AVInputFormat *format = av_find_input_format(fastOpen_.codec() == NalUnits::kCodec_HEVC ? "hevc" : "h264");
+        int32_t r             = avformat_open_input(&avformatContext_, nullptr, format, nullptr);
+        if (r != 0) {
+            raiseOpenError("avformat_open_input failed: " + ffmpegError(r));
+        }
+        if (avformatContext_->nb_streams < 1) {
+            raiseException(kErrorCode_Invalid_Format, "No stream in annex-b input");
+        }
+
+        fillAnnexBParameters(avformatContext_->streams[0]->codecpar);
+    }
+
+    // 按快速打开收集的参数集和SPS填写解码参数
+    void fillAnnexBParameters(AVCodecParameters *par) {
+        std::string extradata        = fastOpen_.extradata();
+        const NalUnits::SpsInfo &sps = fastOpen_.sps();
+        par->extradata               = (uint8_t *)av_mallocz(extradata.size() + AV_INPUT_BUFFER_PADDING_SIZE);
+        par->extradata_size          = (int32_t)extradata.size();
+        par->width                   = sps.width;
+        par->height                  = sps.height;
+        par->format                  = spsPixelFormat(fastOpen_.codec(), sps);
+        memcpy(par->extradata, extradata.data(), extradata.size());
+    }
+
+    // 按SPS的色度格式和位深推断解码输出的像素格式，不常见的组合由解码器在第一帧确定
+    // 单色(chroma_format_idc为0)的H.265输出GRAY8/GRAY10，addVideoRegions按单色输出；
+    // H.264单色码流的输出格式和FFmpeg的编译配置有关，也由解码器确定
+    static int32_t spsPixelFormat(NalUnits::Codec codec, const NalUnits::SpsInfo &sps) {
+        static const AVPixelFormat formats8[]  = {AV_PIX_FMT_GRAY8, AV_PIX_FMT_YUV420P, AV_PIX_FMT_YUV422P, AV_PIX_FMT_YUV444P};
+        static const AVPixelFormat formats10[] = {AV_PIX_FMT_GRAY10LE, AV_PIX_FMT_YUV420P10LE, AV_PIX_FMT_YUV422P10LE, AV_PIX_FMT_YUV444P10LE};
+        if (sps.chromaFormat < 0 || sps.chromaFormat > 3 || (sps.bitDepth != 8 && sps.bitDepth != 10) ||
+            (sps.chromaFormat == 0 && codec != NalUnits::kCodec_HEVC)) {
+            return AV_PIX_FMT_NONE;
+        }
+        return sps.bitDepth == 8 ? formats8[sps.chromaFormat] : formats10[sps.chromaFormat];
+    }
+
+    void raiseOpenError(const std::string &msg, ErrorCode code = kErrorCode_FFmpeg_Error) {
+        if (opening_ && openCancelled_) {
+            raiseException(kErrorCode_Cancelled, "Open cancelled");
+        } else if (openInterrupted()) {
+            raiseException(kErrorCode_Timeout, "Open timeout, " + msg);
+        }
+        raiseException(code, msg);
+    }
+
+    bool canDecode() { return opened_ && decoding_ && !closed_ && (getAailableDataSize() > 0 || !splitter_.empty()) && !credit_.shouldPause(); }
+
+    // 每个会话同一时刻最多只有一个解码任务在队列或执行中，保证同一会话的包不会在两个worker上并行解码
+    // 不加锁，生产者先写数据再检查scheduled_，解码任务先清scheduled_再检查数据，两边至少有一方会提交任务
+    void scheduleDecode() {
+        if (!canDecode() || scheduled_.exchange(true)) {
+            return;
+        }
+        deadline_.onPending();
+        auto self = shared_from_this();
+        decodeExecutor().submit([self]() { self->runDecodeTask(); }, deadline_.priority());
+    }
+
+    void stopDecodeTask() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        opened_ = false;
+        ingest_.setAborted(true);
+        dataCond_.wait(lock, [this]() { return !scheduled_; });
+        LOG_INFO("Decode task stopped, wakeups {}.", decodeWakeups_.load());
+    }
+
+    void runDecodeTask() {
+        decodeWakeups_++;
+
+        if (isStream_ && canDecode()) {
+            catchUpLive();
+        }
+
+        for (int32_t i = 0; i < kPacketsPerDecodeTask; i++) {
+            if (!canDecode()) {
+                break;
+            }
+
+            try {
+                decodeOnePacket();
+            } catch (BizException &e) {
+                LOG_ERROR("Decode frame error, code={}, reason={}", e.code, e.msg);
+            } catch (std::exception &e) {
+                LOG_ERROR("Decode frame error, reason={}", e.what());
+            }
+        }
+
+        // 让出worker，还有数据时重新排到队尾
+        scheduled_ = false;
+        scheduleDecode();
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        dataCond_.notify_all();
+    }
+
+    void setIngestFormat() {
+        if (elementaryPar_ != nullptr) {
+            bool hevc = fastOpen_.codec() == NalUnits::kCodec_HEVC;
+            ingest_.setFormat(hevc ? KeyframeIndexer::kFormat_HEVC : KeyframeIndexer::kFormat_H264, videoStreamIdx_);
+            return;
+        }
+
+        std::string name = avformatContext_->iformat->name;
+        int32_t videoPid = videoStreamIdx_ >= 0 ? avformatContext_->streams[videoStreamIdx_]->id : -1;
+
+        KeyframeIndexer::Format format = KeyframeIndexer::kFormat_None;
+        if (name == "mpegts") {
+            format = KeyframeIndexer::kFormat_TS;
+        } else if (name == "h264") {
+            format = KeyframeIndexer::kFormat_H264;
+        } else if (name == "hevc") {
+            format = KeyframeIndexer::kFormat_HEVC;
+        }
+
+        if (format == KeyframeIndexer::kFormat_None || videoPid < 0) {
+            LOG_INFO("Live catch up disabled for format {}.", name);
+            return;
+        }
+        ingest_.setFormat(format, videoPid);
+    }
+
+    // 实况积压过多时跳到最新的关键帧，丢弃avio、demuxer(裸流输入时为切分的访问单元)和codec中跳转前的数据
+    void catchUpLive() {
+        int64_t pos = ingest_.catchUp();
+        if (pos < 0) {
+            return;
+        }
+
+        if (elementaryPar_ != nullptr) {
+            splitter_.reset(fastOpen_.codec());
+        } else {
+            AVIOContext *pb = avformatContext_->pb;
+            pb->buf_ptr     = pb->buffer;
+            pb->buf_end     = pb->buffer;
+            pb->pos         = pos;
+            pb->eof_reached = 0;
+
+            avformat_flush(avformatContext_);
+        }
+        if (videoCodecContext_ != nullptr) {
+            avcodec_flush_buffers(videoCodecContext_);
+        }
+        if (audioCodecContext_ != nullptr) {
+            avcodec_flush_buffers(audioCodecContext_);
+        }
+    }
+
     static int32_t ffReadCallback(void *opaque, uint8_t *buf, int32_t buf_size) { return ((FFmpegWrapper *)opaque)->readCallback(buf, buf_size); }
 
     static int64_t ffSeekCallback(void *opaque, int64_t offset, int32_t whence) { return ((FFmpegWrapper *)opaque)->seekCallback(offset, whence); }
 
+    static int32_t ffInterruptCallback(void *opaque) { return ((FFmpegWrapper *)opaque)->openInterrupted() ? 1 : 0; }
+
+    // 裸流输入没有AVFormatContext，使用打开时按SPS建立的解码参数，流序号固定为0
+    void openVideoCodecContext() {
+        if (elementaryPar_ != nullptr) {
+            videoStreamIdx_ = 0;
+            openCodecContext(elementaryPar_, AVMEDIA_TYPE_VIDEO, &videoCodecContext_);
+        } else {
+            openCodecContext(avformatContext_, AVMEDIA_TYPE_VIDEO, &videoStreamIdx_, &videoCodecContext_);
+        }
+    }
+
     void openCodecContext(AVFormatContext *fmtCtx, enum AVMediaType type, int32_t *streamIdx, AVCodecContext **decCtx) {
         int32_t ret = av_find_best_stream(fmtCtx, type, -1, -1, nullptr, 0);
         if (ret < 0) {
             raiseException(kErrorCode_FFmpeg_Error, "av_find_best_stream error, " + ffmpegError(ret));
         }
 
-        int32_t streamIndex = ret;
-        AVStream *st        = fmtCtx->streams[streamIndex];
+        openCodecContext(fmtCtx->streams[ret]->codecpar, type, decCtx);
+        *streamIdx = ret;
+    }
 
-        AVCodec *dec = avcodec_find_decoder(st->codecpar->codec_id);
+    void openCodecContext(const AVCodecParameters *par, enum AVMediaType type, AVCodecContext **decCtx) {
+        CodecThreadBudget::ThreadConfig threadConfig{1, FF_THREAD_FRAME};
+        bool burst = false; // 其他会话正在集中打开或关闭，线程预算还没有稳定
+        if (type == AVMEDIA_TYPE_VIDEO) {
+            auto &budget = CodecThreadBudget::INSTANCE();
+            burst        = !budget.settled();
+            if (budgetId_ == 0) {
+                bool wavefront = NalUnits::wavefrontEnabled(par->codec_id == AV_CODEC_ID_HEVC ? NalUnits::kCodec_HEVC : NalUnits::kCodec_H264,
+                                                            par->extradata, par->extradata_size);
+                budgetId_      = budget.registerSession(par->width, par->height, par->codec_id, isStream_, wavefront);
+            }
+            budgetGeneration_  = budget.getGeneration();
+            threadConfig       = budget.getConfig(budgetId_);
+            videoThreadConfig_ = threadConfig;
+            LOG_INFO("Video codec threads {}, thread type {}.", threadConfig.threads, threadConfig.typeName());
+        }
+
+        // Annex-B视频从池中取出已经打开的上下文，集中打开时可能取到线程数较少的，预算稳定后再按分配的线程数重建
+        videoContextPooled_ = false;
+        if (type == AVMEDIA_TYPE_VIDEO && CodecContextPool::eligible(par)) {
+            *decCtx = CodecContextPool::INSTANCE().checkout(par, threadConfig, burst);
+            if (*decCtx == nullptr) {
+                raiseException(kErrorCode_FFmpeg_Error, "Checkout codec context failed");
+            }
+            videoContextPooled_ = true;
+            threadsDeferred_    = threadConfig != videoThreadConfig_;
+            videoThreadConfig_  = threadConfig;
+            return;
+        }
+
+        int32_t ret  = 0;
+        AVCodec *dec = avcodec_find_decoder(par->codec_id);
         // dec = avcodec_find_decoder_by_name("hevc");
         if (!dec) {
             ret = AVERROR(EINVAL);
@@ -387,86 +1043,106 @@ private:
             raiseException(kErrorCode_FFmpeg_Error, "avcodec_alloc_context3 error, " + ffmpegError(ret));
         }
 
-        if ((ret = avcodec_parameters_to_context(*decCtx, st->codecpar)) != 0) {
+        if ((ret = avcodec_parameters_to_context(*decCtx, par)) != 0) {
             raiseException(kErrorCode_FFmpeg_Error, "avcodec_parameters_to_context error, " + ffmpegError(ret));
         }
 
         AVDictionary *opts = nullptr;
         common::RAII optsGuard([&]() { av_dict_free(&opts); });
 
+        // 视频帧从进程级的帧池分配，复用内存
+        if (type == AVMEDIA_TYPE_VIDEO) {
+            (*decCtx)->get_buffer2 = FrameBufferPool::getBuffer2;
+#if LIBAVCODEC_VERSION_MAJOR < 59
+            (*decCtx)->thread_safe_callbacks = 1;
+#endif
+        }
+
         av_dict_set(&opts, "refcounted_frames", "0", 0);
-        av_dict_set(&opts, "threads", "4", 0);
+        av_dict_set(&opts, "threads", std::to_string(threadConfig.threads).c_str(), 0);
+        av_dict_set(&opts, "thread_type", threadConfig.typeName().c_str(), 0);
         av_dict_set(&opts, "probesize", std::to_string(waitHeaderLength_).c_str(), 0);
 
         if ((ret = avcodec_open2(*decCtx, dec, &opts)) != 0) {
             raiseException(kErrorCode_FFmpeg_Error, "avcodec_open2 error, " + ffmpegError(ret));
         }
 
-        *streamIdx = streamIndex;
         avcodec_flush_buffers(*decCtx);
     }
 
-    void closeCodecContext(AVFormatContext *fmtCtx, AVCodecContext *decCtx, uint32_t streamIdx) {
-        if (fmtCtx == nullptr || decCtx == nullptr) {
+    // 全局线程预算变化后(或池中取出的上下文线程数少于分配的，预算已经稳定)，输出codec中缓存的帧，用新的线程配置重建video codec
+    void applyThreadBudget() {
+        auto &budget        = CodecThreadBudget::INSTANCE();
+        uint64_t generation = budget.getGeneration();
+        if (budgetId_ == 0 || (generation == budgetGeneration_ && !(threadsDeferred_ && budget.settled()))) {
             return;
         }
 
-        if (streamIdx < 0 || streamIdx >= fmtCtx->nb_streams) {
+        budgetGeneration_ = generation;
+        threadsDeferred_  = false;
+        auto threadConfig = budget.getConfig(budgetId_);
+        if (threadConfig == videoThreadConfig_) {
             return;
         }
 
-        fmtCtx->streams[streamIdx]->discard = AVDISCARD_ALL;
-        avcodec_close(decCtx);
-    }
-
-    void copyYuvData(AVFrame *frame, uint8_t *buffer, int32_t width, int32_t height) {
-        uint8_t *src = nullptr;
-        uint8_t *dst = buffer;
-        int32_t i    = 0;
-
-        if (frame == nullptr || buffer == nullptr) {
-            raiseException(kErrorCode_Invalid_Param, "Invalid param");
-        }
+        LOG_INFO("Rebalance video codec threads {}({}) -> {}({}).", videoThreadConfig_.threads, videoThreadConfig_.typeName(), threadConfig.threads,
+                 threadConfig.typeName());
 
-        if (!frame->data[0] || !frame->data[1] || !frame->data[2]) {
-            raiseException(kErrorCode_Invalid_Param, "Invalid param");
+        avcodec_send_packet(videoCodecContext_, nullptr);
+        while (avcodec_receive_frame(videoCodecContext_, avFrame_) == 0) {
+            try {
+                processDecodedVideoFrame(avFrame_, FrameHeader::nowUs());
+            } catch (BizException &e) {
+                LOG_WARN("Drop drained frame, code={}, reason={}", e.code, e.msg);
+            }
         }
 
-        for (i = 0; i < height; i++) {
-            src = frame->data[0] + i * frame->linesize[0];
-            memcpy(dst, src, width);
-            dst += width;
+        // 池中的上下文按原来的线程配置放回，其他会话还可以使用
+        if (videoContextPooled_) {
+            CodecContextPool::INSTANCE().checkin(videoCodecContext_, videoThreadConfig_);
+            videoCodecContext_ = nullptr;
+        } else {
+            avcodec_free_context(&videoCodecContext_);
         }
+        openVideoCodecContext();
+    }
 
-        for (i = 0; i < height / 2; i++) {
-            src = frame->data[1] + i * frame->linesize[1];
-            memcpy(dst, src, width / 2);
-            dst += width / 2;
+    void closeCodecContext(AVFormatContext *fmtCtx, AVCodecContext *decCtx, uint32_t streamIdx) {
+        if (decCtx == nullptr) {
+            return;
         }
 
-        for (i = 0; i < height / 2; i++) {
-            src = frame->data[2] + i * frame->linesize[2];
-            memcpy(dst, src, width / 2);
-            dst += width / 2;
+        // 裸流输入没有AVFormatContext
+        if (fmtCtx != nullptr) {
+            if (streamIdx < 0 || streamIdx >= fmtCtx->nb_streams) {
+                return;
+            }
+            fmtCtx->streams[streamIdx]->discard = AVDISCARD_ALL;
         }
+        avcodec_close(decCtx);
     }
 
     void copyPcmData(AVFrame *frame, uint8_t *buffer, uint32_t sampleSize) {
-        uint32_t offset = 0;
-        for (int32_t i = 0; i < frame->nb_samples; i++) {
-            for (int32_t ch = 0; ch < audioCodecContext_->channels; ch++) {
-                memcpy(pcmBuffer_ + offset, frame->data[ch] + sampleSize * i, sampleSize);
-                offset += sampleSize;
-            }
+        int32_t channels = audioCodecContext_->channels;
+        if (!av_sample_fmt_is_planar((enum AVSampleFormat)frame->format)) {
+            memcpy(buffer, frame->data[0], (size_t)frame->nb_samples * channels * sampleSize);
+            return;
         }
+        PackKernels::INSTANCE().interleave(buffer, (const uint8_t *const *)frame->extended_data, channels, frame->nb_samples, sampleSize);
     }
 
     int32_t readCallback(uint8_t *data, int32_t len) {
         if (data == nullptr || len <= 0) {
             return -1;
         }
+        if (openInterrupted()) {
+            return AVERROR_EXIT;
+        }
+        if (isStream_) {
+            return readFromFifo(data, len);
+        }
         std::unique_lock<std::mutex> lock(mutex_);
-        return (isStream_) ? readFromFifo(data, len) : readFromFile(data, len);
+        return readFromFile(data, len);
     }
 
     int64_t seekCallback(int64_t offset, int32_t whence) {
@@ -480,30 +1156,24 @@ private:
             return -1;
         }
 
-        LOG_INFO("Seek fifo, whence {}, offset {}, fifoSize {}", whence, offset, fifoSize_);
+        LOG_INFO("Seek fifo, whence {}, offset {}, queued {}", whence, offset, ingest_.getQueuedBytes());
 
         /*
-         * fifo原本不支持seek操作，但实况时，如果不支持seek操作会导致解析首帧视频时很慢，这里针对fifo做的seek做简单的操作
-         * 当为SEEK_SET时，把read指针指向开始，fifo的空间最好设置大一些，避免覆盖
-         * 暂时没想到其他办法，实属无奈^^
+         * 实况流本身不支持seek，但不支持seek会导致探测首帧视频时很慢
+         * 接收缓冲区在探测期间保留了已读数据，这里只支持seek到保留的范围内
          */
-        if (whence == SEEK_SET) {
-            // 因为fifo是循环写的，但seek的时候传入的offset不是循环的，所以，这里转成循环后的offset
-            offset = offset % fifoSize_;
-            avFifoReadReset(fifo_);
-        } else if (whence == SEEK_END) {
-            // seek保护，避免内存越界，从末尾seek,最多可以seek到开始
-            if ((fifo_->rptr + offset) < fifo_->buffer) {
-                LOG_ERROR("Invalid fifo seek, offset={}, whence={}", offset, whence);
-                return -1;
-            }
-        } else {
+        if (whence == AVSEEK_SIZE) {
+            return -1;
+        } else if (whence != SEEK_SET) {
             LOG_ERROR("Unsupported whence {}, offset is {}", whence, offset);
             return -1;
         }
 
-        av_fifo_drain(fifo_, offset);
-        return offset;
+        int64_t ret = ingest_.seek(offset);
+        if (ret < 0) {
+            LOG_ERROR("Invalid fifo seek, offset={}, whence={}", offset, whence);
+        }
+        return ret;
     }
 
     int64_t seekFile(int64_t offset, int32_t whence) {
@@ -552,52 +1222,254 @@ private:
         return ret;
     }
 
-    void avFifoReadReset(AVFifoBuffer *f) {
-        // 重置fifo的读指针到开始
-        f->rptr = f->buffer;
-        f->rndx = 0;
-    }
-
     int32_t roundUp(int32_t numToRound, int32_t multiple) { return (numToRound + multiple - 1) & -multiple; }
 
-    void processDecodedVideoFrame(AVFrame *frame) {
-        double timestamp = 0.0f;
-        int32_t offset   = 0;
+    // decodedUs为avcodec_receive_frame返回这一帧的时间
+    void processDecodedVideoFrame(AVFrame *frame, int64_t decodedUs) {
+        int64_t stageBegin = common::WorkStealingPool::nowUs();
+        double timestamp   = 0.0f;
+        FrameHeader header;
+        uint8_t headerData[FrameHeader::kMaxSize];
 
-        if (frame == nullptr || videoCallback_ == nullptr || videoBufferSize_ <= 0) {
+        if (frame == nullptr || videoCallback_ == nullptr) {
             raiseException(kErrorCode_Invalid_Param, "Invalid param");
         }
 
-        if (videoCodecContext_->pix_fmt != AV_PIX_FMT_YUV420P && videoCodecContext_->pix_fmt != AV_PIX_FMT_YUVJ420P) {
-            raiseException(kErrorCode_Invalid_Format, std::string("Unknown pixel format ") + std::to_string(videoCodecContext_->pix_fmt));
+        // 单色(4:0:0)的帧只有Y平面
+        if (!frame->data[0] || (!isGray(frame->format) && (!frame->data[1] || !frame->data[2]))) {
+            raiseException(kErrorCode_Invalid_Param, "Invalid param");
         }
 
-        timestamp = (double)frame->pts * av_q2d(avformatContext_->streams[videoStreamIdx_]->time_base);
+        AVRational timeBase = avformatContext_ != nullptr ? avformatContext_->streams[videoStreamIdx_]->time_base : AVRational{1, 1000000};
+        timestamp           = (double)frame->pts * av_q2d(timeBase);
+        deadline_.onVideoFrame(timestamp);
 
         if (accurateSeek_ && timestamp < beginTimeOffset_) {
             raiseException(kErrorCode_Old_Frame, "video timestamp " + std::to_string(timestamp) + "< " + std::to_string(beginTimeOffset_));
         }
 
-        // set data type
-        yuvBuffer_[0] = KVideoFrameFlag;
-        offset += KDecodedDataTypeLength;
-        // set timestamp
-        memcpy(yuvBuffer_ + offset, timestamp2str(timestamp).c_str(), KTimeStampStrLength);
-        offset += KTimeStampStrLength;
-        // set data
-        copyYuvData(frame, yuvBuffer_ + offset, videoCodecContext_->width, videoCodecContext_->height);
-        // callback
-        videoCallback_(yuvBuffer_, KDecodedDataTypeLength + KTimeStampStrLength + videoSize_);
+        // 自适应档位在显示尺寸的基础上再缩小，最低档只发送Y平面
+        QualityLadder::Level level = ladder_.level();
+        OutputFormat format        = QualityLadder::lumaOnly(level) ? kOutputFormat_Y : output_.format;
+        uint32_t rendition         = ((uint32_t)level << FrameHeader::kRenditionShift) | (level != rendition_ ? FrameHeader::kFlag_RenditionChanged : 0);
+        scaler_.setDivisor(QualityLadder::divisor(level));
+
+        // 缩小到客户端的显示尺寸，不需要缩放时返回原帧；NV12/RGBA的打包内核只支持8位4:2:0，其他格式先转换
+        bool yuv420p8 = frame->format == AV_PIX_FMT_YUV420P || frame->format == AV_PIX_FMT_YUVJ420P;
+        bool convert  = (format == kOutputFormat_NV12 || format == kOutputFormat_RGBA) && !yuv420p8;
+        frame         = scaler_.scale(frame, format == kOutputFormat_Y ? AV_PIX_FMT_GRAY8 : AV_PIX_FMT_YUV420P, convert);
+        if (frame == nullptr) {
+            raiseException(kErrorCode_FFmpeg_Error, "Scale video frame failed");
+        }
+
+        // set data, 各平面转换后直接写入待发送消息，分辨率变化时尺寸跟随当前帧
+        videoPayload_.clear();
+        header.format = addVideoRegions(frame, format, header.strides);
+        // set header, 平面紧密排列发送，stride即各平面行字节数
+        header.type        = FrameHeader::kType_Video;
+        header.seq         = videoSeq_++;
+        header.pts         = frame->pts;
+        header.timeBaseNum = timeBase.num;
+        header.timeBaseDen = timeBase.den;
+        header.decodeUs    = decodedUs;
+        header.flags       = (frame->key_frame ? FrameHeader::kFlag_Keyframe : 0) | rendition;
+        header.width       = frame->width;
+        header.height      = frame->height;
+        videoPayload_.setHeader(headerData, header.encode(headerData, headerVersion_));
+        // flow control
+        size_t sentBytes = 0;
+        switch (credit_.admit(videoPayload_.size())) {
+            case OutputCredit::kDecision_Drop:
+                break;
+            case OutputCredit::kDecision_Hold:
+                holdMailbox();
+                break;
+            default:
+                dropMailbox();
+                sentBytes = videoPayload_.size();
+                sendVideoPayload(stageBegin);
+                // 档位切换的标志一直带到切换后实际发送的第一帧
+                rendition_ = level;
+                break;
+        }
+        // 按这一帧的发送情况和发送缓冲区的变化调整下一帧的档位
+        ladder_.onFrame(common::WorkStealingPool::nowUs(), sentBytes, credit_.buffered(), credit_.congestion());
+    }
+
+    void sendVideoPayload(int64_t stageBegin) {
+        int64_t packBegin = common::WorkStealingPool::nowUs();
+        videoCallback_(videoPayload_);
+        if (ttffMs_ < 0) {
+            ttffMs_ = getTickCount() - openBeginMs_;
+            LOG_INFO("First video frame sent {}ms after open, fast open {}.", ttffMs_.load(), fastOpened_.load());
+        }
+        prepareStageUs_ += packBegin - stageBegin;
+        packStageUs_ += common::WorkStealingPool::nowUs() - packBegin;
+        videoBytes_ += videoPayload_.size();
+        stageFrames_++;
+    }
+
+    static bool isGray(int32_t format) { return format == AV_PIX_FMT_GRAY8 || format == AV_PIX_FMT_GRAY10LE; }
+
+    // 按输出格式添加帧的区域，返回输出的像素格式，strides为输出各平面的行字节数
+    // 高位深转8位、4:2:2/4:4:4的色度降采样、UV交织、转RGBA在打包时和拷贝一起完成，不支持的格式抛出异常
+    // 单色的帧输出I420时色度平面为中性值(0x80)，NV12/RGBA在缩放时已经转换成YUV420P
+    int32_t addVideoRegions(AVFrame *frame, OutputFormat format, int32_t *strides) {
+        PackKernels::Convert luma = {1, 0, 1, 1, output_.dither};
+        int32_t hsub              = 1;
+        int32_t vsub              = 1;
+        bool fullRange            = false;
+
+        switch (frame->format) {
+            case AV_PIX_FMT_YUV420P:
+            case AV_PIX_FMT_GRAY8: // 单色的帧，或只输出Y时缩放后的帧
+                break;
+            case AV_PIX_FMT_YUVJ420P:
+                fullRange = true;
+                break;
+            case AV_PIX_FMT_YUV422P:
+                vsub = 2;
+                break;
+            case AV_PIX_FMT_YUVJ422P:
+                vsub      = 2;
+                fullRange = true;
+                break;
+            case AV_PIX_FMT_YUV444P:
+                hsub = 2;
+                vsub = 2;
+                break;
+            case AV_PIX_FMT_YUVJ444P:
+                hsub      = 2;
+                vsub      = 2;
+                fullRange = true;
+                break;
+            case AV_PIX_FMT_YUV420P10LE:
+            case AV_PIX_FMT_GRAY10LE:
+                luma.srcBytes = 2;
+                break;
+            case AV_PIX_FMT_YUV422P10LE:
+                luma.srcBytes = 2;
+                vsub          = 2;
+                break;
+            case AV_PIX_FMT_YUV444P10LE:
+                luma.srcBytes = 2;
+                hsub          = 2;
+                vsub          = 2;
+                break;
+            default:
+                raiseException(kErrorCode_Invalid_Format, std::string("Unknown pixel format ") + std::to_string(frame->format));
+        }
+
+        int32_t width       = frame->width;
+        int32_t height      = frame->height;
+        int32_t chromaWidth = width / 2;
+        int32_t chromaRows  = height / 2;
+
+        luma.shift = luma.srcBytes == 2 ? 2 : 0;
+        strides[1] = strides[2] = 0;
+
+        // 只发送Y平面，不读取色度
+        if (format == kOutputFormat_Y) {
+            strides[0] = width;
+            videoPayload_.addRegion(frame->data[0], frame->linesize[0], width, height, luma);
+            return AV_PIX_FMT_GRAY8;
+        }
+
+        if (format == kOutputFormat_NV12 || format == kOutputFormat_RGBA) {
+            if (!luma.identity() || hsub != 1 || vsub != 1 || isGray(frame->format)) {
+                raiseException(kErrorCode_Invalid_Format, std::string("Unconverted pixel format ") + std::to_string(frame->format));
+            }
+            if (format == kOutputFormat_NV12) {
+                strides[0] = width;
+                strides[1] = chromaWidth * 2;
+                videoPayload_.addRegion(frame->data[0], frame->linesize[0], width, height);
+                videoPayload_.addInterleavedRegion(frame->data[1], frame->linesize[1], frame->data[2], frame->linesize[2], chromaWidth, chromaRows);
+                return AV_PIX_FMT_NV12;
+            }
+            fullRange  = fullRange || frame->color_range == AVCOL_RANGE_JPEG;
+            strides[0] = width * 4;
+            videoPayload_.addRgbaRegion(frame->data, frame->linesize, width, height,
+                                        PackKernels::yuvMatrix(frame->colorspace == AVCOL_SPC_BT709, fullRange));
+            return AV_PIX_FMT_RGBA;
+        }
+
+        // 客户端可以渲染16位采样时，10位4:2:0原样发送
+        if (output_.highBitDepth && frame->format == AV_PIX_FMT_YUV420P10LE) {
+            strides[0] = width * 2;
+            strides[1] = strides[2] = chromaWidth * 2;
+            videoPayload_.addRegion(frame->data[0], frame->linesize[0], strides[0], height);
+            videoPayload_.addRegion(frame->data[1], frame->linesize[1], strides[1], chromaRows);
+            videoPayload_.addRegion(frame->data[2], frame->linesize[2], strides[2], chromaRows);
+            return AV_PIX_FMT_YUV420P10LE;
+        }
+
+        PackKernels::Convert chroma = luma;
+        chroma.hsub                 = hsub;
+        chroma.vsub                 = vsub;
+
+        strides[0] = width;
+        strides[1] = strides[2] = chromaWidth;
+        videoPayload_.addRegion(frame->data[0], frame->linesize[0], width, height, luma);
+        if (isGray(frame->format)) {
+            // 色度的每一行都从同一行中性值拷贝
+            if ((int32_t)neutralChroma_.size() < chromaWidth) {
+                neutralChroma_.assign(chromaWidth, 0x80);
+            }
+            videoPayload_.addRegion(neutralChroma_.data(), 0, chromaWidth, chromaRows);
+            videoPayload_.addRegion(neutralChroma_.data(), 0, chromaWidth, chromaRows);
+            return AV_PIX_FMT_YUV420P;
+        }
+        videoPayload_.addRegion(frame->data[1], frame->linesize[1], chromaWidth, chromaRows, chroma);
+        videoPayload_.addRegion(frame->data[2], frame->linesize[2], chromaWidth, chromaRows, chroma);
+        return fullRange ? AV_PIX_FMT_YUVJ420P : AV_PIX_FMT_YUV420P;
+    }
+
+    // 没有credit时只保留最新的一帧，帧的数据会被解码器复用，打包后保存
+    void holdMailbox() {
+        std::unique_lock<std::mutex> lock(mailboxMutex_);
+        if (mailboxFull_) {
+            credit_.onMailboxReplaced();
+        }
+        mailbox_.clear();
+        videoPayload_.appendTo(mailbox_);
+        mailboxHeaderSize_ = (int32_t)videoPayload_.header().size();
+        mailboxFull_       = true;
+    }
+
+    // 有credit发送新帧时，mailbox中更早的帧已经过时
+    void dropMailbox() {
+        std::unique_lock<std::mutex> lock(mailboxMutex_);
+        if (mailboxFull_) {
+            credit_.onMailboxReplaced();
+            mailboxFull_ = false;
+        }
+    }
+
+    void flushMailbox() {
+        std::unique_lock<std::mutex> lock(mailboxMutex_);
+        if (!opened_ || !mailboxFull_ || !credit_.tryConsume()) {
+            return;
+        }
+        // 头部单独设置，发送时可以按头部版本压缩数据部分
+        int32_t dataSize = (int32_t)mailbox_.size() - mailboxHeaderSize_;
+        FramePayload held;
+        held.setHeader((const uint8_t *)mailbox_.data(), mailboxHeaderSize_);
+        held.addRegion((const uint8_t *)mailbox_.data() + mailboxHeaderSize_, dataSize, dataSize, 1);
+        videoCallback_(held);
+        mailboxFull_ = false;
     }
 
-    void processDecodedAudioFrame(AVFrame *frame) {
+    void processDecodedAudioFrame(AVFrame *frame, int64_t decodedUs) {
         int32_t sampleSize    = 0;
         int32_t audioDataSize = 0;
         int32_t targetSize    = 0;
         int32_t offset        = 0;
         int32_t i             = 0;
         int32_t ch            = 0;
+        int32_t headerSize    = 0;
         double timestamp      = 0.0f;
+        FrameHeader header;
+        uint8_t headerData[FrameHeader::kMaxSize];
 
         if (frame == nullptr || audioCallback_ == nullptr) {
             raiseException(kErrorCode_Invalid_Param, "Invalid param");
@@ -614,26 +1486,35 @@ private:
             LOG_INFO("PCM buffer size {} not sufficient for data size {}, round up to target {}.", pcmBufferSize_, audioDataSize, targetSize);
             pcmBufferSize_ = targetSize;
             av_free(pcmBuffer_);
-            pcmBuffer_ = (uint8_t *)av_mallocz(pcmBufferSize_ + KTimeStampStrLength + KDecodedDataTypeLength);
+            pcmBuffer_ = (uint8_t *)av_mallocz(FrameHeader::kMaxSize + pcmBufferSize_);
         }
 
-        timestamp = (double)frame->pts * av_q2d(avformatContext_->streams[audioStreamIdx_]->time_base);
+        AVRational timeBase = avformatContext_->streams[audioStreamIdx_]->time_base;
+        timestamp           = (double)frame->pts * av_q2d(timeBase);
 
         if (accurateSeek_ && timestamp < beginTimeOffset_) {
             LOG_INFO("audio timestamp {} < {}", timestamp, beginTimeOffset_);
             raiseException(kErrorCode_Old_Frame, "Old frame");
         }
 
-        // set data type
-        pcmBuffer_[0] = KAudioFrameFlag;
-        offset += KDecodedDataTypeLength;
-        // set timestamp
-        memcpy(pcmBuffer_ + offset, timestamp2str(timestamp).c_str(), KTimeStampStrLength);
-        offset += KTimeStampStrLength;
-        // set data
-        copyPcmData(frame, pcmBuffer_ + offset, sampleSize);
+        // set data, pcm从最大头部长度之后开始写，头部可紧贴其前写入
+        copyPcmData(frame, pcmBuffer_ + FrameHeader::kMaxSize, sampleSize);
+        // set header
+        header.type        = FrameHeader::kType_Audio;
+        header.seq         = audioSeq_++;
+        header.pts         = frame->pts;
+        header.timeBaseNum = timeBase.num;
+        header.timeBaseDen = timeBase.den;
+        header.decodeUs    = decodedUs;
+        header.format      = audioCodecContext_->sample_fmt;
+        header.width       = audioCodecContext_->sample_rate;
+        header.height      = audioCodecContext_->channels;
+        header.strides[0]  = frame->nb_samples;
+        headerSize         = header.encode(headerData, headerVersion_);
+        offset             = FrameHeader::kMaxSize - headerSize;
+        memcpy(pcmBuffer_ + offset, headerData, headerSize);
         // callback
-        audioCallback_(pcmBuffer_, KDecodedDataTypeLength + KTimeStampStrLength + audioDataSize);
+        audioCallback_(pcmBuffer_ + offset, headerSize + audioDataSize);
     }
 
     void decodePacket(AVPacket *pkt, int32_t *decodedLen) {
@@ -657,7 +1538,16 @@ private:
             raiseException(kErrorCode_Invalid_Data, "Invalid data");
         }
 
-        ret = avcodec_send_packet(codecContext, pkt);
+        // 丢弃非参考帧的策略下，没有credit时让解码器跳过非参考帧
+        bool skipNonRef = false;
+        if (isVideo && credit_.policy() == OutputCredit::kPolicy_DropNonRef) {
+            skipNonRef               = !credit_.available();
+            codecContext->skip_frame = skipNonRef ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+        }
+
+        int64_t stageBegin = common::WorkStealingPool::nowUs();
+        int32_t frames     = 0;
+        ret                = avcodec_send_packet(codecContext, pkt);
         if (ret < 0) {
             raiseException(kErrorCode_FFmpeg_Error, "avcodec_send_packet " + ffmpegError(ret));
         }
@@ -665,17 +1555,25 @@ private:
         while (ret >= 0) {
             ret = avcodec_receive_frame(codecContext, avFrame_);
             if (ret == AVERROR(EAGAIN)) {
+                // 跳过期间没有输出帧的包按丢弃一帧估计，帧线程的输出延迟使这个计数不精确
+                if (skipNonRef && frames == 0) {
+                    credit_.onNonRefSkipped();
+                }
                 return;
             } else if (ret == AVERROR_EOF) {
                 raiseException(kErrorCode_Eof, "avcodec_receive_frame");
             } else if (ret < 0) {
                 raiseException(kErrorCode_FFmpeg_Error, "avcodec_receive_frame");
             } else {
+                frames++;
+                int64_t decodedUs = FrameHeader::nowUs();
                 if (isVideo) {
-                    processDecodedVideoFrame(avFrame_);
+                    decodeStageUs_ += common::WorkStealingPool::nowUs() - stageBegin;
+                    processDecodedVideoFrame(avFrame_, decodedUs);
                 } else {
-                    processDecodedAudioFrame(avFrame_);
+                    processDecodedAudioFrame(avFrame_, decodedUs);
                 }
+                stageBegin = common::WorkStealingPool::nowUs();
             }
         }
 
@@ -705,35 +1603,17 @@ private:
         return ret;
     }
 
+    // 只有打开和探测时等待数据(最多kFifoReadTimeoutMs)，解码worker上不等待，没有数据时返回EAGAIN，
+    // 解码任务结束，新的数据到达时sendData()重新调度，一个会话等网络数据不会占住共享的worker
     int32_t readFromFifo(uint8_t *data, int32_t len) {
-        int32_t ret            = -1;
-        int32_t availableBytes = 0;
-        int32_t canReadLen     = 0;
-        if (fifo_ == nullptr) {
-            return ret;
-        }
-
-        int count = 50;
-        while (count-- > 0 && av_fifo_size(fifo_) < len) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(5));
-        }
-
-        availableBytes = av_fifo_size(fifo_);
-        if (availableBytes <= 0) {
-            LOG_WARN("No more data to read, available bytes is {}", availableBytes);
+        int32_t ret = ingest_.read(data, len, opening_ ? kFifoReadTimeoutMs : 0);
+        if (ret == 0) {
             return AVERROR(EAGAIN);
         }
-
-        canReadLen = MIN(availableBytes, len);
-        av_fifo_generic_read(fifo_, data, canReadLen, nullptr);
-        ret = canReadLen;
-
-        // LOG_INFO("Read from fifo, size {}, left {}", ret, av_fifo_size(fifo_));
-
         return ret;
     }
 
-    int32_t writeToFile(uint8_t *buff, int32_t size) {
+    int32_t writeToFile(const uint8_t *buff, int32_t size) {
         int32_t ret           = 0;
         int64_t leftBytes     = 0;
         int32_t canWriteBytes = 0;
@@ -756,37 +1636,9 @@ private:
         return ret;
     }
 
-    int32_t writeToFifo(uint8_t *buff, int32_t size) {
-        int32_t ret = 0;
-        if (fifo_ == nullptr) {
-            return -1;
-        }
-
-        int64_t leftSpace = av_fifo_space(fifo_);
-        if (leftSpace < size) {
-            int32_t growSize = 0;
-            do {
-                leftSpace += fifoSize_;
-                growSize += fifoSize_;
-                fifoSize_ += fifoSize_;
-            } while (leftSpace < size);
-
-            av_fifo_grow(fifo_, growSize);
-
-            LOG_INFO("Fifo size growed to {}.", fifoSize_);
-            if (fifoSize_ >= kMaxFifoSize) {
-                LOG_INFO("[Warn] Fifo size larger than {}.", kMaxFifoSize);
-            }
-        }
-
-        ret = av_fifo_generic_write(fifo_, buff, size, nullptr);
-        // LOG_INFO("Write fifo_ size {}, left {}", ret, av_fifo_size(fifo_));
-        return ret;
-    }
-
     int32_t getAailableDataSize() {
         if (isStream_) {
-            return fifo_ == nullptr ? 0 : av_fifo_size(fifo_);
+            return ingest_.available();
         } else {
             return fileWritePos_ - fileReadPos_;
         }
@@ -804,12 +1656,6 @@ private:
         return ts.tv_sec * (unsigned long)1000 + ts.tv_nsec / 1000000;
     }
 
-    std::string timestamp2str(double timestamp) {
-        char ss[KTimeStampStrLength] = {0};
-        sprintf(ss, "%.6lf", timestamp);
-        return std::string(ss, ss + sizeof(ss));
-    }
-
     void raiseException(ErrorCode code, const std::string &msg) { throw BizException((int32_t)code, msg); }
 
 private:
@@ -821,11 +1667,23 @@ private:
     AVFrame *avFrame_                  = nullptr;
     int32_t videoStreamIdx_            = -1;
     int32_t audioStreamIdx_            = -1;
-    uint8_t *yuvBuffer_                = nullptr;
-    int32_t videoBufferSize_           = 0;
     int32_t videoSize_                 = 0;
     uint8_t *pcmBuffer_                = nullptr;
     int32_t pcmBufferSize_             = 0;
+    FramePayload videoPayload_;
+    std::vector<uint8_t> neutralChroma_; // 单色的帧输出的色度行
+    FrameScaler scaler_;
+    OutputCredit credit_;
+    QualityLadder ladder_;
+    QualityLadder::Level rendition_ = QualityLadder::kLevel_Full; // 最近发送的视频帧的档位
+    std::mutex mailboxMutex_;
+    std::string mailbox_; // 没有credit时保留的最新一帧(已打包)
+    int32_t mailboxHeaderSize_ = 0;
+    bool mailboxFull_          = false;
+    OutputOptions output_;
+    FrameHeader::Version headerVersion_ = FrameHeader::kVersion_Legacy;
+    uint32_t videoSeq_                  = 0;
+    uint32_t audioSeq_                  = 0;
 
     // callback
     onVideo videoCallback_             = nullptr;
@@ -835,23 +1693,54 @@ private:
     // common
     int32_t waitHeaderLength_ = 512 * 1024;
     bool isStream_            = false;
-    bool decoding_            = false;
-    common::Timer decodeTimer_;
+    std::atomic<bool> decoding_{false};
+    std::atomic<bool> opened_{false};
+    std::atomic<bool> scheduled_{false};
+    std::atomic<bool> closed_{false}; // 连接已关闭，不再调度解码
+    std::condition_variable dataCond_;
+    std::atomic<bool> opening_{false}; // 异步打开任务在队列或执行中
+    std::atomic<bool> openCancelled_{false};
+    std::atomic<int64_t> openDeadlineMs_{0};
+    std::atomic<int64_t> probeMs_{0};
+    std::atomic<int64_t> openBeginMs_{0};
+    std::atomic<int64_t> ttffMs_{-1};
+    std::mutex openMutex_;
+    std::condition_variable openCond_;
+    std::atomic<uint64_t> decodeWakeups_{0};
+    std::atomic<uint64_t> stageFrames_{0};
+    std::atomic<uint64_t> decodeStageUs_{0};
+    std::atomic<uint64_t> prepareStageUs_{0};
+    std::atomic<uint64_t> packStageUs_{0};
+    std::atomic<uint64_t> videoBytes_{0};
+    DeadlineTracker deadline_;
+    uint64_t budgetId_                                 = 0;
+    uint64_t budgetGeneration_                         = 0;
+    CodecThreadBudget::ThreadConfig videoThreadConfig_ = {1, FF_THREAD_FRAME};
+    bool videoContextPooled_                           = false; // 视频上下文从CodecContextPool取出，关闭时放回
+    bool threadsDeferred_                              = false; // 池中取出的上下文线程数少于分配的，预算稳定后重建
     std::mutex mutex_;
 
     // file
     std::string fileName_;
     FILE *fp_                  = nullptr;
     int64_t fileSize_          = 0;
-    int64_t fileReadPos_       = 0;
-    int64_t fileWritePos_      = 0;
+    std::atomic<int64_t> fileReadPos_{0};
+    std::atomic<int64_t> fileWritePos_{0};
     int64_t lastRequestOffset_ = 0;
     double beginTimeOffset_    = 0;
     int32_t accurateSeek_      = 0;
 
     // stream
-    AVFifoBuffer *fifo_ = nullptr;
-    int32_t fifoSize_   = 0;
+    LiveIngestBuffer ingest_;
+    FastOpenProbe fastOpen_;
+    bool fastOpenEnabled_       = true;
+    NalUnits::Codec knownCodec_ = NalUnits::kCodec_None;
+    std::string knownExtradata_; // 客户端给出的Annex-B参数集
+    std::atomic<bool> fastOpened_{false};
+    IngestMode ingestMode_            = kIngest_Demux;
+    AVCodecParameters *elementaryPar_ = nullptr; // 裸流输入的解码参数，不为空时没有AVFormatContext
+    AccessUnitSplitter splitter_;
+    int64_t firstUnitUs_ = -1;
 };
 
 } // namespace decoder
\ No newline at end of file
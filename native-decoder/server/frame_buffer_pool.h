@@ -0,0 +1,131 @@
+#pragma once
+
+#include <atomic>
+#include <map>
+#include <mutex>
+
+#include "common/helper/logger.h"
+#include "common/helper/singleton.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include "libavcodec/avcodec.h"
+#include "libavutil/imgutils.h"
+#ifdef __cplusplus
+}
+#endif
+
+namespace decoder {
+
+/*
+ * 进程级的解码输出帧内存池，作为AVCodecContext::get_buffer2使用
+ * 每帧的所有平面分配在一块内存中，按大小分桶，每个桶是一个AVBufferPool，帧释放后内存回到池中复用
+ * stride从codec要求的对齐宽度开始，宽度本身满足对齐要求时stride等于宽度(紧凑)，每个平面可以整块拷贝
+ * 分辨率变化时按新的大小分配，不依赖打开解码器时的分辨率
+ */
+class FrameBufferPool {
+public:
+    const int32_t kBucketSize  = 64 * 1024;
+    const int32_t kBufferAlign = 64;
+
+    FrameBufferPool() = default;
+
+    ~FrameBufferPool() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (auto &it : pools_) {
+            av_buffer_pool_uninit(&it.second);
+        }
+        pools_.clear();
+    }
+
+    static FrameBufferPool &INSTANCE() { return common::Singleton<FrameBufferPool>::getInstance(); }
+
+    // 设置到AVCodecContext::get_buffer2，可能在codec的多个线程中同时调用
+    static int getBuffer2(AVCodecContext *ctx, AVFrame *frame, int flags) { return INSTANCE().allocFrame(ctx, frame, flags); }
+
+    uint64_t getAllocs() const { return allocs_; }
+
+    uint64_t getGets() const { return gets_; }
+
+    uint64_t getFallbacks() const { return fallbacks_; }
+
+private:
+    int allocFrame(AVCodecContext *ctx, AVFrame *frame, int flags) {
+        if (ctx->codec_type != AVMEDIA_TYPE_VIDEO || ctx->codec == nullptr || !(ctx->codec->capabilities & AV_CODEC_CAP_DR1)) {
+            fallbacks_++;
+            return avcodec_default_get_buffer2(ctx, frame, flags);
+        }
+
+        enum AVPixelFormat format = (enum AVPixelFormat)frame->format;
+        int32_t width             = frame->width;
+        int32_t height            = frame->height;
+
+        int32_t align[AV_NUM_DATA_POINTERS] = {0};
+        avcodec_align_dimensions2(ctx, &width, &height, align);
+
+        // 和ffmpeg默认分配器一样，从对齐宽度开始逐步增大，直到所有平面的linesize满足对齐要求
+        int32_t linesize[4] = {0};
+        int32_t unaligned   = 0;
+        do {
+            if (av_image_fill_linesizes(linesize, format, width) < 0) {
+                fallbacks_++;
+                return avcodec_default_get_buffer2(ctx, frame, flags);
+            }
+            width += width & ~(width - 1);
+            unaligned = 0;
+            for (int32_t i = 0; i < 4; i++) {
+                unaligned |= align[i] > 0 ? linesize[i] % align[i] : 0;
+            }
+        } while (unaligned);
+
+        // 计算各平面相对于起始位置的偏移
+        uint8_t *planes[4] = {nullptr};
+        int32_t size       = av_image_fill_pointers(planes, format, height, nullptr, linesize);
+        if (size < 0) {
+            fallbacks_++;
+            return avcodec_default_get_buffer2(ctx, frame, flags);
+        }
+
+        // 额外的16字节给codec的simd越界读
+        int32_t total      = kBufferAlign + size + 16;
+        AVBufferPool *pool = getPool(FFALIGN(total, kBucketSize));
+        frame->buf[0]      = av_buffer_pool_get(pool);
+        if (frame->buf[0] == nullptr) {
+            return AVERROR(ENOMEM);
+        }
+        gets_++;
+
+        uint8_t *start = (uint8_t *)FFALIGN((uintptr_t)frame->buf[0]->data, (uintptr_t)kBufferAlign);
+        for (int32_t i = 0; i < 4; i++) {
+            frame->data[i]     = planes[i] == nullptr && i > 0 ? nullptr : start + (planes[i] - planes[0]);
+            frame->linesize[i] = linesize[i];
+        }
+        frame->extended_data = frame->data;
+        return 0;
+    }
+
+    AVBufferPool *getPool(int32_t bucket) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        AVBufferPool *&pool = pools_[bucket];
+        if (pool == nullptr) {
+            pool = av_buffer_pool_init2(bucket, this, FrameBufferPool::allocBuffer, nullptr);
+            LOG_INFO("Frame buffer pool bucket {} created, buckets {}.", bucket, pools_.size());
+        }
+        return pool;
+    }
+
+    static AVBufferRef *allocBuffer(void *opaque, int size) {
+        ((FrameBufferPool *)opaque)->allocs_++;
+        return av_buffer_alloc(size);
+    }
+
+private:
+    std::mutex mutex_;
+    std::map<int32_t, AVBufferPool *> pools_;
+    std::atomic<uint64_t> allocs_{0};    // 实际分配的内存块数
+    std::atomic<uint64_t> gets_{0};      // 从池中获取的帧数
+    std::atomic<uint64_t> fallbacks_{0}; // 使用ffmpeg默认分配器的帧数
+};
+
+} // namespace decoder
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+namespace decoder {
+
+/*
+ * 发送给js的解码数据头部，openDecoder时协商版本
+ * 版本0: 类型(1字节) + "%.6lf"格式的秒数字符串(16字节)，兼容旧的客户端
+ * 版本1: 固定布局的二进制头部，小端，数据从headerSize偏移处开始
+ *   0  uint8   类型(0视频，1音频)
+ *   1  uint8   版本
+ *   2  uint16  headerSize
+ *   4  uint32  序号，视频和音频分别计数
+ *   8  int64   pts，流的时间基
+ *   16 int32   时间基分子
+ *   20 int32   时间基分母
+ *   24 int64   解码完成的时间(us，系统时钟)
+ *   32 int64   交给websocket发送的时间(us，系统时钟)
+ *   40 uint32  标志，bit0为关键帧，bit1为输出档位切换后的第一帧，bit8-15为视频的输出档位(见QualityLadder::Level)
+ *   44 int32   格式，视频为AVPixelFormat，音频为AVSampleFormat
+ *   视频: 48 int32 宽，52 int32 高，56 int32[3] 数据中各平面的stride
+ *   数据压缩时(bit2)头部之后的布局见SliceCompressor
+ *   音频: 48 int32 采样率，52 int32 声道数，56 int32 采样数
+ */
+class FrameHeader {
+public:
+    static const int32_t kMaxSize                = 68;
+    static const int32_t kLegacySize             = 17;
+    static const int32_t kVideoSize              = 68;
+    static const int32_t kAudioSize              = 60;
+    static const uint32_t kFlag_Keyframe         = 0x1;
+    static const uint32_t kFlag_RenditionChanged = 0x2;
+    static const uint32_t kFlag_Compressed       = 0x4;
+    static const int32_t kRenditionShift         = 8;
+    static const uint8_t kType_Video             = 0;
+    static const uint8_t kType_Audio             = 1;
+
+    typedef enum Version {
+        kVersion_Legacy = 0,
+        kVersion_Binary = 1,
+        kVersion_Latest = kVersion_Binary,
+    } Version;
+
+    uint8_t type        = kType_Video;
+    uint32_t seq        = 0;
+    int64_t pts         = 0;
+    int32_t timeBaseNum = 0;
+    int32_t timeBaseDen = 1;
+    int64_t decodeUs    = 0;
+    int64_t sendUs      = 0;
+    uint32_t flags      = 0;
+    int32_t format      = -1;
+    int32_t width       = 0;   // 音频为采样率
+    int32_t height      = 0;   // 音频为声道数
+    int32_t strides[3]  = {0}; // 音频strides[0]为采样数
+
+    // 客户端请求的版本，服务端不支持时降到支持的最高版本
+    static Version negotiate(int32_t requested) {
+        if (requested <= kVersion_Legacy) {
+            return kVersion_Legacy;
+        }
+        return requested >= kVersion_Latest ? kVersion_Latest : (Version)requested;
+    }
+
+    static int64_t nowUs() {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    // 写入out(至少kMaxSize字节)，返回头部长度
+    int32_t encode(uint8_t *out, Version version) const {
+        if (version == kVersion_Legacy) {
+            double seconds       = timeBaseDen != 0 ? (double)pts * timeBaseNum / timeBaseDen : 0;
+            char ss[kLegacySize] = {0};
+            snprintf(ss, sizeof(ss), "%.6lf", seconds);
+            out[0] = type;
+            memcpy(out + 1, ss, kLegacySize - 1);
+            return kLegacySize;
+        }
+
+        int32_t size = type == kType_Video ? kVideoSize : kAudioSize;
+        out[0]       = type;
+        out[1]       = (uint8_t)version;
+        put16(out + 2, (uint16_t)size);
+        put32(out + 4, seq);
+        put64(out + 8, (uint64_t)pts);
+        put32(out + 16, (uint32_t)timeBaseNum);
+        put32(out + 20, (uint32_t)timeBaseDen);
+        put64(out + 24, (uint64_t)decodeUs);
+        put64(out + 32, (uint64_t)sendUs);
+        put32(out + 40, flags);
+        put32(out + 44, (uint32_t)format);
+        put32(out + 48, (uint32_t)width);
+        put32(out + 52, (uint32_t)height);
+        put32(out + 56, (uint32_t)strides[0]);
+        if (type == kType_Video) {
+            put32(out + 60, (uint32_t)strides[1]);
+            put32(out + 64, (uint32_t)strides[2]);
+        }
+        return size;
+    }
+
+    // 已经编码的头部是否为二进制版本
+    static bool isBinary(const void *data, size_t size) { return size >= (size_t)kAudioSize && ((const uint8_t *)data)[1] == kVersion_Binary; }
+
+    // 在已经编码的二进制头部中加上标志
+    static void addFlags(uint8_t *data, size_t size, uint32_t flags) {
+        if (isBinary(data, size)) {
+            put32(data + 40, get32(data + 40) | flags);
+        }
+    }
+
+    // 在已经编码的二进制头部中写入交给websocket发送的时间，mailbox中保留的帧发送时才写入
+    static void stampSend(uint8_t *data, size_t size) {
+        if (isBinary(data, size)) {
+            put64(data + 32, (uint64_t)nowUs());
+        }
+    }
+
+    // 小端读写，压缩数据的分片表也使用
+    static uint32_t get32(const uint8_t *p) { return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24); }
+
+    static void put16(uint8_t *p, uint16_t v) {
+        p[0] = (uint8_t)v;
+        p[1] = (uint8_t)(v >> 8);
+    }
+
+    static void put32(uint8_t *p, uint32_t v) {
+        for (int32_t i = 0; i < 4; i++) {
+            p[i] = (uint8_t)(v >> (8 * i));
+        }
+    }
+
+    static void put64(uint8_t *p, uint64_t v) {
+        for (int32_t i = 0; i < 8; i++) {
+            p[i] = (uint8_t)(v >> (8 * i));
+        }
+    }
+};
+
+} // namespace decoder
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "server/pack_kernels.h"
+
+namespace decoder {
+
+/*
+ * 待发送帧的描述：一个头部加若干内存区域(如解码帧的平面)，区域按行描述，可以带stride填充
+ * 发送时直接从各区域拼接到websocket消息中，不需要先打包到一块连续的中间缓冲区
+ * 区域可以带格式转换(高位深转8位、色度降采样、UV交织、转RGBA)，转换在拼接时和拷贝一起完成
+ */
+class FramePayload {
+public:
+    typedef enum Op {
+        kOp_Convert = 0,  // 按行拷贝(转换)一个平面
+        kOp_InterleaveUV, // data为U平面，data2[0]为V平面，输出NV12的UV平面
+        kOp_YuvToRgba,    // data为Y平面，data2为U/V平面(8位4:2:0)，输出RGBA
+    } Op;
+
+    typedef struct tagRegion {
+        const uint8_t *data;
+        int32_t stride;   // 行首之间的距离
+        int32_t rowBytes; // 每行有效字节数
+        int32_t rows;
+        PackKernels::Convert convert; // 不转换时为{1, 0, 1, 1, false}
+        Op op                         = kOp_Convert;
+        const uint8_t *data2[2]       = {nullptr, nullptr};
+        int32_t stride2[2]            = {0, 0};
+        PackKernels::YuvMatrix matrix = {};
+    } Region;
+
+    const PackKernels::Convert kNoConvert = {1, 0, 1, 1, false};
+
+    void clear() {
+        header_.clear();
+        regions_.clear();
+        size_ = 0;
+    }
+
+    void setHeader(const uint8_t *header, int32_t size) {
+        size_ -= header_.size();
+        header_.assign(header, header + size);
+        size_ += size;
+    }
+
+    void addRegion(const uint8_t *data, int32_t stride, int32_t rowBytes, int32_t rows) { addRegion(data, stride, rowBytes, rows, kNoConvert); }
+
+    // 带转换的区域，rowBytes/rows为转换后的大小，stride为源数据的stride
+    void addRegion(const uint8_t *data, int32_t stride, int32_t rowBytes, int32_t rows, const PackKernels::Convert &convert) {
+        regions_.push_back(Region{data, stride, rowBytes, rows, convert});
+        size_ += (size_t)rowBytes * rows;
+    }
+
+    // U/V平面交织为NV12的UV平面，width为每行的UV对数
+    void addInterleavedRegion(const uint8_t *u, int32_t uStride, const uint8_t *v, int32_t vStride, int32_t width, int32_t rows) {
+        Region region{u, uStride, width * 2, rows, kNoConvert};
+        region.op         = kOp_InterleaveUV;
+        region.data2[0]   = v;
+        region.stride2[0] = vStride;
+        regions_.push_back(region);
+        size_ += (size_t)region.rowBytes * rows;
+    }
+
+    // 8位4:2:0的Y/U/V平面转RGBA
+    void addRgbaRegion(uint8_t *const *planes, const int32_t *strides, int32_t width, int32_t rows, const PackKernels::YuvMatrix &matrix) {
+        Region region{planes[0], strides[0], width * 4, rows, kNoConvert};
+        region.op         = kOp_YuvToRgba;
+        region.data2[0]   = planes[1];
+        region.data2[1]   = planes[2];
+        region.stride2[0] = strides[1];
+        region.stride2[1] = strides[2];
+        region.matrix     = matrix;
+        regions_.push_back(region);
+        size_ += (size_t)region.rowBytes * rows;
+    }
+
+    size_t size() const { return size_; }
+
+    const std::vector<uint8_t> &header() const { return header_; }
+
+    const std::vector<Region> &regions() const { return regions_; }
+
+    // 追加到out的末尾，stride等于行宽的区域整块拷贝，带stride填充的区域用PackKernels按行紧凑拷贝
+    void appendTo(std::string &out) const {
+        out.reserve(out.size() + size_);
+        out.append((const char *)header_.data(), header_.size());
+        for (auto &r : regions_) {
+            if (r.op == kOp_Convert && r.stride == r.rowBytes && r.convert.identity()) {
+                out.append((const char *)r.data, (size_t)r.rowBytes * r.rows);
+                continue;
+            }
+            size_t offset = out.size();
+            out.resize(offset + (size_t)r.rowBytes * r.rows);
+            packRows(r, 0, r.rows, (uint8_t *)&out[offset]);
+        }
+    }
+
+    // 紧凑拷贝(转换)区域的输出行[firstRow, firstRow + rows)到dst，各行互不依赖，可以分段并行
+    static void packRows(const Region &r, int32_t firstRow, int32_t rows, uint8_t *dst) {
+        auto &kernels = PackKernels::INSTANCE();
+        switch (r.op) {
+            case kOp_InterleaveUV:
+                kernels.interleaveRows(dst, r.rowBytes, r.data + (size_t)firstRow * r.stride, r.stride, r.data2[0] + (size_t)firstRow * r.stride2[0],
+                                       r.stride2[0], r.rowBytes / 2, rows);
+                break;
+            case kOp_YuvToRgba: {
+                const uint8_t *planes[3] = {r.data, r.data2[0], r.data2[1]};
+                int32_t strides[3]       = {r.stride, r.stride2[0], r.stride2[1]};
+                kernels.yuvToRgba(dst, r.rowBytes, planes, strides, r.rowBytes / 4, rows, firstRow, r.matrix);
+                break;
+            }
+            default: {
+                const uint8_t *src = r.data + (size_t)firstRow * r.convert.vsub * r.stride;
+                kernels.convertRows(dst, r.rowBytes, src, r.stride, r.rowBytes, rows, firstRow, r.convert);
+                break;
+            }
+        }
+    }
+
+private:
+    std::vector<uint8_t> header_;
+    std::vector<Region> regions_;
+    size_t size_ = 0;
+};
+
+} // namespace decoder
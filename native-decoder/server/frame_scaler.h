@@ -0,0 +1,184 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "common/helper/logger.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include "libavutil/frame.h"
+#include "libavutil/opt.h"
+#include "libswscale/swscale.h"
+#ifdef __cplusplus
+}
+#endif
+
+namespace decoder {
+
+/*
+ * 按客户端的显示尺寸缩小解码帧，输出8位yuv420p(只输出Y时为gray8)，高位深/4:2:2/4:4:4在缩放时一起转换
+ * 输出格式的打包内核只支持8位4:2:0时，也用来做不缩放的格式转换
+ * 保持宽高比缩小到不超过目标尺寸，不放大；SwsContext和输出帧在源/目标尺寸和格式不变时复用
+ * 自适应档位在目标尺寸的基础上再按比例缩小(setDivisor)
+ * 缩小到1/2及以下时使用SWS_FAST_BILINEAR(多个小窗口的场景，开销优先)，否则使用SWS_BICUBIC(画质优先)
+ * swscale 6(FFmpeg 5)及以上使用slice线程，旧版本单线程缩放
+ */
+class FrameScaler {
+public:
+    const int32_t kMaxThreads = 4;
+
+    FrameScaler() = default;
+
+    ~FrameScaler() { release(); }
+
+    // 可以在其他线程调用，下一帧生效，0表示不缩放
+    void setTarget(int32_t width, int32_t height) { target_ = ((int64_t)std::max(width, 0) << 32) | (uint32_t)std::max(height, 0); }
+
+    // 在目标尺寸(没有目标时为原始尺寸)的基础上再缩小到1/divisor，1为不缩小
+    void setDivisor(int32_t divisor) { divisor_ = std::max(divisor, 1); }
+
+    // 需要缩放(或convert为true)时返回缩放/转换到format后的帧(下次调用前有效)，否则返回frame本身，失败时返回nullptr
+    AVFrame *scale(AVFrame *frame, AVPixelFormat format = AV_PIX_FMT_YUV420P, bool convert = false) {
+        int32_t width  = frame->width;
+        int32_t height = frame->height;
+        if (!outputSize(frame->width, frame->height, &width, &height) && !convert) {
+            return frame;
+        }
+
+        int64_t begin = nowUs();
+        if (!prepare(frame, width, height, format)) {
+            return nullptr;
+        }
+        sws_scale(ctx_, (const uint8_t *const *)frame->data, frame->linesize, 0, frame->height, output_->data, output_->linesize);
+        output_->pts         = frame->pts;
+        output_->key_frame   = frame->key_frame;
+        output_->colorspace  = frame->colorspace;
+        output_->color_range = AVCOL_RANGE_MPEG;
+
+        scaledFrames_++;
+        scaleUs_ += nowUs() - begin;
+        return output_;
+    }
+
+    void release() {
+        if (ctx_ != nullptr) {
+            sws_freeContext(ctx_);
+            ctx_ = nullptr;
+        }
+        if (output_ != nullptr) {
+            av_frame_free(&output_);
+        }
+        key_ = Key();
+    }
+
+    uint64_t getScaledFrames() const { return scaledFrames_; }
+
+    uint64_t getScaleUs() const { return scaleUs_; }
+
+private:
+    struct Key {
+        int32_t srcWidth  = 0;
+        int32_t srcHeight = 0;
+        int32_t srcFormat = -1;
+        int32_t dstWidth  = 0;
+        int32_t dstHeight = 0;
+        int32_t dstFormat = -1;
+
+        bool operator==(const Key &o) const {
+            return srcWidth == o.srcWidth && srcHeight == o.srcHeight && srcFormat == o.srcFormat && dstWidth == o.dstWidth && dstHeight == o.dstHeight &&
+                   dstFormat == o.dstFormat;
+        }
+    };
+
+    static int64_t nowUs() {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // 计算输出尺寸，不需要缩放时返回false，宽高取偶数保证色度平面尺寸准确
+    bool outputSize(int32_t srcWidth, int32_t srcHeight, int32_t *width, int32_t *height) const {
+        int64_t target    = target_;
+        int32_t maxWidth  = (int32_t)(target >> 32);
+        int32_t maxHeight = (int32_t)(target & 0xffffffff);
+        int32_t divisor   = divisor_;
+        if (divisor > 1 && srcWidth > 0 && srcHeight > 0) {
+            maxWidth  = std::min(maxWidth > 0 ? maxWidth : srcWidth, srcWidth) / divisor;
+            maxHeight = std::min(maxHeight > 0 ? maxHeight : srcHeight, srcHeight) / divisor;
+        }
+        if (maxWidth <= 0 || maxHeight <= 0 || srcWidth <= 0 || srcHeight <= 0 || (srcWidth <= maxWidth && srcHeight <= maxHeight)) {
+            return false;
+        }
+        double ratio = std::min((double)maxWidth / srcWidth, (double)maxHeight / srcHeight);
+        *width       = std::max(2, (int32_t)(srcWidth * ratio) & ~1);
+        *height      = std::max(2, (int32_t)(srcHeight * ratio) & ~1);
+        return *width < srcWidth || *height < srcHeight;
+    }
+
+    bool prepare(AVFrame *frame, int32_t width, int32_t height, AVPixelFormat format) {
+        Key key{frame->width, frame->height, frame->format, width, height, format};
+        if (ctx_ != nullptr && key == key_) {
+            return true;
+        }
+        release();
+
+        int32_t flags = (width * 2 <= frame->width && height * 2 <= frame->height) ? SWS_FAST_BILINEAR : SWS_BICUBIC;
+        ctx_          = createContext(key, flags);
+        output_       = av_frame_alloc();
+        if (ctx_ == nullptr || output_ == nullptr) {
+            LOG_ERROR("Create scaler {}x{} -> {}x{} failed.", frame->width, frame->height, width, height);
+            release();
+            return false;
+        }
+
+        output_->format = format;
+        output_->width  = width;
+        output_->height = height;
+        if (av_frame_get_buffer(output_, 32) < 0) {
+            release();
+            return false;
+        }
+        key_ = key;
+        LOG_INFO("Scaler {}x{} fmt {} -> {}x{} fmt {}, flags {}.", frame->width, frame->height, frame->format, width, height, format, flags);
+        return true;
+    }
+
+    SwsContext *createContext(const Key &key, int32_t flags) {
+#if LIBSWSCALE_VERSION_MAJOR >= 6
+        SwsContext *ctx = sws_alloc_context();
+        if (ctx == nullptr) {
+            return nullptr;
+        }
+        int32_t threads = std::min<int32_t>(kMaxThreads, std::max<int32_t>(1, std::thread::hardware_concurrency()));
+        av_opt_set_int(ctx, "srcw", key.srcWidth, 0);
+        av_opt_set_int(ctx, "srch", key.srcHeight, 0);
+        av_opt_set_int(ctx, "src_format", key.srcFormat, 0);
+        av_opt_set_int(ctx, "dstw", key.dstWidth, 0);
+        av_opt_set_int(ctx, "dsth", key.dstHeight, 0);
+        av_opt_set_int(ctx, "dst_format", key.dstFormat, 0);
+        av_opt_set_int(ctx, "sws_flags", flags, 0);
+        av_opt_set_int(ctx, "threads", threads, 0);
+        if (sws_init_context(ctx, nullptr, nullptr) < 0) {
+            sws_freeContext(ctx);
+            return nullptr;
+        }
+        return ctx;
+#else
+        return sws_getContext(key.srcWidth, key.srcHeight, (enum AVPixelFormat)key.srcFormat, key.dstWidth, key.dstHeight,
+                              (enum AVPixelFormat)key.dstFormat, flags, nullptr, nullptr, nullptr);
+#endif
+    }
+
+private:
+    std::atomic<int64_t> target_{0}; // 高32位宽，低32位高
+    std::atomic<int32_t> divisor_{1};
+    SwsContext *ctx_ = nullptr;
+    AVFrame *output_ = nullptr;
+    Key key_;
+    std::atomic<uint64_t> scaledFrames_{0};
+    std::atomic<uint64_t> scaleUs_{0};
+};
+
+} // namespace decoder
@@ -0,0 +1,382 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+
+#include "common/helper/logger.h"
+#include "common/helper/spsc_ring.h"
+#include "server/keyframe_indexer.h"
+
+namespace decoder {
+
+/*
+ * 实况流的接收缓冲区，websocket io线程是唯一的生产者，解码线程是唯一的消费者
+ * 每次写入的数据作为一个chunk放入SpscRing，写入不加锁、不等待；chunk按流位置(累计写入字节数)编号
+ * chunk引用写入者的内存(如websocket消息)，不拷贝，唯一的一次拷贝是read到avio的缓冲区(裸流输入时是访问单元切分的缓冲区)
+ * 消费者没有数据可读时才在条件变量上等待，生产者只在消费者等待时才加锁通知
+ * 缓冲的字节数不超过maxBytes(硬上限)，超过时丢弃新写入的数据，不会像AVFifoBuffer一样无限增长
+ * 丢弃积压的策略在积压超过maxBytes/kFlushDivisor时请求消费者跳到最新的已索引关键帧，没有时跳到下一个关键帧，
+ * 消费者丢弃前新数据照常写入，余下的空间用来容纳这段时间写入的数据
+ * 探测码流期间保留已读数据，支持seek回到任意已读位置，打开解码器后调用releaseHistory()释放
+ * 写入时索引关键帧位置，积压的延迟或字节数超过阈值时，消费者丢弃整个GOP跳到最新的关键帧(catchUp)
+ */
+class LiveIngestBuffer {
+public:
+    const uint32_t kMaxChunks    = 8192;
+    const uint32_t kMaxKeyframes = 1024;
+    const int64_t kFlushDivisor  = 2;
+
+    typedef enum OverflowPolicy {
+        kOverflow_DropNewest = 0, // 丢弃新写入的数据，解码器在下一个关键帧恢复
+        kOverflow_DropBacklog,    // 丢弃消费者未读的积压数据，从最新的关键帧继续读，延迟最小
+    } OverflowPolicy;
+
+    LiveIngestBuffer() : ring_(kMaxChunks), keyframeRing_(kMaxKeyframes) {}
+
+    // 生产者和消费者都空闲时调用
+    void reset(int64_t maxBytes, OverflowPolicy policy) {
+        Chunk chunk;
+        while (ring_.pop(chunk)) {
+        }
+        window_.clear();
+
+        int64_t keyframe = 0;
+        while (keyframeRing_.pop(keyframe)) {
+        }
+        keyframes_.clear();
+        indexer_.setFormat(KeyframeIndexer::kFormat_None, -1);
+        indexer_.reset();
+
+        maxBytes_        = maxBytes;
+        overflowBytes_   = policy == kOverflow_DropBacklog ? maxBytes / kFlushDivisor : maxBytes;
+        policy_          = policy;
+        retain_          = true;
+        overflowing_     = false;
+        writePos_        = 0;
+        readPos_         = 0;
+        queuedBytes_     = 0;
+        flushPos_        = -1;
+        aborted_         = false;
+        lastKeyframe_    = -1;
+        flushOnKeyframe_ = false;
+    }
+
+    // 积压超过任一阈值时跳到最新的关键帧，0表示不限制
+    void setCatchUp(int64_t maxLatencyMs, int64_t maxBacklogBytes) {
+        maxLatencyUs_    = maxLatencyMs * 1000;
+        maxBacklogBytes_ = maxBacklogBytes;
+    }
+
+    // 码流格式确定后开始索引关键帧
+    void setFormat(KeyframeIndexer::Format format, int32_t videoPid) { indexer_.setFormat(format, videoPid); }
+
+    // 生产者调用，拷贝一份数据再写入
+    int32_t write(const uint8_t *data, int32_t size) {
+        std::shared_ptr<uint8_t> copy(new uint8_t[size], std::default_delete<uint8_t[]>());
+        memcpy(copy.get(), data, size);
+        copiedBytes_ += size;
+        return write(std::shared_ptr<const uint8_t>(copy), size);
+    }
+
+    // 生产者调用，引用data，不拷贝，data所属的对象在数据被读取并释放前保持有效
+    // 返回写入的字节数，丢弃时返回-1
+    int32_t write(std::shared_ptr<const uint8_t> data, int32_t size) {
+        receivedBytes_ += size;
+        bool overflow = queuedBytes_ + size > overflowBytes_;
+        if (overflow && !onOverflow(size)) {
+            return -1;
+        }
+
+        Chunk chunk;
+        chunk.pos       = writePos_;
+        chunk.size      = size;
+        chunk.arrivalUs = nowUs();
+        chunk.data      = data;
+
+        queuedBytes_ += size;
+        if (!ring_.push(std::move(chunk))) {
+            queuedBytes_ -= size;
+            dropChunk(size);
+            return -1;
+        }
+        int64_t pos = writePos_;
+        writePos_ += size;
+        if (!overflow) {
+            overflowing_ = false;
+        }
+
+        // 先发布数据再发布关键帧，消费者看到的关键帧位置总是已经写入
+        indexer_.scan(data.get(), size, pos, [this](int64_t keyframe) {
+            keyframeRing_.push(int64_t(keyframe));
+            lastKeyframe_ = keyframe;
+            if (flushOnKeyframe_) {
+                flushOnKeyframe_ = false;
+                flushPos_        = keyframe;
+            }
+        });
+
+        if (waiting_) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cond_.notify_one();
+        }
+        return size;
+    }
+
+    // 消费者调用，没有数据时最多等待timeoutMs，返回读取的字节数，超时返回0，abort后返回-1
+    // chunkEnd不为空时不跨过chunk的结尾，读到chunk结尾时设置为true，按访问单元写入的裸流用来确定帧的结尾
+    int32_t read(uint8_t *data, int32_t len, int32_t timeoutMs, bool *chunkEnd = nullptr) {
+        if (chunkEnd != nullptr) {
+            *chunkEnd = false;
+        }
+        if (!waitReadable(timeoutMs)) {
+            return aborted_ ? -1 : 0;
+        }
+
+        pull();
+        int32_t copied = 0;
+        for (auto it = window_.begin(); it != window_.end() && copied < len; ++it) {
+            int64_t pos = readPos_;
+            if (it->pos + it->size <= pos) {
+                continue;
+            }
+            int32_t offset = (int32_t)(pos - it->pos);
+            int32_t n      = std::min(it->size - offset, len - copied);
+            memcpy(data + copied, it->data.get() + offset, n);
+            copied += n;
+            readPos_ = pos + n;
+            if (chunkEnd != nullptr) {
+                *chunkEnd = offset + n == it->size;
+                break;
+            }
+        }
+        copiedBytes_ += copied;
+        release();
+        return copied;
+    }
+
+    // 消费者调用，pos为流位置，只能seek到保留的数据范围内，失败返回-1
+    int64_t seek(int64_t pos) {
+        pull();
+        int64_t begin = window_.empty() ? readPos_.load() : window_.front().pos;
+        if (pos < begin || pos > writePos_) {
+            return -1;
+        }
+        readPos_ = pos;
+        release();
+        return pos;
+    }
+
+    // 消费者调用，积压超过阈值且有更新的关键帧时，丢弃到最新关键帧之前的数据
+    // 返回跳转后的流位置，没有跳转返回-1，跳转后调用者需要清空demuxer和codec的缓存
+    // 溢出时请求的丢弃积压也在这里执行
+    int64_t catchUp() {
+        if (retain_) {
+            return -1;
+        }
+        int64_t flushed = applyFlush();
+        if (flushed >= 0) {
+            return flushed;
+        }
+        if (maxLatencyUs_ <= 0 && maxBacklogBytes_ <= 0) {
+            return -1;
+        }
+
+        pull();
+        int64_t readPos  = readPos_;
+        int64_t keyframe = 0;
+        while (keyframeRing_.pop(keyframe)) {
+            keyframes_.push_back(keyframe);
+        }
+        while (!keyframes_.empty() && keyframes_.front() <= readPos) {
+            keyframes_.pop_front();
+        }
+        if (keyframes_.empty()) {
+            return -1;
+        }
+
+        int64_t backlogBytes = writePos_ - readPos;
+        int64_t latencyUs    = 0;
+        for (auto &chunk : window_) {
+            if (chunk.pos + chunk.size > readPos) {
+                latencyUs = nowUs() - chunk.arrivalUs;
+                break;
+            }
+        }
+        bool behind = (maxBacklogBytes_ > 0 && backlogBytes > maxBacklogBytes_) || (maxLatencyUs_ > 0 && latencyUs > maxLatencyUs_);
+        if (!behind) {
+            return -1;
+        }
+
+        int64_t target = keyframes_.back();
+        keyframes_.clear();
+        readPos_ = target;
+        release();
+
+        catchUps_++;
+        catchUpBytes_ += target - readPos;
+        LOG_INFO("Ingest catch up, latency {}ms, backlog {}, skip {} bytes to {}.", latencyUs / 1000, backlogBytes, target - readPos, target);
+        return target;
+    }
+
+    // 消费者调用，不再保留已读数据
+    void releaseHistory() {
+        retain_ = false;
+        release();
+    }
+
+    // 为true时唤醒等待中的read并返回-1，关闭解码器时调用
+    void setAborted(bool aborted) {
+        aborted_ = aborted;
+        std::unique_lock<std::mutex> lock(mutex_);
+        cond_.notify_all();
+    }
+
+    int64_t available() const { return writePos_ - readPos_; }
+
+    int64_t getQueuedBytes() const { return queuedBytes_; }
+
+    uint64_t getOverflows() const { return overflows_; }
+
+    uint64_t getDroppedBytes() const { return droppedBytes_; }
+
+    uint64_t getReceivedBytes() const { return receivedBytes_; }
+
+    uint64_t getCopiedBytes() const { return copiedBytes_; }
+
+    uint64_t getCatchUps() const { return catchUps_; }
+
+    uint64_t getCatchUpBytes() const { return catchUpBytes_; }
+
+private:
+    struct Chunk {
+        int64_t pos       = 0;
+        int32_t size      = 0;
+        int64_t arrivalUs = 0;
+        std::shared_ptr<const uint8_t> data;
+    };
+
+    static int64_t nowUs() {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // 生产者调用，积压超过overflowBytes_时调用，返回true时仍然写入这次的数据，超过maxBytes_时总是丢弃
+    // 丢弃积压: 请求消费者跳到最新的已索引关键帧，积压中没有关键帧时跳到下一个关键帧，不能索引关键帧的格式跳到当前写位置
+    bool onOverflow(int32_t size) {
+        overflows_++;
+        if (!overflowing_) {
+            overflowing_ = true;
+            LOG_WARN("Ingest buffer overflow, queued {}, threshold {}, hard limit {}, policy {}.", queuedBytes_.load(), overflowBytes_, maxBytes_,
+                     (int32_t)policy_);
+        }
+        if (policy_ != kOverflow_DropBacklog || queuedBytes_ + size > maxBytes_) {
+            dropChunk(size);
+            return false;
+        }
+
+        if (flushPos_ < 0 && !flushOnKeyframe_) {
+            if (lastKeyframe_ > readPos_) {
+                flushPos_ = lastKeyframe_;
+            } else if (indexer_.enabled()) {
+                flushOnKeyframe_ = true;
+            } else {
+                flushPos_ = writePos_.load();
+            }
+        }
+        return true;
+    }
+
+    // 生产者调用，丢弃新写入的数据
+    void dropChunk(int32_t size) {
+        droppedBytes_ += size;
+        // 丢弃的数据造成码流不连续，丢弃积压时从之后的关键帧继续
+        indexer_.reset();
+        if (policy_ == kOverflow_DropBacklog && indexer_.enabled()) {
+            flushPos_        = -1;
+            flushOnKeyframe_ = true;
+        }
+    }
+
+    bool waitReadable(int32_t timeoutMs) {
+        if (available() > 0) {
+            return true;
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        waiting_ = true;
+        cond_.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this]() { return aborted_ || available() > 0; });
+        waiting_ = false;
+        return !aborted_ && available() > 0;
+    }
+
+    // 以下函数只在消费者线程调用
+    void pull() {
+        Chunk chunk;
+        while (ring_.pop(chunk)) {
+            window_.push_back(std::move(chunk));
+        }
+    }
+
+    void release() {
+        while (!retain_ && !window_.empty() && window_.front().pos + window_.front().size <= readPos_) {
+            queuedBytes_ -= window_.front().size;
+            window_.pop_front();
+        }
+    }
+
+    // 生产者溢出时请求丢弃积压，跳到请求的关键帧位置，返回跳转后的流位置，没有跳转返回-1
+    int64_t applyFlush() {
+        int64_t flushPos = flushPos_.exchange(-1);
+        int64_t readPos  = readPos_;
+        if (flushPos <= readPos) {
+            return -1;
+        }
+        pull();
+        readPos_ = flushPos;
+        while (!window_.empty() && window_.front().pos + window_.front().size <= flushPos) {
+            queuedBytes_ -= window_.front().size;
+            window_.pop_front();
+        }
+        droppedBytes_ += flushPos - readPos;
+        LOG_INFO("Ingest flush backlog, skip {} bytes to {}.", flushPos - readPos, flushPos);
+        return flushPos;
+    }
+
+private:
+    common::SpscRing<Chunk> ring_;
+    std::deque<Chunk> window_; // 消费者从ring中取出、还未释放的chunk
+    KeyframeIndexer indexer_;
+    common::SpscRing<int64_t> keyframeRing_;
+    std::deque<int64_t> keyframes_; // 消费者从keyframeRing_中取出的关键帧位置
+    int64_t maxLatencyUs_    = 0;
+    int64_t maxBacklogBytes_ = 0;
+    int64_t maxBytes_      = 0; // 缓冲字节数的硬上限
+    int64_t overflowBytes_ = 0; // 超过时按溢出策略处理
+    OverflowPolicy policy_ = kOverflow_DropBacklog;
+    bool retain_           = true;
+    bool overflowing_      = false;
+    int64_t lastKeyframe_  = -1;    // 生产者最近索引到的关键帧位置
+    bool flushOnKeyframe_  = false; // 丢弃积压等待下一个关键帧
+
+    std::atomic<int64_t> writePos_{0};
+    std::atomic<int64_t> readPos_{0};
+    std::atomic<int64_t> queuedBytes_{0};
+    std::atomic<int64_t> flushPos_{-1};
+    std::atomic<uint64_t> overflows_{0};
+    std::atomic<uint64_t> droppedBytes_{0};
+    std::atomic<uint64_t> receivedBytes_{0};
+    std::atomic<uint64_t> copiedBytes_{0}; // 所有memcpy的字节数，零拷贝写入时约等于receivedBytes_
+    std::atomic<uint64_t> catchUps_{0};
+    std::atomic<uint64_t> catchUpBytes_{0};
+
+    std::atomic<bool> aborted_{false};
+    std::atomic<bool> waiting_{false};
+    std::mutex mutex_;
+    std::condition_variable cond_;
+};
+
+} // namespace decoder
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+namespace decoder {
+
+/*
+ * 在接收的实况数据中定位关键帧的起始位置(流位置)，用于延迟过大时跳到最新的关键帧
+ * 支持H.264/H.265 Annex-B裸流和TS流，逐字节的状态机，数据可以在任意位置被切分成多次输入
+ * Annex-B: 关键帧的起始位置是IDR/IRAP之前第一个非VCL NAL(AUD/SPS/PPS/SEI等)的起始码，没有则为IDR本身
+ * TS: 关键帧的起始位置是视频PID上带random_access_indicator的TS包
+ */
+class KeyframeIndexer {
+public:
+    const int32_t kTsPacketSize = 188;
+    const uint8_t kTsSyncByte   = 0x47;
+
+    typedef enum Format {
+        kFormat_None = 0,
+        kFormat_H264,
+        kFormat_HEVC,
+        kFormat_TS,
+    } Format;
+
+    // 可以在其他线程调用，下一次scan时生效
+    void setFormat(Format format, int32_t videoPid) {
+        videoPid_ = videoPid;
+        format_   = format;
+    }
+
+    bool enabled() const { return format_ != kFormat_None; }
+
+    // 输入数据不连续时调用
+    void reset() {
+        zeros_        = 0;
+        nalStart_     = -1;
+        auStart_      = -1;
+        prevVclKey_   = false;
+        tsOffset_     = 0;
+        tsPacketPos_  = 0;
+        activeFormat_ = format_;
+    }
+
+    // pos为data第一个字节的流位置，发现关键帧时调用onKeyframe(关键帧起始的流位置)
+    template <typename Callback> void scan(const uint8_t *data, int32_t size, int64_t pos, Callback onKeyframe) {
+        if (activeFormat_ != format_) {
+            reset();
+        }
+
+        switch (activeFormat_) {
+            case kFormat_H264:
+            case kFormat_HEVC:
+                scanAnnexB(data, size, pos, onKeyframe);
+                break;
+            case kFormat_TS:
+                scanTs(data, size, pos, onKeyframe);
+                break;
+            default:
+                break;
+        }
+    }
+
+private:
+    template <typename Callback> void scanAnnexB(const uint8_t *data, int32_t size, int64_t pos, Callback &onKeyframe) {
+        for (int32_t i = 0; i < size; i++) {
+            uint8_t b = data[i];
+
+            // 上一个字节是起始码的最后一个字节，当前字节是NAL头
+            if (nalStart_ >= 0) {
+                onNalHeader(b, nalStart_, onKeyframe);
+                nalStart_ = -1;
+            }
+
+            if (b == 0) {
+                zeros_++;
+                continue;
+            }
+            if (b == 1 && zeros_ >= 2) {
+                nalStart_ = pos + i - (zeros_ >= 3 ? 3 : 2);
+            }
+            zeros_ = 0;
+        }
+    }
+
+    template <typename Callback> void onNalHeader(uint8_t header, int64_t start, Callback &onKeyframe) {
+        bool vcl = false;
+        bool key = false;
+        if (activeFormat_ == kFormat_H264) {
+            int32_t type = header & 0x1f;
+            vcl          = type >= 1 && type <= 5;
+            key          = type == 5;
+        } else {
+            int32_t type = (header >> 1) & 0x3f;
+            vcl          = type <= 31;
+            key          = type >= 16 && type <= 21; // BLA/IDR/CRA
+        }
+
+        if (!vcl) {
+            if (auStart_ < 0) {
+                auStart_ = start;
+            }
+            return;
+        }
+
+        // 同一帧的多个slice只记录一次
+        if (key && (auStart_ >= 0 || !prevVclKey_)) {
+            onKeyframe(auStart_ >= 0 ? auStart_ : start);
+        }
+        prevVclKey_ = key;
+        auStart_    = -1;
+    }
+
+    template <typename Callback> void scanTs(const uint8_t *data, int32_t size, int64_t pos, Callback &onKeyframe) {
+        for (int32_t i = 0; i < size; i++) {
+            uint8_t b = data[i];
+            if (tsOffset_ == 0) {
+                // 等待同步字节
+                if (b != kTsSyncByte) {
+                    continue;
+                }
+                tsPacketPos_ = pos + i;
+            }
+
+            if (tsOffset_ < (int32_t)sizeof(tsHeader_)) {
+                tsHeader_[tsOffset_] = b;
+            }
+            tsOffset_++;
+
+            if (tsOffset_ == (int32_t)sizeof(tsHeader_)) {
+                int32_t pid        = ((tsHeader_[1] & 0x1f) << 8) | tsHeader_[2];
+                bool hasAdaptation = (tsHeader_[3] >> 4) & 0x2;
+                bool randomAccess  = hasAdaptation && tsHeader_[4] > 0 && (tsHeader_[5] & 0x40);
+                if (pid == videoPid_ && randomAccess) {
+                    onKeyframe(tsPacketPos_);
+                }
+            }
+
+            if (tsOffset_ == kTsPacketSize) {
+                tsOffset_ = 0;
+            }
+        }
+    }
+
+private:
+    std::atomic<int32_t> format_{kFormat_None};
+    std::atomic<int32_t> videoPid_{-1};
+
+    // 以下只在scan的线程访问
+    int32_t activeFormat_ = kFormat_None;
+
+    // annex-b
+    int32_t zeros_    = 0;
+    int64_t nalStart_ = -1;
+    int64_t auStart_  = -1;
+    bool prevVclKey_  = false;
+
+    // ts
+    uint8_t tsHeader_[6] = {0};
+    int32_t tsOffset_    = 0;
+    int64_t tsPacketPos_ = 0;
+};
+
+} // namespace decoder
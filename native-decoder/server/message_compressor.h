@@ -0,0 +1,186 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+
+#include <zlib.h>
+
+#include "server/compression_policy.h"
+#include "server/zlib_budget.h"
+
+namespace decoder {
+
+/*
+ * 每个连接的permessage-deflate压缩，服务端自己压缩消息并设置RSV1，不使用websocketpp给每个连接固定分配的压缩上下文
+ * 协商的参数从握手响应的Sec-WebSocket-Extensions中解析，是否压缩、级别、是否保留上下文由CompressionPolicy逐条决定
+ * 保留上下文(context takeover)的压缩只用于控制消息，上下文第一次使用时从ZlibBudget分配，超过上限时退回到不保留上下文
+ * 不保留上下文的压缩使用线程的临时上下文，每条消息前重置
+ * 客户端的解压窗口包含所有压缩发送的消息，所以保留的上下文和客户端不一致时(中间发送过其他压缩消息)先重置再用，
+ * 压缩和提交发送在同一个锁内，保证客户端按压缩的顺序解压
+ */
+class MessageCompressor {
+public:
+    static const int32_t kMemLevel = 4; // 和websocketpp默认值相同
+
+    // extensions为握手响应的Sec-WebSocket-Extensions
+    explicit MessageCompressor(const std::string &extensions) {
+        negotiated_      = extensions.find("permessage-deflate") != std::string::npos;
+        takeoverAllowed_ = extensions.find("server_no_context_takeover") == std::string::npos;
+        size_t pos       = extensions.find("server_max_window_bits=");
+        if (pos != std::string::npos) {
+            windowBits_ = std::max(9, std::min(15, atoi(extensions.c_str() + pos + strlen("server_max_window_bits="))));
+        }
+    }
+
+    ~MessageCompressor() {
+        if (takeoverReady_) {
+            deflateEnd(&takeover_);
+        }
+    }
+
+    bool negotiated() const { return negotiated_; }
+
+    CompressionPolicy &policy() { return policy_; }
+
+    // 按策略压缩(或不压缩)后调用submit(data, size, compressed)提交发送，返回提交的字节数
+    template <typename Submit> size_t send(CompressionPolicy::MessageType type, const uint8_t *data, size_t size, Submit submit) {
+        CompressionPolicy::Decision d = policy_.decide(type, size, negotiated_ ? Z_BEST_COMPRESSION : 0);
+        if (!d.compress) {
+            submit(data, size, false);
+            return size;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        std::string &out = scratch();
+        bool takeover    = d.takeover && acquireTakeover();
+        bool ok          = takeover ? deflateMessage(takeover_, data, size, out) : deflateStateless(d.level, windowBits_, data, size, out);
+        if (!ok || out.size() >= size) {
+            // 保留的上下文已经压缩了这条消息，但客户端收不到，上下文和客户端不一致
+            dirty_ = dirty_ || takeover;
+            policy_.onCompressed(type, size, size);
+            submit(data, size, false);
+            return size;
+        }
+
+        dirty_ = !takeover && takeoverReady_;
+        policy_.onCompressed(type, size, out.size());
+        submit((const uint8_t *)out.data(), out.size(), true);
+        return out.size();
+    }
+
+    // 不保留上下文压缩一条消息到out，websocketpp的扩展也使用
+    static bool deflateStateless(int32_t level, int32_t windowBits, const uint8_t *data, size_t size, std::string &out) {
+        z_stream *stream = statelessDeflater().get(level, windowBits);
+        return stream != nullptr && deflateMessage(*stream, data, size, out);
+    }
+
+private:
+    // 线程的临时压缩上下文，级别或窗口变化时重建
+    class StatelessDeflater {
+    public:
+        ~StatelessDeflater() { release(); }
+
+        z_stream *get(int32_t level, int32_t windowBits) {
+            if (ready_ && (level != level_ || windowBits != windowBits_)) {
+                release();
+            }
+            if (ready_) {
+                return deflateReset(&stream_) == Z_OK ? &stream_ : nullptr;
+            }
+            memset(&stream_, 0, sizeof(stream_));
+            ZlibBudget::INSTANCE().bind(stream_, false);
+            if (deflateInit2(&stream_, level, Z_DEFLATED, -windowBits, kMemLevel, Z_DEFAULT_STRATEGY) != Z_OK) {
+                return nullptr;
+            }
+            ready_      = true;
+            level_      = level;
+            windowBits_ = windowBits;
+            return &stream_;
+        }
+
+    private:
+        void release() {
+            if (ready_) {
+                deflateEnd(&stream_);
+                ready_ = false;
+            }
+        }
+
+        z_stream stream_;
+        bool ready_         = false;
+        int32_t level_      = 0;
+        int32_t windowBits_ = 0;
+    };
+
+    // 第一次使用时分配保留的上下文，超过内存上限时返回false
+    bool acquireTakeover() {
+        if (!takeoverAllowed_) {
+            return false;
+        }
+        if (!takeoverReady_) {
+            memset(&takeover_, 0, sizeof(takeover_));
+            ZlibBudget::INSTANCE().bind(takeover_, true);
+            if (deflateInit2(&takeover_, policy_.kControlLevel, Z_DEFLATED, -windowBits_, kMemLevel, Z_DEFAULT_STRATEGY) != Z_OK) {
+                return false;
+            }
+            takeoverReady_ = true;
+            dirty_         = false;
+        }
+        if (dirty_) {
+            dirty_ = false;
+            return deflateReset(&takeover_) == Z_OK;
+        }
+        return true;
+    }
+
+    // Z_SYNC_FLUSH压缩一条消息，去掉结尾的00 00 ff ff(RFC 7692)
+    static bool deflateMessage(z_stream &stream, const uint8_t *data, size_t size, std::string &out) {
+        size_t used = 0;
+        out.resize(size / 2 + 64);
+        stream.next_in  = (Bytef *)data;
+        stream.avail_in = (uInt)size;
+        do {
+            if (used == out.size()) {
+                out.resize(out.size() * 2);
+            }
+            stream.next_out  = (Bytef *)&out[used];
+            stream.avail_out = (uInt)(out.size() - used);
+            int32_t ret      = deflate(&stream, Z_SYNC_FLUSH);
+            if (ret != Z_OK && ret != Z_BUF_ERROR) {
+                return false;
+            }
+            used = out.size() - stream.avail_out;
+        } while (stream.avail_out == 0);
+
+        if (used < 4) {
+            return false;
+        }
+        out.resize(used - 4);
+        return true;
+    }
+
+    static StatelessDeflater &statelessDeflater() {
+        thread_local StatelessDeflater deflater;
+        return deflater;
+    }
+
+    static std::string &scratch() {
+        thread_local std::string out;
+        return out;
+    }
+
+private:
+    bool negotiated_      = false;
+    bool takeoverAllowed_ = true;
+    int32_t windowBits_   = 15;
+    CompressionPolicy policy_;
+    std::mutex mutex_;
+    z_stream takeover_;
+    bool takeoverReady_ = false;
+    bool dirty_         = false; // 保留的上下文和客户端的解压窗口不一致
+};
+
+} // namespace decoder
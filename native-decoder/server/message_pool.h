@@ -0,0 +1,154 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "common/helper/singleton.h"
+
+namespace decoder {
+
+/*
+ * websocket消息payload缓冲区池，缓冲区按容量分级(2的幂，每级再分4档)，释放的缓冲区按容量放回对应级别复用
+ * 每个线程有自己的小缓存，本线程释放后再申请不需要加锁；线程缓存满了放到全局列表，各线程共享
+ * (解码线程申请的发送缓冲区在io线程写完后释放，需要经过全局列表回到解码线程)
+ * 池中空闲缓冲区的总字节数不超过上限，超过时直接释放；回收时先计入再检查上限，超过时撤回，并发回收不会一起越过上限
+ */
+class MessagePool {
+public:
+    const size_t kMinClassSize         = 4 * 1024;
+    const size_t kMaxClassSize         = 64 * 1024 * 1024;
+    const size_t kLocalBuffersPerClass = 4;
+    const size_t kDefaultCeiling       = 256 * 1024 * 1024;
+
+    typedef struct tagStats {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t dropped; // 超过上限或不在分级范围内而直接释放的缓冲区数
+        int64_t pooledBytes;
+    } Stats;
+
+    MessagePool() : ceiling_(kDefaultCeiling) {
+        for (size_t base = kMinClassSize; base <= kMaxClassSize; base *= 2) {
+            for (size_t step = 0; step < 4 && base + base / 4 * step <= kMaxClassSize; step++) {
+                classSizes_.push_back(base + base / 4 * step);
+            }
+        }
+        globalLists_.resize(classSizes_.size());
+    }
+
+    static MessagePool &INSTANCE() { return common::Singleton<MessagePool>::getInstance(); }
+
+    void setCeiling(size_t bytes) { ceiling_ = bytes; }
+
+    // 返回一个空字符串，容量不小于size
+    std::string acquire(size_t size) {
+        std::string buffer;
+        int32_t c = ceilClass(size);
+        if (c < 0) {
+            misses_++;
+            buffer.reserve(size);
+            return buffer;
+        }
+
+        bool found  = false;
+        auto &local = localCache().lists[c];
+        if (!local.empty()) {
+            buffer = std::move(local.back());
+            local.pop_back();
+            found = true;
+        } else {
+            std::unique_lock<std::mutex> lock(mutex_);
+            auto &global = globalLists_[c];
+            if (!global.empty()) {
+                buffer = std::move(global.back());
+                global.pop_back();
+                found = true;
+            }
+        }
+
+        if (found) {
+            hits_++;
+            pooledBytes_ -= buffer.capacity();
+            return buffer;
+        }
+
+        misses_++;
+        buffer.reserve(classSizes_[c]);
+        return buffer;
+    }
+
+    // 回收缓冲区，调用后buffer不再可用
+    void release(std::string &&buffer) {
+        size_t capacity = buffer.capacity();
+        int32_t c       = floorClass(capacity);
+        if (c < 0) {
+            dropped_++;
+            return;
+        }
+        if ((pooledBytes_ += (int64_t)capacity) > (int64_t)ceiling_) {
+            pooledBytes_ -= (int64_t)capacity;
+            dropped_++;
+            return;
+        }
+
+        buffer.clear();
+
+        auto &local = localCache().lists[c];
+        if (local.size() < kLocalBuffersPerClass) {
+            local.push_back(std::move(buffer));
+            return;
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        globalLists_[c].push_back(std::move(buffer));
+    }
+
+    Stats getStats() const { return Stats{hits_.load(), misses_.load(), dropped_.load(), pooledBytes_.load()}; }
+
+private:
+    struct LocalCache {
+        std::vector<std::vector<std::string>> lists;
+
+        explicit LocalCache(size_t classes) : lists(classes) {}
+
+        ~LocalCache() {
+            // 线程退出，缓存的缓冲区直接释放
+            for (auto &list : lists) {
+                for (auto &buffer : list) {
+                    INSTANCE().pooledBytes_ -= buffer.capacity();
+                }
+            }
+        }
+    };
+
+    LocalCache &localCache() {
+        static thread_local LocalCache cache(classSizes_.size());
+        return cache;
+    }
+
+    // 不小于size的最小级别，用于申请
+    int32_t ceilClass(size_t size) const {
+        auto it = std::lower_bound(classSizes_.begin(), classSizes_.end(), size);
+        return it == classSizes_.end() ? -1 : (int32_t)(it - classSizes_.begin());
+    }
+
+    // 不大于capacity的最大级别，用于回收，保证从该级别取出的缓冲区容量足够
+    int32_t floorClass(size_t capacity) const {
+        auto it = std::upper_bound(classSizes_.begin(), classSizes_.end(), capacity);
+        return it == classSizes_.begin() ? -1 : (int32_t)(it - classSizes_.begin()) - 1;
+    }
+
+private:
+    std::vector<size_t> classSizes_;
+    std::mutex mutex_;
+    std::vector<std::vector<std::string>> globalLists_;
+    std::atomic<size_t> ceiling_;
+    std::atomic<uint64_t> hits_{0};
+    std::atomic<uint64_t> misses_{0};
+    std::atomic<uint64_t> dropped_{0};
+    std::atomic<int64_t> pooledBytes_{0};
+};
+
+} // namespace decoder
@@ -0,0 +1,362 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE2__)
+#define NAL_UNITS_SSE2 1
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#define NAL_UNITS_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace decoder {
+
+/*
+ * H.264/H.265 Annex-B NAL单元的工具函数: 查找起始码、NAL类型、识别编码格式、解析SPS
+ * SPS只解析打开解码器需要的字段(尺寸、位深、色度格式)，PPS只解析选择多线程方式需要的字段，不做完整的语法检查
+ */
+class NalUnits {
+public:
+    typedef enum Codec {
+        kCodec_None = 0,
+        kCodec_H264,
+        kCodec_HEVC,
+    } Codec;
+
+    typedef struct tagSpsInfo {
+        int32_t width; // 裁剪后的显示尺寸
+        int32_t height;
+        int32_t bitDepth;
+        int32_t chromaFormat; // 0单色，1为4:2:0，2为4:2:2，3为4:4:4
+    } SpsInfo;
+
+    // 返回[p, end)中第一个起始码(00 00 01)的位置，没有时返回end
+    // 向量实现每次检查16个位置，剩余不足一个块的数据和没有向量指令的平台使用标量实现
+    static const uint8_t *findStartCode(const uint8_t *p, const uint8_t *end) {
+#if defined(NAL_UNITS_SSE2)
+        p = findStartCodeSse2(p, end);
+#elif defined(NAL_UNITS_NEON)
+        p = findStartCodeNeon(p, end);
+#endif
+        return findStartCodeScalar(p, end);
+    }
+
+    // 每次看第三个字节，大于1时起始码不可能从这三个位置开始，跳过3个字节
+    static const uint8_t *findStartCodeScalar(const uint8_t *p, const uint8_t *end) {
+        while (p + 3 <= end) {
+            if (p[2] > 1) {
+                p += 3;
+            } else if (p[2] == 0) {
+                p++;
+            } else if (p[0] == 0 && p[1] == 0) {
+                return p;
+            } else {
+                p += 3;
+            }
+        }
+        return end;
+    }
+
+#if defined(NAL_UNITS_SSE2)
+    // 三个错开一个字节的加载分别和0、0、1比较，结果相与后最低的置位就是起始码
+    // 压缩数据中1很少，先只比较第三个字节，大部分块不需要另外两次比较
+    static const uint8_t *findStartCodeSse2(const uint8_t *p, const uint8_t *end) {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i one  = _mm_set1_epi8(1);
+        for (; end - p >= 18; p += 16) {
+            int32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + 2)), one));
+            if (mask == 0) {
+                continue;
+            }
+            mask &= _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)p), zero));
+            mask &= _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + 1)), zero));
+            if (mask != 0) {
+                return p + __builtin_ctz(mask);
+            }
+        }
+        return p;
+    }
+#endif
+
+#if defined(NAL_UNITS_NEON)
+    // 和SSE2实现相同，NEON没有movemask，块内有起始码时用标量实现找到具体位置
+    static const uint8_t *findStartCodeNeon(const uint8_t *p, const uint8_t *end) {
+        const uint8x16_t zero = vdupq_n_u8(0);
+        const uint8x16_t one  = vdupq_n_u8(1);
+        for (; end - p >= 18; p += 16) {
+            uint8x16_t m   = vandq_u8(vandq_u8(vceqq_u8(vld1q_u8(p), zero), vceqq_u8(vld1q_u8(p + 1), zero)), vceqq_u8(vld1q_u8(p + 2), one));
+            uint64x2_t m64 = vreinterpretq_u64_u8(m);
+            if ((vgetq_lane_u64(m64, 0) | vgetq_lane_u64(m64, 1)) != 0) {
+                return findStartCodeScalar(p, p + 18);
+            }
+        }
+        return p;
+    }
+#endif
+
+    static int32_t headerSize(Codec codec) { return codec == kCodec_HEVC ? 2 : 1; }
+
+    static int32_t nalType(Codec codec, uint8_t header) { return codec == kCodec_HEVC ? (header >> 1) & 0x3f : header & 0x1f; }
+
+    static bool isVcl(Codec codec, int32_t type) { return codec == kCodec_HEVC ? type <= 31 : type >= 1 && type <= 5; }
+
+    // H.264的IDR，H.265的IRAP(BLA/IDR/CRA)
+    static bool isKeyframe(Codec codec, int32_t type) { return codec == kCodec_HEVC ? type >= 16 && type <= 21 : type == 5; }
+
+    static bool isSps(Codec codec, int32_t type) { return codec == kCodec_HEVC ? type == 33 : type == 7; }
+
+    // 出现在一帧的VCL单元之后时开始新的访问单元的非VCL单元: AUD、参数集、SEI和保留类型
+    static bool startsAccessUnit(Codec codec, int32_t type) {
+        if (codec == kCodec_HEVC) {
+            return (type >= 32 && type <= 35) || type == 39 || (type >= 41 && type <= 44) || (type >= 48 && type <= 55);
+        }
+        return (type >= 6 && type <= 9) || (type >= 14 && type <= 18);
+    }
+
+    // H.265的VPS/SPS/PPS，H.264的SPS/PPS
+    static bool isParameterSet(Codec codec, int32_t type) { return codec == kCodec_HEVC ? type >= 32 && type <= 34 : type == 7 || type == 8; }
+
+    // 按参数集的NAL头识别编码格式，两种格式的参数集NAL头不会冲突，其他NAL返回kCodec_None
+    static Codec detect(const uint8_t *nal, size_t size) {
+        if (size < 2 || (nal[0] & 0x80) != 0) {
+            return kCodec_None;
+        }
+        // H.265: nuh_layer_id为0，nuh_temporal_id_plus1不为0
+        int32_t hevcType = (nal[0] >> 1) & 0x3f;
+        if ((nal[0] & 0x01) == 0 && (nal[1] >> 3) == 0 && (nal[1] & 0x07) != 0 && hevcType >= 32 && hevcType <= 34) {
+            return kCodec_HEVC;
+        }
+        int32_t h264Type = nal[0] & 0x1f;
+        if (h264Type == 7 || h264Type == 8) {
+            return kCodec_H264;
+        }
+        return kCodec_None;
+    }
+
+    // nal从NAL头开始，不含起始码
+    static bool parseSps(Codec codec, const uint8_t *nal, size_t size, SpsInfo &info) {
+        BitReader br(nal + headerSize(codec), size - std::min<size_t>(size, headerSize(codec)));
+        bool ok = codec == kCodec_HEVC ? parseHevcSps(br, info) : parseH264Sps(br, info);
+        return ok && !br.overrun() && info.width > 0 && info.height > 0;
+    }
+
+    // data为Annex-B格式的参数集(如extradata)，H.265的PPS启用了WPP(entropy_coding_sync)时返回true，
+    // FFmpeg的H.265 slice多线程只并行WPP的CTU行；H.264一帧的slice数不在参数集中，返回false
+    static bool wavefrontEnabled(Codec codec, const uint8_t *data, size_t size) {
+        if (codec != kCodec_HEVC || data == nullptr) {
+            return false;
+        }
+        const uint8_t *end = data + size;
+        for (const uint8_t *p = findStartCode(data, end); p < end;) {
+            const uint8_t *nal  = p + 3;
+            const uint8_t *next = findStartCode(nal, end);
+            if (next - nal > 2 && nalType(codec, nal[0]) == 34) {
+                BitReader br(nal + 2, next - nal - 2);
+                if (parseHevcPpsWavefront(br) && !br.overrun()) {
+                    return true;
+                }
+            }
+            p = next;
+        }
+        return false;
+    }
+
+private:
+    // 读取RBSP，跳过防竞争字节(00 00 03中的03)
+    class BitReader {
+    public:
+        BitReader(const uint8_t *data, size_t size) {
+            rbsp_.reserve(size);
+            int32_t zeros = 0;
+            for (size_t i = 0; i < size; i++) {
+                if (zeros >= 2 && data[i] == 3) {
+                    zeros = 0;
+                    continue;
+                }
+                zeros = data[i] == 0 ? zeros + 1 : 0;
+                rbsp_.push_back(data[i]);
+            }
+        }
+
+        uint32_t bits(int32_t n) {
+            uint32_t v = 0;
+            for (int32_t i = 0; i < n; i++) {
+                v = (v << 1) | bit();
+            }
+            return v;
+        }
+
+        uint32_t ue() {
+            int32_t leadingZeros = 0;
+            while (bit() == 0 && !overrun() && leadingZeros < 32) {
+                leadingZeros++;
+            }
+            return leadingZeros >= 32 ? 0 : ((1u << leadingZeros) - 1) + bits(leadingZeros);
+        }
+
+        int32_t se() {
+            uint32_t v = ue();
+            return (v & 1) ? (int32_t)((v + 1) / 2) : -(int32_t)(v / 2);
+        }
+
+        void skip(int32_t n) { pos_ += n; }
+
+        bool overrun() const { return pos_ > rbsp_.size() * 8; }
+
+    private:
+        uint32_t bit() {
+            size_t pos = pos_++;
+            return pos < rbsp_.size() * 8 ? (rbsp_[pos / 8] >> (7 - pos % 8)) & 1 : 0;
+        }
+
+        std::vector<uint8_t> rbsp_;
+        size_t pos_ = 0;
+    };
+
+    static void skipScalingList(BitReader &br, int32_t size) {
+        int32_t lastScale = 8;
+        int32_t nextScale = 8;
+        for (int32_t j = 0; j < size; j++) {
+            if (nextScale != 0) {
+                nextScale = (lastScale + br.se() + 256) % 256;
+            }
+            lastScale = nextScale == 0 ? lastScale : nextScale;
+        }
+    }
+
+    static bool parseH264Sps(BitReader &br, SpsInfo &info) {
+        int32_t profile = br.bits(8);
+        br.skip(16); // constraint_set_flags, level_idc
+        br.ue();     // seq_parameter_set_id
+
+        int32_t chromaFormat = 1;
+        int32_t bitDepth     = 8;
+        bool separatePlanes  = false;
+        if (profile == 100 || profile == 110 || profile == 122 || profile == 244 || profile == 44 || profile == 83 || profile == 86 || profile == 118 ||
+            profile == 128 || profile == 138 || profile == 139 || profile == 134 || profile == 135) {
+            chromaFormat = br.ue();
+            if (chromaFormat == 3) {
+                separatePlanes = br.bits(1);
+            }
+            bitDepth = br.ue() + 8;
+            br.ue();    // bit_depth_chroma_minus8
+            br.skip(1); // qpprime_y_zero_transform_bypass_flag
+            if (br.bits(1)) {
+                for (int32_t i = 0; i < (chromaFormat != 3 ? 8 : 12); i++) {
+                    if (br.bits(1)) {
+                        skipScalingList(br, i < 6 ? 16 : 64);
+                    }
+                }
+            }
+        }
+
+        br.ue(); // log2_max_frame_num_minus4
+        int32_t pocType = br.ue();
+        if (pocType == 0) {
+            br.ue();
+        } else if (pocType == 1) {
+            br.skip(1);
+            br.se();
+            br.se();
+            uint32_t cycle = br.ue();
+            for (uint32_t i = 0; i < cycle && !br.overrun(); i++) {
+                br.se();
+            }
+        }
+        br.ue();    // max_num_ref_frames
+        br.skip(1); // gaps_in_frame_num_value_allowed_flag
+
+        int32_t widthInMbs  = br.ue() + 1;
+        int32_t heightInMap = br.ue() + 1;
+        int32_t frameMbs    = br.bits(1);
+        if (!frameMbs) {
+            br.skip(1); // mb_adaptive_frame_field_flag
+        }
+        br.skip(1); // direct_8x8_inference_flag
+
+        info.width        = widthInMbs * 16;
+        info.height       = (2 - frameMbs) * heightInMap * 16;
+        info.bitDepth     = bitDepth;
+        info.chromaFormat = chromaFormat;
+        if (br.bits(1)) {
+            bool monochrome   = chromaFormat == 0 || separatePlanes;
+            int32_t cropUnitX = monochrome || chromaFormat == 3 ? 1 : 2;
+            int32_t cropUnitY = (monochrome || chromaFormat != 1 ? 1 : 2) * (2 - frameMbs);
+            int32_t left      = br.ue();
+            int32_t right     = br.ue();
+            int32_t top       = br.ue();
+            int32_t bottom    = br.ue();
+            info.width -= (left + right) * cropUnitX;
+            info.height -= (top + bottom) * cropUnitY;
+        }
+        return true;
+    }
+
+    static bool parseHevcSps(BitReader &br, SpsInfo &info) {
+        br.skip(4); // sps_video_parameter_set_id
+        int32_t maxSubLayersMinus1 = br.bits(3);
+        br.skip(1); // sps_temporal_id_nesting_flag
+
+        // profile_tier_level: general部分88位加general_level_idc
+        br.skip(88 + 8);
+        bool subProfile[8] = {false};
+        bool subLevel[8]   = {false};
+        for (int32_t i = 0; i < maxSubLayersMinus1; i++) {
+            subProfile[i] = br.bits(1);
+            subLevel[i]   = br.bits(1);
+        }
+        if (maxSubLayersMinus1 > 0) {
+            br.skip(2 * (8 - maxSubLayersMinus1));
+        }
+        for (int32_t i = 0; i < maxSubLayersMinus1; i++) {
+            br.skip((subProfile[i] ? 88 : 0) + (subLevel[i] ? 8 : 0));
+        }
+
+        br.ue(); // sps_seq_parameter_set_id
+        int32_t chromaFormat = br.ue();
+        if (chromaFormat == 3) {
+            br.skip(1); // separate_colour_plane_flag，按4:4:4输出
+        }
+        int32_t width  = br.ue();
+        int32_t height = br.ue();
+        if (br.bits(1)) {
+            int32_t subWidth  = chromaFormat == 1 || chromaFormat == 2 ? 2 : 1;
+            int32_t subHeight = chromaFormat == 1 ? 2 : 1;
+            int32_t left      = br.ue();
+            int32_t right     = br.ue();
+            int32_t top       = br.ue();
+            int32_t bottom    = br.ue();
+            width -= (left + right) * subWidth;
+            height -= (top + bottom) * subHeight;
+        }
+
+        info.width        = width;
+        info.height       = height;
+        info.bitDepth     = br.ue() + 8;
+        info.chromaFormat = chromaFormat;
+        return true;
+    }
+
+    // 读到entropy_coding_sync_enabled_flag为止
+    static bool parseHevcPpsWavefront(BitReader &br) {
+        br.ue();    // pps_pic_parameter_set_id
+        br.ue();    // pps_seq_parameter_set_id
+        br.skip(7); // dependent_slice_segments_enabled_flag ... cabac_init_present_flag
+        br.ue();    // num_ref_idx_l0_default_active_minus1
+        br.ue();    // num_ref_idx_l1_default_active_minus1
+        br.se();    // init_qp_minus26
+        br.skip(2); // constrained_intra_pred_flag, transform_skip_enabled_flag
+        if (br.bits(1)) {
+            br.ue(); // diff_cu_qp_delta_depth
+        }
+        br.se();    // pps_cb_qp_offset
+        br.se();    // pps_cr_qp_offset
+        br.skip(5); // pps_slice_chroma_qp_offsets_present_flag ... tiles_enabled_flag
+        return br.bits(1) != 0;
+    }
+};
+
+} // namespace decoder
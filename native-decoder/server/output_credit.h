@@ -0,0 +1,166 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <mutex>
+
+namespace decoder {
+
+/*
+ * 视频输出的流量控制，防止客户端处理不过来时数据堆积在websocket发送缓冲区中，内存和延迟无限增长
+ * 客户端openDecoder时给出初始窗口，之后每收到若干帧用grantCredit追加，每发送一帧视频消耗一个credit
+ * 不发送credit的旧客户端按连接的发送缓冲区判断，缓冲区不超过几帧的大小时视为有credit
+ * 没有credit时按会话的策略处理视频帧，音频不受限制
+ */
+class OutputCredit {
+public:
+    typedef enum Policy {
+        kPolicy_DropNonRef = 0, // 解码器丢弃非参考帧，参考帧在发送缓冲区不超过硬上限时继续发送
+        kPolicy_Mailbox,        // 只保留最新的一帧，有credit时发送
+        kPolicy_Pause,          // 暂停解码，有credit时恢复
+    } Policy;
+
+    typedef enum Decision {
+        kDecision_Send = 0,
+        kDecision_Drop,
+        kDecision_Hold, // 放入mailbox
+    } Decision;
+
+    typedef struct tagStats {
+        uint64_t dropNonRef;   // 解码器丢弃的非参考帧(估计值)
+        uint64_t dropOverflow; // 发送缓冲区超过硬上限丢弃的帧
+        uint64_t dropMailbox;  // mailbox中被新帧替换的帧
+        uint64_t pauses;       // 因为没有credit暂停解码的次数
+        int64_t credit;
+    } Stats;
+
+    const int32_t kBufferedFrames  = 3; // 旧客户端允许堆积在发送缓冲区中的帧数
+    const size_t kMinBufferedBytes = 1024 * 1024;
+    const size_t kMaxBufferedBytes = 32 * 1024 * 1024;
+
+    using BufferedAmount = std::function<size_t()>;
+
+    // window为0时不使用credit，按发送缓冲区判断；buffered返回连接发送缓冲区中的字节数
+    void reset(int32_t window, Policy policy, BufferedAmount buffered) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        useCredit_  = window > 0;
+        credit_     = window;
+        policy_     = policy;
+        buffered_   = buffered;
+        paused_     = false;
+        frameBytes_ = 0;
+    }
+
+    void grant(int32_t frames) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        useCredit_ = true;
+        credit_ += frames;
+    }
+
+    Policy policy() const { return policy_; }
+
+    bool available() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        return availableLocked();
+    }
+
+    // 有credit时消耗一个并返回true
+    bool tryConsume() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (!availableLocked()) {
+            return false;
+        }
+        credit_--;
+        return true;
+    }
+
+    // 暂停策略下是否应该暂停解码，暂停次数在每次由可解码变为暂停时计数
+    bool shouldPause() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        bool paused = policy_ == kPolicy_Pause && !availableLocked();
+        if (paused && !paused_) {
+            pauses_++;
+        }
+        paused_ = paused;
+        return paused;
+    }
+
+    // 解码出一帧视频后决定如何处理，frameBytes为打包后的大小
+    Decision admit(size_t frameBytes) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        frameBytes_ = frameBytes_ == 0 ? frameBytes : (frameBytes_ * 7 + frameBytes) / 8;
+        if (availableLocked()) {
+            credit_--;
+            return kDecision_Send;
+        }
+
+        switch (policy_) {
+            case kPolicy_Mailbox:
+                return kDecision_Hold;
+            case kPolicy_DropNonRef:
+                if (bufferedLocked() >= kMaxBufferedBytes) {
+                    dropOverflow_++;
+                    return kDecision_Drop;
+                }
+                credit_--;
+                return kDecision_Send;
+            default:
+                // 暂停前已经在解码的包产生的帧，透支credit发送
+                credit_--;
+                return kDecision_Send;
+        }
+    }
+
+    void onNonRefSkipped() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        dropNonRef_++;
+    }
+
+    void onMailboxReplaced() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        dropMailbox_++;
+    }
+
+    // 连接发送缓冲区中的字节数
+    size_t buffered() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        return bufferedLocked();
+    }
+
+    // 累计的丢帧和暂停次数，自适应档位用来判断拥塞
+    uint64_t congestion() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        return dropNonRef_ + dropOverflow_ + dropMailbox_ + pauses_;
+    }
+
+    Stats getStats() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        return Stats{dropNonRef_, dropOverflow_, dropMailbox_, pauses_, useCredit_ ? credit_ : 0};
+    }
+
+private:
+    size_t bufferedLocked() const { return buffered_ != nullptr ? buffered_() : 0; }
+
+    bool availableLocked() const {
+        if (useCredit_) {
+            return credit_ > 0;
+        }
+        return bufferedLocked() < std::max(kMinBufferedBytes, frameBytes_ * kBufferedFrames);
+    }
+
+private:
+    std::mutex mutex_;
+    std::atomic<Policy> policy_{kPolicy_Pause};
+    BufferedAmount buffered_;
+    bool useCredit_        = false;
+    int64_t credit_        = 0;
+    bool paused_           = false;
+    size_t frameBytes_     = 0; // 最近几帧的平均大小
+    uint64_t dropNonRef_   = 0;
+    uint64_t dropOverflow_ = 0;
+    uint64_t dropMailbox_  = 0;
+    uint64_t pauses_       = 0;
+};
+
+} // namespace decoder
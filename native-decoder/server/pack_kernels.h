@@ -0,0 +1,712 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include "common/helper/singleton.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PACK_KERNELS_X86 1
+#include <immintrin.h>
+#endif
+
+namespace decoder {
+
+/*
+ * 解码输出打包用的内存拷贝内核：按行拷贝(平面打包/去除stride填充)、平面格式转换、平面PCM交织、输出格式转换
+ * 格式转换和拷贝在同一遍内完成: 高位深(10/12位)右移到8位(可选有序抖动)，4:2:2/4:4:4色度降采样到4:2:0
+ * 输出格式转换: 8位4:2:0的U/V平面交织为NV12的UV平面，8位4:2:0转RGBA(BT.601/BT.709，有限/全范围)
+ * 启动时根据cpuid选择SSE2/AVX2/AVX-512实现，非x86平台或不支持时使用标量实现
+ * 各指令集的函数用target属性单独编译，不需要全局打开-mavx2等编译选项
+ */
+class PackKernels {
+public:
+    typedef enum Level {
+        kLevel_Scalar = 0,
+        kLevel_SSE2,
+        kLevel_AVX2,
+        kLevel_AVX512,
+    } Level;
+
+    // 拷贝rows行，每行rowBytes字节，dstStride等于rowBytes时即为紧凑打包
+    using CopyRowsFunc = void (*)(uint8_t *dst, int32_t dstStride, const uint8_t *src, int32_t srcStride, int32_t rowBytes, int32_t rows);
+    // 平面转换参数，源每个采样srcBytes字节(1或2，2为小端)，hsub/vsub为水平/垂直方向的降采样倍数(1或2)，
+    // 降采样取相邻采样的平均值，然后右移shift位输出8位，dither为true时用2x2有序抖动代替四舍五入
+    typedef struct tagConvert {
+        int32_t srcBytes;
+        int32_t shift;
+        int32_t hsub;
+        int32_t vsub;
+        bool dither;
+
+        bool identity() const { return srcBytes == 1 && hsub == 1 && vsub == 1; }
+    } Convert;
+
+    // 输出rows行，每行width个8位采样，firstRow为第一行在平面中的行号(决定抖动图案)
+    using ConvertRowsFunc = void (*)(uint8_t *dst, int32_t dstStride, const uint8_t *src, int32_t srcStride, int32_t width, int32_t rows,
+                                     int32_t firstRow, const Convert &convert);
+    // 平面PCM交织，planes[ch]为每个声道的数据，sampleSize为每个采样的字节数
+    using InterleaveFunc = void (*)(uint8_t *dst, const uint8_t *const *planes, int32_t channels, int32_t samples, int32_t sampleSize);
+    // U/V两个平面交织，每行width个UV对
+    using InterleaveRowsFunc = void (*)(uint8_t *dst, int32_t dstStride, const uint8_t *u, int32_t uStride, const uint8_t *v, int32_t vStride,
+                                        int32_t width, int32_t rows);
+
+    // yuv转rgb的定点系数(Q13)，R = (y * (Y - yOffset) + vr * (V - 128)) >> 13，G、B类似，结果截断到[0, 255]
+    typedef struct tagYuvMatrix {
+        int32_t yOffset;
+        int32_t y;
+        int32_t vr;
+        int32_t ug;
+        int32_t vg;
+        int32_t ub;
+    } YuvMatrix;
+
+    // 输出rows行RGBA，planes为Y/U/V平面的起始地址(不是第一行)，firstRow为第一个输出行在Y平面中的行号
+    using YuvToRgbaFunc = void (*)(uint8_t *dst, int32_t dstStride, const uint8_t *const *planes, const int32_t *strides, int32_t width, int32_t rows,
+                                   int32_t firstRow, const YuvMatrix &matrix);
+
+    PackKernels() {
+        supported_ = detect();
+        select(supported_);
+    }
+
+    static PackKernels &INSTANCE() { return common::Singleton<PackKernels>::getInstance(); }
+
+    // 选择指令集，超过cpu支持的级别时使用支持的最高级别，返回实际使用的级别
+    Level select(Level level) {
+        level_ = level > supported_ ? supported_ : level;
+        switch (level_) {
+#ifdef PACK_KERNELS_X86
+            case kLevel_AVX512:
+                copyRows_       = copyRowsAvx512;
+                convertRows_    = convertRowsAvx2;
+                interleave_     = interleaveAvx512;
+                interleaveRows_ = interleaveRowsAvx2;
+                yuvToRgba_      = yuvToRgbaSse2;
+                break;
+            case kLevel_AVX2:
+                copyRows_       = copyRowsAvx2;
+                convertRows_    = convertRowsAvx2;
+                interleave_     = interleaveAvx2;
+                interleaveRows_ = interleaveRowsAvx2;
+                yuvToRgba_      = yuvToRgbaSse2;
+                break;
+            case kLevel_SSE2:
+                copyRows_       = copyRowsSse2;
+                convertRows_    = convertRowsSse2;
+                interleave_     = interleaveSse2;
+                interleaveRows_ = interleaveRowsSse2;
+                yuvToRgba_      = yuvToRgbaSse2;
+                break;
+#endif
+            default:
+                copyRows_       = copyRowsScalar;
+                convertRows_    = convertRowsScalar;
+                interleave_     = interleaveScalar;
+                interleaveRows_ = interleaveRowsScalar;
+                yuvToRgba_      = yuvToRgbaScalar;
+                break;
+        }
+        return level_;
+    }
+
+    Level level() const { return level_; }
+
+    Level supported() const { return supported_; }
+
+    static const char *levelName(Level level) {
+        static const char *names[] = {"scalar", "sse2", "avx2", "avx512"};
+        return names[level];
+    }
+
+    void copyRows(uint8_t *dst, int32_t dstStride, const uint8_t *src, int32_t srcStride, int32_t rowBytes, int32_t rows) const {
+        if (dstStride == rowBytes && srcStride == rowBytes) {
+            memcpy(dst, src, (size_t)rowBytes * rows);
+            return;
+        }
+        copyRows_(dst, dstStride, src, srcStride, rowBytes, rows);
+    }
+
+    void convertRows(uint8_t *dst, int32_t dstStride, const uint8_t *src, int32_t srcStride, int32_t width, int32_t rows, int32_t firstRow,
+                     const Convert &convert) const {
+        if (convert.identity()) {
+            copyRows(dst, dstStride, src, srcStride, width, rows);
+            return;
+        }
+        convertRows_(dst, dstStride, src, srcStride, width, rows, firstRow, convert);
+    }
+
+    void interleave(uint8_t *dst, const uint8_t *const *planes, int32_t channels, int32_t samples, int32_t sampleSize) const {
+        if (channels == 1) {
+            memcpy(dst, planes[0], (size_t)samples * sampleSize);
+            return;
+        }
+        interleave_(dst, planes, channels, samples, sampleSize);
+    }
+
+    void interleaveRows(uint8_t *dst, int32_t dstStride, const uint8_t *u, int32_t uStride, const uint8_t *v, int32_t vStride, int32_t width,
+                        int32_t rows) const {
+        interleaveRows_(dst, dstStride, u, uStride, v, vStride, width, rows);
+    }
+
+    void yuvToRgba(uint8_t *dst, int32_t dstStride, const uint8_t *const *planes, const int32_t *strides, int32_t width, int32_t rows,
+                   int32_t firstRow, const YuvMatrix &matrix) const {
+        yuvToRgba_(dst, dstStride, planes, strides, width, rows, firstRow, matrix);
+    }
+
+    // 标清及未指定时使用BT.601，高清使用BT.709；有限范围的Y为[16, 235]，UV为[16, 240]
+    static YuvMatrix yuvMatrix(bool bt709, bool fullRange) {
+        double kr     = bt709 ? 0.2126 : 0.299;
+        double kb     = bt709 ? 0.0722 : 0.114;
+        double kg     = 1 - kr - kb;
+        double yScale = fullRange ? 1.0 : 255.0 / 219;
+        double cScale = fullRange ? 1.0 : 255.0 / 224;
+        auto q13      = [](double v) { return (int32_t)lround(v * (1 << 13)); };
+
+        YuvMatrix m;
+        m.yOffset = fullRange ? 0 : 16;
+        m.y       = q13(yScale);
+        m.vr      = q13(2 * (1 - kr) * cScale);
+        m.ug      = q13(-2 * (1 - kb) * kb / kg * cScale);
+        m.vg      = q13(-2 * (1 - kr) * kr / kg * cScale);
+        m.ub      = q13(2 * (1 - kb) * cScale);
+        return m;
+    }
+
+private:
+    static Level detect() {
+#ifdef PACK_KERNELS_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f")) {
+            return kLevel_AVX512;
+        }
+        if (__builtin_cpu_supports("avx2")) {
+            return kLevel_AVX2;
+        }
+        if (__builtin_cpu_supports("sse2")) {
+            return kLevel_SSE2;
+        }
+#endif
+        return kLevel_Scalar;
+    }
+
+    //------------------------------------------------------------------------
+    // scalar
+
+    static void copyRowsScalar(uint8_t *dst, int32_t dstStride, const uint8_t *src, int32_t srcStride, int32_t rowBytes, int32_t rows) {
+        for (int32_t y = 0; y < rows; y++) {
+            memcpy(dst + (size_t)y * dstStride, src + (size_t)y * srcStride, rowBytes);
+        }
+    }
+
+    // 固定大小的采样拷贝，编译器展开成一次load/store，不是每个采样一次memcpy调用
+    template <typename T> static void interleaveScalarT(uint8_t *dst, const uint8_t *const *planes, int32_t channels, int32_t samples, int32_t from) {
+        T *out = (T *)dst;
+        for (int32_t i = from; i < samples; i++) {
+            for (int32_t ch = 0; ch < channels; ch++) {
+                T v;
+                memcpy(&v, planes[ch] + (size_t)i * sizeof(T), sizeof(T));
+                memcpy(out + (size_t)i * channels + ch, &v, sizeof(T));
+            }
+        }
+    }
+
+    static void interleaveTail(uint8_t *dst, const uint8_t *const *planes, int32_t channels, int32_t samples, int32_t sampleSize, int32_t from) {
+        switch (sampleSize) {
+            case 1:
+                interleaveScalarT<uint8_t>(dst, planes, channels, samples, from);
+                break;
+            case 2:
+                interleaveScalarT<uint16_t>(dst, planes, channels, samples, from);
+                break;
+            case 4:
+                interleaveScalarT<uint32_t>(dst, planes, channels, samples, from);
+                break;
+            case 8:
+                interleaveScalarT<uint64_t>(dst, planes, channels, samples, from);
+                break;
+            default:
+                for (int32_t i = from; i < samples; i++) {
+                    for (int32_t ch = 0; ch < channels; ch++) {
+                        memcpy(dst + ((size_t)i * channels + ch) * sampleSize, planes[ch] + (size_t)i * sampleSize, sampleSize);
+                    }
+                }
+                break;
+        }
+    }
+
+    static void interleaveScalar(uint8_t *dst, const uint8_t *const *planes, int32_t channels, int32_t samples, int32_t sampleSize) {
+        interleaveTail(dst, planes, channels, samples, sampleSize, 0);
+    }
+
+    // 右移前加的偏移，抖动时为2x2 bayer图案{0,2;3,1}按shift缩放，否则为四舍五入
+    static int32_t bias(const Convert &c, int32_t x, int32_t y) {
+        static const int32_t bayer[2][2] = {{0, 2}, {3, 1}};
+        if (c.shift == 0) {
+            return 0;
+        }
+        if (!c.dither || c.shift < 2) {
+            return 1 << (c.shift - 1);
+        }
+        return bayer[y & 1][x & 1] << (c.shift - 2);
+    }
+
+    static int32_t sample(const uint8_t *row, int32_t x, int32_t srcBytes) { return srcBytes == 1 ? row[x] : row[2 * x] | (row[2 * x + 1] << 8); }
+
+    // 源采样(sx, 输出行)的值，垂直降采样时和下一行平均
+    static int32_t sampleV(const uint8_t *row0, const uint8_t *row1, int32_t sx, const Convert &c) {
+        int32_t v = sample(row0, sx, c.srcBytes);
+        return c.vsub == 2 ? (v + sample(row1, sx, c.srcBytes) + 1) >> 1 : v;
+    }
+
+    // 转换一行中[from, width)的采样，y为输出行在平面中的行号
+    // 先垂直再水平两两平均(向上取整)，和simd的avg指令结果一致
+    static void convertRowTail(uint8_t *dst, const uint8_t *row0, const uint8_t *row1, int32_t from, int32_t width, int32_t y, const Convert &c) {
+        for (int32_t x = from; x < width; x++) {
+            int32_t v = sampleV(row0, row1, x * c.hsub, c);
+            if (c.hsub == 2) {
+                v = (v + sampleV(row0, row1, x * 2 + 1, c) + 1) >> 1;
+            }
+            v      = (v + bias(c, x, y)) >> c.shift;
+            dst[x] = (uint8_t)(v > 255 ? 255 : v);
+        }
+    }
+
+    static void convertRowsScalar(uint8_t *dst, int32_t dstStride, const uint8_t *src, int32_t srcStride, int32_t width, int32_t rows, int32_t firstRow,
+                                  const Convert &convert) {
+        for (int32_t y = 0; y < rows; y++) {
+            const uint8_t *row0 = src + (size_t)y * convert.vsub * srcStride;
+            convertRowTail(dst + (size_t)y * dstStride, row0, row0 + srcStride, 0, width, firstRow + y, convert);
+        }
+    }
+
+    static void interleaveRowTail(uint8_t *dst, const uint8_t *u, const uint8_t *v, int32_t from, int32_t width) {
+        for (int32_t x = from; x < width; x++) {
+            dst[2 * x]     = u[x];
+            dst[2 * x + 1] = v[x];
+        }
+    }
+
+    static void interleaveRowsScalar(uint8_t *dst, int32_t dstStride, const uint8_t *u, int32_t uStride, const uint8_t *v, int32_t vStride,
+                                     int32_t width, int32_t rows) {
+        for (int32_t y = 0; y < rows; y++) {
+            interleaveRowTail(dst + (size_t)y * dstStride, u + (size_t)y * uStride, v + (size_t)y * vStride, 0, width);
+        }
+    }
+
+    static uint8_t clamp8(int32_t v) { return (uint8_t)(v < 0 ? 0 : (v > 255 ? 255 : v)); }
+
+    // 转换一行中[from, width)的像素，和simd实现使用同样的定点运算，结果一致
+    static void yuvToRgbaTail(uint8_t *dst, const uint8_t *y, const uint8_t *u, const uint8_t *v, int32_t from, int32_t width, const YuvMatrix &m) {
+        for (int32_t x = from; x < width; x++) {
+            int32_t luma   = m.y * (y[x] - m.yOffset) + (1 << 12);
+            int32_t cu     = u[x >> 1] - 128;
+            int32_t cv     = v[x >> 1] - 128;
+            dst[4 * x]     = clamp8((luma + m.vr * cv) >> 13);
+            dst[4 * x + 1] = clamp8((luma + m.ug * cu + m.vg * cv) >> 13);
+            dst[4 * x + 2] = clamp8((luma + m.ub * cu) >> 13);
+            dst[4 * x + 3] = 255;
+        }
+    }
+
+    static void yuvToRgbaScalar(uint8_t *dst, int32_t dstStride, const uint8_t *const *planes, const int32_t *strides, int32_t width, int32_t rows,
+                                int32_t firstRow, const YuvMatrix &m) {
+        for (int32_t r = 0; r < rows; r++) {
+            int32_t y = firstRow + r;
+            yuvToRgbaTail(dst + (size_t)r * dstStride, planes[0] + (size_t)y * strides[0], planes[1] + (size_t)(y >> 1) * strides[1],
+                          planes[2] + (size_t)(y >> 1) * strides[2], 0, width, m);
+        }
+    }
+
+#ifdef PACK_KERNELS_X86
+    //------------------------------------------------------------------------
+    // sse2
+
+    __attribute__((target("sse2"))) static void copyRowSse2(uint8_t *dst, const uint8_t *src, int32_t rowBytes) {
+        int32_t x = 0;
+        for (; x + 64 <= rowBytes; x += 64) {
+            __m128i a = _mm_loadu_si128((const __m128i *)(src + x));
+            __m128i b = _mm_loadu_si128((const __m128i *)(src + x + 16));
+            __m128i c = _mm_loadu_si128((const __m128i *)(src + x + 32));
+            __m128i d = _mm_loadu_si128((const __m128i *)(src + x + 48));
+            _mm_storeu_si128((__m128i *)(dst + x), a);
+            _mm_storeu_si128((__m128i *)(dst + x + 16), b);
+            _mm_storeu_si128((__m128i *)(dst + x + 32), c);
+            _mm_storeu_si128((__m128i *)(dst + x + 48), d);
+        }
+        for (; x + 16 <= rowBytes; x += 16) {
+            _mm_storeu_si128((__m128i *)(dst + x), _mm_loadu_si128((const __m128i *)(src + x)));
+        }
+        if (x < rowBytes) {
+            memcpy(dst + x, src + x, rowBytes - x);
+        }
+    }
+
+    __attribute__((target("sse2"))) static void copyRowsSse2(uint8_t *dst, int32_t dstStride, const uint8_t *src, int32_t srcStride, int32_t rowBytes,
+                                                             int32_t rows) {
+        for (int32_t y = 0; y < rows; y++) {
+            copyRowSse2(dst + (size_t)y * dstStride, src + (size_t)y * srcStride, rowBytes);
+        }
+    }
+
+    // 立体声16/32位有向量实现，其他情况使用标量
+    __attribute__((target("sse2"))) static void interleaveSse2(uint8_t *dst, const uint8_t *const *planes, int32_t channels, int32_t samples,
+                                                               int32_t sampleSize) {
+        int32_t i = 0;
+        if (channels == 2 && sampleSize == 2) {
+            for (; i + 8 <= samples; i += 8) {
+                __m128i l = _mm_loadu_si128((const __m128i *)(planes[0] + i * 2));
+                __m128i r = _mm_loadu_si128((const __m128i *)(planes[1] + i * 2));
+                _mm_storeu_si128((__m128i *)(dst + i * 4), _mm_unpacklo_epi16(l, r));
+                _mm_storeu_si128((__m128i *)(dst + i * 4 + 16), _mm_unpackhi_epi16(l, r));
+            }
+        } else if (channels == 2 && sampleSize == 4) {
+            for (; i + 4 <= samples; i += 4) {
+                __m128i l = _mm_loadu_si128((const __m128i *)(planes[0] + i * 4));
+                __m128i r = _mm_loadu_si128((const __m128i *)(planes[1] + i * 4));
+                _mm_storeu_si128((__m128i *)(dst + i * 8), _mm_unpacklo_epi32(l, r));
+                _mm_storeu_si128((__m128i *)(dst + i * 8 + 16), _mm_unpackhi_epi32(l, r));
+            }
+        }
+        interleaveTail(dst, planes, channels, samples, sampleSize, i);
+    }
+
+    __attribute__((target("sse2"))) static __m128i biasSse2(const Convert &c, int32_t y, bool wide) {
+        int32_t b0 = bias(c, 0, y);
+        int32_t b1 = bias(c, 1, y);
+        return wide ? _mm_set_epi32(b1, b0, b1, b0) : _mm_set1_epi32((b1 << 16) | b0);
+    }
+
+    // 8个16位采样: 可选与下一行平均，加偏移，右移
+    __attribute__((target("sse2"))) static __m128i load16Sse2(const uint8_t *row0, const uint8_t *row1, int32_t x, const Convert &c, __m128i bias,
+                                                              __m128i shift) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(row0 + x * 2));
+        if (c.vsub == 2) {
+            v = _mm_avg_epu16(v, _mm_loadu_si128((const __m128i *)(row1 + x * 2)));
+        }
+        return _mm_srl_epi16(_mm_add_epi16(v, bias), shift);
+    }
+
+    // 16个8位源采样水平两两平均，得到8个16位采样
+    __attribute__((target("sse2"))) static __m128i hsub8Sse2(__m128i v) {
+        return _mm_avg_epu16(_mm_and_si128(v, _mm_set1_epi16(0xff)), _mm_srli_epi16(v, 8));
+    }
+
+    __attribute__((target("sse2"))) static void convertRowsSse2(uint8_t *dst, int32_t dstStride, const uint8_t *src, int32_t srcStride, int32_t width,
+                                                                int32_t rows, int32_t firstRow, const Convert &c) {
+        __m128i shift = _mm_cvtsi32_si128(c.shift);
+        for (int32_t r = 0; r < rows; r++) {
+            int32_t y           = firstRow + r;
+            uint8_t *out        = dst + (size_t)r * dstStride;
+            const uint8_t *row0 = src + (size_t)r * c.vsub * srcStride;
+            const uint8_t *row1 = row0 + srcStride;
+            int32_t x           = 0;
+
+            if (c.srcBytes == 2 && c.hsub == 1) {
+                // 10位4:2:0的所有平面、4:2:2的色度
+                __m128i bias = biasSse2(c, y, false);
+                for (; x + 16 <= width; x += 16) {
+                    __m128i lo = load16Sse2(row0, row1, x, c, bias, shift);
+                    __m128i hi = load16Sse2(row0, row1, x + 8, c, bias, shift);
+                    _mm_storeu_si128((__m128i *)(out + x), _mm_packus_epi16(lo, hi));
+                }
+            } else if (c.srcBytes == 1 && c.hsub == 1 && c.vsub == 2) {
+                // 8位4:2:2的色度
+                for (; x + 16 <= width; x += 16) {
+                    __m128i a = _mm_loadu_si128((const __m128i *)(row0 + x));
+                    __m128i b = _mm_loadu_si128((const __m128i *)(row1 + x));
+                    _mm_storeu_si128((__m128i *)(out + x), _mm_avg_epu8(a, b));
+                }
+            } else if (c.srcBytes == 1 && c.hsub == 2 && c.vsub == 2) {
+                // 8位4:4:4的色度
+                for (; x + 16 <= width; x += 16) {
+                    __m128i a  = _mm_avg_epu8(_mm_loadu_si128((const __m128i *)(row0 + x * 2)), _mm_loadu_si128((const __m128i *)(row1 + x * 2)));
+                    __m128i b  = _mm_avg_epu8(_mm_loadu_si128((const __m128i *)(row0 + x * 2 + 16)), _mm_loadu_si128((const __m128i *)(row1 + x * 2 + 16)));
+                    _mm_storeu_si128((__m128i *)(out + x), _mm_packus_epi16(hsub8Sse2(a), hsub8Sse2(b)));
+                }
+            } else if (c.srcBytes == 2 && c.hsub == 2 && c.vsub == 2) {
+                // 10位4:4:4的色度，32位通道内水平平均，结果不超过8位，有符号饱和打包不会截断
+                __m128i bias = biasSse2(c, y, true);
+                __m128i mask = _mm_set1_epi32(0xffff);
+                for (; x + 8 <= width; x += 8) {
+                    __m128i q[2];
+                    for (int32_t i = 0; i < 2; i++) {
+                        __m128i v = _mm_avg_epu16(_mm_loadu_si128((const __m128i *)(row0 + x * 4 + i * 16)),
+                                                  _mm_loadu_si128((const __m128i *)(row1 + x * 4 + i * 16)));
+                        v         = _mm_avg_epu16(_mm_and_si128(v, mask), _mm_srli_epi32(v, 16));
+                        q[i]      = _mm_srl_epi32(_mm_add_epi32(v, bias), shift);
+                    }
+                    __m128i packed = _mm_packs_epi32(q[0], q[1]);
+                    _mm_storel_epi64((__m128i *)(out + x), _mm_packus_epi16(packed, packed));
+                }
+            }
+            convertRowTail(out, row0, row1, x, width, y, c);
+        }
+    }
+
+    __attribute__((target("sse2"))) static void interleaveRowsSse2(uint8_t *dst, int32_t dstStride, const uint8_t *u, int32_t uStride, const uint8_t *v,
+                                                                   int32_t vStride, int32_t width, int32_t rows) {
+        for (int32_t y = 0; y < rows; y++) {
+            uint8_t *out      = dst + (size_t)y * dstStride;
+            const uint8_t *ur = u + (size_t)y * uStride;
+            const uint8_t *vr = v + (size_t)y * vStride;
+            int32_t x         = 0;
+            for (; x + 16 <= width; x += 16) {
+                __m128i a = _mm_loadu_si128((const __m128i *)(ur + x));
+                __m128i b = _mm_loadu_si128((const __m128i *)(vr + x));
+                _mm_storeu_si128((__m128i *)(out + x * 2), _mm_unpacklo_epi8(a, b));
+                _mm_storeu_si128((__m128i *)(out + x * 2 + 16), _mm_unpackhi_epi8(a, b));
+            }
+            interleaveRowTail(out, ur, vr, x, width);
+        }
+    }
+
+    // madd的系数对，和unpack(a, b)的16位交错顺序一致
+    __attribute__((target("sse2"))) static __m128i coefSse2(int32_t a, int32_t b) { return _mm_set_epi16(b, a, b, a, b, a, b, a); }
+
+    // 8个像素的 (a * ab0 + b * ab1 + c * cd0 + d * cd1) >> 13，32位累加，有符号饱和到16位
+    __attribute__((target("sse2"))) static __m128i dotSse2(__m128i a, __m128i b, __m128i ab, __m128i c, __m128i d, __m128i cd) {
+        __m128i lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(a, b), ab), _mm_madd_epi16(_mm_unpacklo_epi16(c, d), cd));
+        __m128i hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(a, b), ab), _mm_madd_epi16(_mm_unpackhi_epi16(c, d), cd));
+        return _mm_packs_epi32(_mm_srai_epi32(lo, 13), _mm_srai_epi32(hi, 13));
+    }
+
+    // 每次16个像素，色度水平复制到两个像素，RGB各通道用madd计算后饱和打包到8位，再交错成RGBA
+    // avx2的unpack/pack在128位通道内进行，重排的开销抵消了收益，avx2/avx-512也使用这个实现
+    __attribute__((target("sse2"))) static void yuvToRgbaSse2(uint8_t *dst, int32_t dstStride, const uint8_t *const *planes, const int32_t *strides,
+                                                              int32_t width, int32_t rows, int32_t firstRow, const YuvMatrix &m) {
+        const __m128i zero    = _mm_setzero_si128();
+        const __m128i one     = _mm_set1_epi16(1);
+        const __m128i alpha   = _mm_set1_epi8((char)0xff);
+        const __m128i yOff    = _mm_set1_epi16(m.yOffset);
+        const __m128i c128    = _mm_set1_epi16(128);
+        const __m128i round   = coefSse2(1 << 12, 0);
+        const __m128i yVr     = coefSse2(m.y, m.vr);
+        const __m128i yUg     = coefSse2(m.y, m.ug);
+        const __m128i vgRound = coefSse2(m.vg, 1 << 12);
+        const __m128i yUb     = coefSse2(m.y, m.ub);
+
+        for (int32_t r = 0; r < rows; r++) {
+            int32_t row       = firstRow + r;
+            uint8_t *out      = dst + (size_t)r * dstStride;
+            const uint8_t *yr = planes[0] + (size_t)row * strides[0];
+            const uint8_t *ur = planes[1] + (size_t)(row >> 1) * strides[1];
+            const uint8_t *vr = planes[2] + (size_t)(row >> 1) * strides[2];
+            int32_t x         = 0;
+            for (; x + 16 <= width; x += 16) {
+                __m128i y8  = _mm_loadu_si128((const __m128i *)(yr + x));
+                __m128i u16 = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(ur + x / 2)), zero), c128);
+                __m128i v16 = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(vr + x / 2)), zero), c128);
+
+                __m128i rgb[2][3];
+                for (int32_t h = 0; h < 2; h++) {
+                    __m128i yv = _mm_sub_epi16(h == 0 ? _mm_unpacklo_epi8(y8, zero) : _mm_unpackhi_epi8(y8, zero), yOff);
+                    __m128i cu = h == 0 ? _mm_unpacklo_epi16(u16, u16) : _mm_unpackhi_epi16(u16, u16);
+                    __m128i cv = h == 0 ? _mm_unpacklo_epi16(v16, v16) : _mm_unpackhi_epi16(v16, v16);
+                    rgb[h][0]  = dotSse2(yv, cv, yVr, one, one, round);
+                    rgb[h][1]  = dotSse2(yv, cu, yUg, cv, one, vgRound);
+                    rgb[h][2]  = dotSse2(yv, cu, yUb, one, one, round);
+                }
+                __m128i red   = _mm_packus_epi16(rgb[0][0], rgb[1][0]);
+                __m128i green = _mm_packus_epi16(rgb[0][1], rgb[1][1]);
+                __m128i blue  = _mm_packus_epi16(rgb[0][2], rgb[1][2]);
+
+                __m128i rgLo = _mm_unpacklo_epi8(red, green);
+                __m128i rgHi = _mm_unpackhi_epi8(red, green);
+                __m128i baLo = _mm_unpacklo_epi8(blue, alpha);
+                __m128i baHi = _mm_unpackhi_epi8(blue, alpha);
+                _mm_storeu_si128((__m128i *)(out + x * 4), _mm_unpacklo_epi16(rgLo, baLo));
+                _mm_storeu_si128((__m128i *)(out + x * 4 + 16), _mm_unpackhi_epi16(rgLo, baLo));
+                _mm_storeu_si128((__m128i *)(out + x * 4 + 32), _mm_unpacklo_epi16(rgHi, baHi));
+                _mm_storeu_si128((__m128i *)(out + x * 4 + 48), _mm_unpackhi_epi16(rgHi, baHi));
+            }
+            yuvToRgbaTail(out, yr, ur, vr, x, width, m);
+        }
+    }
+
+    //------------------------------------------------------------------------
+    // avx2
+
+    __attribute__((target("avx2"))) static void copyRowAvx2(uint8_t *dst, const uint8_t *src, int32_t rowBytes) {
+        int32_t x = 0;
+        for (; x + 128 <= rowBytes; x += 128) {
+            __m256i a = _mm256_loadu_si256((const __m256i *)(src + x));
+            __m256i b = _mm256_loadu_si256((const __m256i *)(src + x + 32));
+            __m256i c = _mm256_loadu_si256((const __m256i *)(src + x + 64));
+            __m256i d = _mm256_loadu_si256((const __m256i *)(src + x + 96));
+            _mm256_storeu_si256((__m256i *)(dst + x), a);
+            _mm256_storeu_si256((__m256i *)(dst + x + 32), b);
+            _mm256_storeu_si256((__m256i *)(dst + x + 64), c);
+            _mm256_storeu_si256((__m256i *)(dst + x + 96), d);
+        }
+        for (; x + 32 <= rowBytes; x += 32) {
+            _mm256_storeu_si256((__m256i *)(dst + x), _mm256_loadu_si256((const __m256i *)(src + x)));
+        }
+        // 剩余不足32字节时用最后32字节重叠拷贝，避免逐字节的尾部处理
+        if (x < rowBytes && rowBytes >= 32) {
+            _mm256_storeu_si256((__m256i *)(dst + rowBytes - 32), _mm256_loadu_si256((const __m256i *)(src + rowBytes - 32)));
+        } else if (x < rowBytes) {
+            memcpy(dst + x, src + x, rowBytes - x);
+        }
+    }
+
+    __attribute__((target("avx2"))) static void copyRowsAvx2(uint8_t *dst, int32_t dstStride, const uint8_t *src, int32_t srcStride, int32_t rowBytes,
+                                                             int32_t rows) {
+        for (int32_t y = 0; y < rows; y++) {
+            copyRowAvx2(dst + (size_t)y * dstStride, src + (size_t)y * srcStride, rowBytes);
+        }
+    }
+
+    __attribute__((target("avx2"))) static void interleaveAvx2(uint8_t *dst, const uint8_t *const *planes, int32_t channels, int32_t samples,
+                                                               int32_t sampleSize) {
+        int32_t i = 0;
+        if (channels == 2 && sampleSize == 2) {
+            for (; i + 16 <= samples; i += 16) {
+                __m256i l  = _mm256_loadu_si256((const __m256i *)(planes[0] + i * 2));
+                __m256i r  = _mm256_loadu_si256((const __m256i *)(planes[1] + i * 2));
+                __m256i lo = _mm256_unpacklo_epi16(l, r);
+                __m256i hi = _mm256_unpackhi_epi16(l, r);
+                // unpack在128位通道内进行，重新排列两个通道的结果
+                _mm256_storeu_si256((__m256i *)(dst + i * 4), _mm256_permute2x128_si256(lo, hi, 0x20));
+                _mm256_storeu_si256((__m256i *)(dst + i * 4 + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+            }
+        } else if (channels == 2 && sampleSize == 4) {
+            for (; i + 8 <= samples; i += 8) {
+                __m256i l  = _mm256_loadu_si256((const __m256i *)(planes[0] + i * 4));
+                __m256i r  = _mm256_loadu_si256((const __m256i *)(planes[1] + i * 4));
+                __m256i lo = _mm256_unpacklo_epi32(l, r);
+                __m256i hi = _mm256_unpackhi_epi32(l, r);
+                _mm256_storeu_si256((__m256i *)(dst + i * 8), _mm256_permute2x128_si256(lo, hi, 0x20));
+                _mm256_storeu_si256((__m256i *)(dst + i * 8 + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+            }
+        }
+        interleaveTail(dst, planes, channels, samples, sampleSize, i);
+    }
+
+    // 10位的平面和8位4:2:2的色度有avx2实现，其他情况使用sse2
+    __attribute__((target("avx2"))) static void convertRowsAvx2(uint8_t *dst, int32_t dstStride, const uint8_t *src, int32_t srcStride, int32_t width,
+                                                                int32_t rows, int32_t firstRow, const Convert &c) {
+        bool wide10 = c.srcBytes == 2 && c.hsub == 1;
+        bool vsub8  = c.srcBytes == 1 && c.hsub == 1 && c.vsub == 2;
+        if (!wide10 && !vsub8) {
+            convertRowsSse2(dst, dstStride, src, srcStride, width, rows, firstRow, c);
+            return;
+        }
+
+        __m128i shift = _mm_cvtsi32_si128(c.shift);
+        for (int32_t r = 0; r < rows; r++) {
+            int32_t y           = firstRow + r;
+            uint8_t *out        = dst + (size_t)r * dstStride;
+            const uint8_t *row0 = src + (size_t)r * c.vsub * srcStride;
+            const uint8_t *row1 = row0 + srcStride;
+            int32_t x           = 0;
+
+            if (wide10) {
+                __m256i offset = _mm256_set1_epi32((bias(c, 1, y) << 16) | bias(c, 0, y));
+                for (; x + 32 <= width; x += 32) {
+                    __m256i v[2];
+                    for (int32_t i = 0; i < 2; i++) {
+                        v[i] = _mm256_loadu_si256((const __m256i *)(row0 + (x + i * 16) * 2));
+                        if (c.vsub == 2) {
+                            v[i] = _mm256_avg_epu16(v[i], _mm256_loadu_si256((const __m256i *)(row1 + (x + i * 16) * 2)));
+                        }
+                        v[i] = _mm256_srl_epi16(_mm256_add_epi16(v[i], offset), shift);
+                    }
+                    // packus在128位通道内交错，重新排列64位块恢复顺序
+                    __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(v[0], v[1]), 0xd8);
+                    _mm256_storeu_si256((__m256i *)(out + x), packed);
+                }
+            } else {
+                for (; x + 32 <= width; x += 32) {
+                    __m256i a = _mm256_loadu_si256((const __m256i *)(row0 + x));
+                    __m256i b = _mm256_loadu_si256((const __m256i *)(row1 + x));
+                    _mm256_storeu_si256((__m256i *)(out + x), _mm256_avg_epu8(a, b));
+                }
+            }
+            convertRowTail(out, row0, row1, x, width, y, c);
+        }
+    }
+
+    __attribute__((target("avx2"))) static void interleaveRowsAvx2(uint8_t *dst, int32_t dstStride, const uint8_t *u, int32_t uStride, const uint8_t *v,
+                                                                   int32_t vStride, int32_t width, int32_t rows) {
+        for (int32_t y = 0; y < rows; y++) {
+            uint8_t *out      = dst + (size_t)y * dstStride;
+            const uint8_t *ur = u + (size_t)y * uStride;
+            const uint8_t *vr = v + (size_t)y * vStride;
+            int32_t x         = 0;
+            for (; x + 32 <= width; x += 32) {
+                __m256i a  = _mm256_loadu_si256((const __m256i *)(ur + x));
+                __m256i b  = _mm256_loadu_si256((const __m256i *)(vr + x));
+                __m256i lo = _mm256_unpacklo_epi8(a, b);
+                __m256i hi = _mm256_unpackhi_epi8(a, b);
+                _mm256_storeu_si256((__m256i *)(out + x * 2), _mm256_permute2x128_si256(lo, hi, 0x20));
+                _mm256_storeu_si256((__m256i *)(out + x * 2 + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+            }
+            interleaveRowTail(out, ur, vr, x, width);
+        }
+    }
+
+    //------------------------------------------------------------------------
+    // avx-512，只依赖avx512f
+
+    __attribute__((target("avx512f"))) static void copyRowAvx512(uint8_t *dst, const uint8_t *src, int32_t rowBytes) {
+        int32_t x = 0;
+        for (; x + 256 <= rowBytes; x += 256) {
+            __m512i a = _mm512_loadu_si512((const void *)(src + x));
+            __m512i b = _mm512_loadu_si512((const void *)(src + x + 64));
+            __m512i c = _mm512_loadu_si512((const void *)(src + x + 128));
+            __m512i d = _mm512_loadu_si512((const void *)(src + x + 192));
+            _mm512_storeu_si512((void *)(dst + x), a);
+            _mm512_storeu_si512((void *)(dst + x + 64), b);
+            _mm512_storeu_si512((void *)(dst + x + 128), c);
+            _mm512_storeu_si512((void *)(dst + x + 192), d);
+        }
+        for (; x + 64 <= rowBytes; x += 64) {
+            _mm512_storeu_si512((void *)(dst + x), _mm512_loadu_si512((const void *)(src + x)));
+        }
+        if (x < rowBytes && rowBytes >= 64) {
+            _mm512_storeu_si512((void *)(dst + rowBytes - 64), _mm512_loadu_si512((const void *)(src + rowBytes - 64)));
+        } else if (x < rowBytes) {
+            memcpy(dst + x, src + x, rowBytes - x);
+        }
+    }
+
+    __attribute__((target("avx512f"))) static void copyRowsAvx512(uint8_t *dst, int32_t dstStride, const uint8_t *src, int32_t srcStride,
+                                                                  int32_t rowBytes, int32_t rows) {
+        for (int32_t y = 0; y < rows; y++) {
+            copyRowAvx512(dst + (size_t)y * dstStride, src + (size_t)y * srcStride, rowBytes);
+        }
+    }
+
+    // 16位采样的跨通道重排需要avx512bw，使用avx2实现
+    __attribute__((target("avx512f"))) static void interleaveAvx512(uint8_t *dst, const uint8_t *const *planes, int32_t channels, int32_t samples,
+                                                                    int32_t sampleSize) {
+        if (channels != 2 || sampleSize != 4) {
+            interleaveAvx2(dst, planes, channels, samples, sampleSize);
+            return;
+        }
+        const __m512i idxLo = _mm512_set_epi32(23, 7, 22, 6, 21, 5, 20, 4, 19, 3, 18, 2, 17, 1, 16, 0);
+        const __m512i idxHi = _mm512_set_epi32(31, 15, 30, 14, 29, 13, 28, 12, 27, 11, 26, 10, 25, 9, 24, 8);
+        int32_t i           = 0;
+        for (; i + 16 <= samples; i += 16) {
+            __m512i l = _mm512_loadu_si512((const void *)(planes[0] + i * 4));
+            __m512i r = _mm512_loadu_si512((const void *)(planes[1] + i * 4));
+            _mm512_storeu_si512((void *)(dst + i * 8), _mm512_permutex2var_epi32(l, idxLo, r));
+            _mm512_storeu_si512((void *)(dst + i * 8 + 64), _mm512_permutex2var_epi32(l, idxHi, r));
+        }
+        interleaveTail(dst, planes, channels, samples, sampleSize, i);
+    }
+#endif
+
+private:
+    Level supported_                   = kLevel_Scalar;
+    Level level_                       = kLevel_Scalar;
+    CopyRowsFunc copyRows_             = nullptr;
+    ConvertRowsFunc convertRows_       = nullptr;
+    InterleaveFunc interleave_         = nullptr;
+    InterleaveRowsFunc interleaveRows_ = nullptr;
+    YuvToRgbaFunc yuvToRgba_           = nullptr;
+};
+
+} // namespace decoder
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "common/helper/singleton.h"
+#include "common/helper/work_stealing_pool.h"
+#include "server/frame_payload.h"
+
+namespace decoder {
+
+/*
+ * 大帧(4K/8K)的并行打包，把每个区域按行切成若干段，在解码共用的线程池上并行拷贝
+ * 调用线程也参与拷贝，只等待已经被其他worker领取并正在执行的段，即使线程池全忙也不会死锁
+ * 小于阈值的帧(1080p及以下)直接在调用线程打包，避免任务调度的开销
+ */
+class ParallelPacker {
+public:
+    const size_t kParallelMinBytes = 8 * 1024 * 1024; // 4K 4:2:0约12MB，1080p约3MB
+    const size_t kBandBytes        = 1024 * 1024;
+
+    static ParallelPacker &INSTANCE() { return common::Singleton<ParallelPacker>::getInstance(); }
+
+    // 把payload追加到out的末尾，返回是否并行打包
+    bool appendTo(const FramePayload &payload, std::string &out) {
+        auto &pool = executor();
+        if (payload.size() < kParallelMinBytes || pool.size() < 2) {
+            payload.appendTo(out);
+            return false;
+        }
+
+        auto job    = std::make_shared<Job>();
+        size_t base = out.size();
+        out.resize(base + payload.size());
+        uint8_t *dst = (uint8_t *)&out[base];
+        memcpy(dst, payload.header().data(), payload.header().size());
+        dst += payload.header().size();
+
+        for (auto &r : payload.regions()) {
+            int32_t bandRows = std::max<int32_t>(1, (int32_t)(kBandBytes / std::max<int32_t>(1, r.rowBytes)));
+            for (int32_t row = 0; row < r.rows; row += bandRows) {
+                int32_t rows = std::min(bandRows, r.rows - row);
+                job->bands.push_back(Band{r, row, rows, dst + (size_t)row * r.rowBytes});
+            }
+            dst += (size_t)r.rowBytes * r.rows;
+        }
+
+        // 已经在执行的任务优先级最高，辅助任务尽快被空闲worker领取
+        int32_t helpers = std::min<int32_t>(pool.size() - 1, (int32_t)job->bands.size() - 1);
+        for (int32_t i = 0; i < helpers; i++) {
+            pool.submit([job]() { job->run(); }, 0);
+        }
+        job->run();
+        job->wait();
+
+        parallelPacks_++;
+        bands_ += job->bands.size();
+        return true;
+    }
+
+    uint64_t getParallelPacks() const { return parallelPacks_; }
+
+    uint64_t getBands() const { return bands_; }
+
+private:
+    struct Band {
+        FramePayload::Region region;
+        int32_t firstRow;
+        int32_t rows;
+        uint8_t *dst;
+    };
+
+    struct Job {
+        std::vector<Band> bands;
+        std::atomic<size_t> next{0};
+        std::atomic<size_t> done{0};
+        std::mutex mutex;
+        std::condition_variable cond;
+
+        // 领取并执行剩余的段，没有剩余时立即返回
+        void run() {
+            size_t i = 0;
+            while ((i = next++) < bands.size()) {
+                FramePayload::packRows(bands[i].region, bands[i].firstRow, bands[i].rows, bands[i].dst);
+                if (++done == bands.size()) {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    cond.notify_all();
+                }
+            }
+        }
+
+        void wait() {
+            std::unique_lock<std::mutex> lock(mutex);
+            cond.wait(lock, [this]() { return done == bands.size(); });
+        }
+    };
+
+    // 和解码任务共用同一个线程池
+    static common::WorkStealingPool &executor() { return common::Singleton<common::WorkStealingPool>::getInstance(); }
+
+private:
+    std::atomic<uint64_t> parallelPacks_{0};
+    std::atomic<uint64_t> bands_{0};
+};
+
+} // namespace decoder
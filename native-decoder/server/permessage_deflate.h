@@ -0,0 +1,126 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+
+#include <websocketpp/extensions/permessage_deflate/enabled.hpp>
+
+#include "server/message_compressor.h"
+#include "server/zlib_budget.h"
+
+namespace decoder {
+
+/*
+ * 服务端的permessage-deflate扩展，替换websocketpp的实现，只负责协商和解压
+ * websocketpp的实现在握手后给每个连接分配固定的压缩和解压上下文，连接多时占用大量内存
+ * 这里不分配压缩上下文，发送的消息由MessageCompressor按策略压缩(预先准备好并设置RSV1)
+ * 解压上下文在第一次收到压缩消息时分配，并要求客户端使用较小的窗口(客户端发来的主要是不可压缩的码流)
+ */
+template <typename config> class BoundedPermessageDeflate {
+public:
+    typedef std::pair<websocketpp::lib::error_code, std::string> err_str_pair;
+
+    const int32_t kClientWindowBits = 12;
+
+    ~BoundedPermessageDeflate() {
+        if (inflateReady_) {
+            inflateEnd(&istate_);
+        }
+    }
+
+    bool is_implemented() const { return true; }
+
+    bool is_enabled() const { return enabled_; }
+
+    // 只用于服务端，不发起协商
+    std::string generate_offer() const { return ""; }
+
+    websocketpp::lib::error_code validate_offer(websocketpp::http::attribute_list const &) { return websocketpp::lib::error_code(); }
+
+    err_str_pair negotiate(websocketpp::http::attribute_list const &offer) {
+        using namespace websocketpp::extensions::permessage_deflate;
+        err_str_pair ret;
+        std::string response = "permessage-deflate";
+        int32_t clientBits   = 15;
+        for (auto &it : offer) {
+            if (it.first == "server_no_context_takeover" || it.first == "client_no_context_takeover") {
+                if (!it.second.empty()) {
+                    ret.first = error::make_error_code(error::invalid_attribute_value);
+                    return ret;
+                }
+                response += "; " + it.first;
+            } else if (it.first == "server_max_window_bits") {
+                int32_t bits = atoi(it.second.c_str());
+                if (bits < 8 || bits > 15) {
+                    ret.first = error::make_error_code(error::invalid_attribute_value);
+                    return ret;
+                }
+                // zlib不支持8位的raw deflate窗口，用9位代替
+                response += "; server_max_window_bits=" + std::to_string(std::max(bits, 9));
+            } else if (it.first == "client_max_window_bits") {
+                int32_t bits = it.second.empty() ? 15 : atoi(it.second.c_str());
+                if (bits < 8 || bits > 15) {
+                    ret.first = error::make_error_code(error::invalid_attribute_value);
+                    return ret;
+                }
+                clientBits = std::max(9, std::min(bits, kClientWindowBits));
+                response += "; client_max_window_bits=" + std::to_string(clientBits);
+            } else {
+                ret.first = error::make_error_code(error::invalid_attributes);
+                return ret;
+            }
+        }
+        enabled_          = true;
+        clientWindowBits_ = clientBits;
+        ret.second        = response;
+        return ret;
+    }
+
+    websocketpp::lib::error_code init(bool) { return websocketpp::lib::error_code(); }
+
+    // 服务端发送的消息都已经准备好，不会经过这里，保留不带上下文的实现
+    websocketpp::lib::error_code compress(std::string const &in, std::string &out) {
+        std::string compressed;
+        if (!MessageCompressor::deflateStateless(Z_DEFAULT_COMPRESSION, 15, (const uint8_t *)in.data(), in.size(), compressed)) {
+            return websocketpp::extensions::permessage_deflate::error::make_error_code(
+                websocketpp::extensions::permessage_deflate::error::zlib_error);
+        }
+        out.append(compressed);
+        return websocketpp::lib::error_code();
+    }
+
+    websocketpp::lib::error_code decompress(uint8_t const *buf, size_t len, std::string &out) {
+        using namespace websocketpp::extensions::permessage_deflate;
+        if (!inflateReady_) {
+            memset(&istate_, 0, sizeof(istate_));
+            ZlibBudget::INSTANCE().bind(istate_, false);
+            if (inflateInit2(&istate_, -clientWindowBits_) != Z_OK) {
+                return error::make_error_code(error::zlib_error);
+            }
+            inflateReady_ = true;
+        }
+
+        uint8_t chunk[8192];
+        istate_.next_in  = (Bytef *)buf;
+        istate_.avail_in = (uInt)len;
+        do {
+            istate_.next_out  = chunk;
+            istate_.avail_out = sizeof(chunk);
+            int32_t ret       = inflate(&istate_, Z_SYNC_FLUSH);
+            if (ret != Z_OK && ret != Z_BUF_ERROR) {
+                return error::make_error_code(error::zlib_error);
+            }
+            out.append((const char *)chunk, sizeof(chunk) - istate_.avail_out);
+        } while (istate_.avail_out == 0);
+        return websocketpp::lib::error_code();
+    }
+
+private:
+    bool enabled_             = false;
+    int32_t clientWindowBits_ = 15; // 客户端没有提出client_max_window_bits时只能使用15位
+    z_stream istate_;
+    bool inflateReady_ = false;
+};
+
+} // namespace decoder
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <vector>
 #include "json/json.hpp"
 
 namespace decoder {
@@ -73,11 +74,26 @@ void to_json_base(json &j, const BaseRequest &p) {
 typedef struct tagInitDecoderRequest : public BaseRequest {
     int fileSize;
     int waitHeaderLength;
+    int overflowPolicy; // 实况接收缓冲区满时的策略，0丢弃新数据，1积压到缓冲区上限的一半时丢弃积压
+    int maxLatencyMs;   // 实况积压超过该延迟时跳到最新关键帧，0不限制，-1使用默认值
+    int maxBacklogSize; // 实况积压超过该字节数时跳到最新关键帧，0不限制，-1使用默认值
+    std::string codec;     // 客户端已知的实况裸流编码格式: h264/hevc，为空时从码流识别
+    std::string extradata; // 客户端已知的Annex-B参数集(base64)，可以为空
+    bool fastOpen;         // 实况裸流按参数集快速打开，不完整探测
+    int ingestMode;        // 实况流的输入方式，0由avformat解复用，1为Annex-B字节流，2为每条消息一个Annex-B访问单元
 } InitDecoderRequest;
 
 void from_json(const json &j, InitDecoderRequest &p) {
     from_json_base(j, p);
 
+    p.overflowPolicy = j.value("overflowPolicy", 1);
+    p.maxLatencyMs   = j.value("maxLatencyMs", -1);
+    p.maxBacklogSize = j.value("maxBacklogSize", -1);
+    p.codec          = j.value("codec", "");
+    p.extradata      = j.value("extradata", "");
+    p.fastOpen       = j.value("fastOpen", true);
+    p.ingestMode     = j.value("ingestMode", 0);
+
     try {
         p.fileSize         = j.at("fileSize").get<int>();
         p.waitHeaderLength = j.at("waitHeaderLength").get<int>();
@@ -89,10 +105,32 @@ void from_json(const json &j, InitDecoderRequest &p) {
 typedef struct tagOpenDecoderRequest : public BaseRequest {
     bool hasVideo;
     bool hasAudio;
+    int32_t headerVersion; // 解码数据头部版本，见FrameHeader::Version，旧的客户端不带此字段
+    bool highBitDepth;     // 客户端可以渲染16位采样
+    bool dither;           // 高位深转8位时使用抖动
+    int32_t outputWidth;   // 客户端的显示尺寸，解码帧保持宽高比缩小到该尺寸以内，0为原始尺寸
+    int32_t outputHeight;
+    std::vector<std::string> outputFormats; // 按优先级排列的视频输出格式: I420/NV12/RGBA/Y
+    int32_t creditWindow;                   // 视频帧的初始credit，0为不使用credit(旧的客户端)
+    int32_t dropPolicy;                     // 没有credit时的策略，0丢弃非参考帧，1只保留最新帧，2暂停解码
+    bool adaptiveQuality;                   // 拥塞时自动切换输出档位，档位在解码数据头部的标志中
+    int32_t compressLevel;                  // 视频帧分片压缩的zlib级别，0不压缩，需要二进制头部
+    int32_t openTimeoutMs;                  // 打开和探测的超时，0为服务端默认值
 } OpenDecoderRequest;
 
 void from_json(const json &j, OpenDecoderRequest &p) {
     from_json_base(j, p);
+    p.headerVersion   = j.value("headerVersion", 0);
+    p.highBitDepth    = j.value("highBitDepth", false);
+    p.dither          = j.value("dither", true);
+    p.outputWidth     = j.value("outputWidth", 0);
+    p.outputHeight    = j.value("outputHeight", 0);
+    p.outputFormats   = j.value("outputFormats", std::vector<std::string>());
+    p.creditWindow    = j.value("creditWindow", 0);
+    p.dropPolicy      = j.value("dropPolicy", 2);
+    p.adaptiveQuality = j.value("adaptiveQuality", false);
+    p.compressLevel   = j.value("compressLevel", 0);
+    p.openTimeoutMs   = j.value("openTimeoutMs", 0);
     try {
         p.hasVideo = j.at("hasVideo").get<bool>();
         p.hasAudio = j.at("hasAudio").get<bool>();
@@ -109,6 +147,10 @@ typedef struct tagOpenDecoderResponse : public BaseResponse {
     int audioSampleFmt;
     int audioChannels;
     int audioSampleRate;
+    int headerVersion        = 0;
+    std::string outputFormat = "I420";
+    int probeMs              = 0; // 打开输入和探测流信息的耗时
+    bool fastOpen            = false;
 
     tagOpenDecoderResponse() { cmd = "openDecoder"; }
 
@@ -134,6 +176,25 @@ void to_json(json &j, const OpenDecoderReponse &p) {
     j["audioSampleFmt"]  = p.audioSampleFmt;
     j["audioChannels"]   = p.audioChannels;
     j["audioSampleRate"] = p.audioSampleRate;
+    j["headerVersion"]   = p.headerVersion;
+    j["outputFormat"]    = p.outputFormat;
+    j["probeMs"]         = p.probeMs;
+    j["fastOpen"]        = p.fastOpen;
+}
+
+//---------------------------------------------------------------------------
+// initDecoder、openDecoder和startDecode的参数放在同一条消息中，字段和各自的请求相同，成功时按openDecoder的格式回复一次
+typedef struct tagOpenSessionRequest : public BaseRequest {
+    InitDecoderRequest init;
+    OpenDecoderRequest open;
+    bool start; // 打开后开始解码
+} OpenSessionRequest;
+
+void from_json(const json &j, OpenSessionRequest &p) {
+    from_json_base(j, p);
+    p.init  = j.get<InitDecoderRequest>();
+    p.open  = j.get<OpenDecoderRequest>();
+    p.start = j.value("start", true);
 }
 
 //---------------------------------------------------------------------------
@@ -157,4 +218,240 @@ void to_json(json &j, const RequestDataRequest &p) {
     j["available"] = p.available;
 }
 
+//---------------------------------------------------------------------------
+typedef struct tagUpdateClockRequest : public BaseRequest {
+    double position;
+} UpdateClockRequest;
+
+void from_json(const json &j, UpdateClockRequest &p) {
+    from_json_base(j, p);
+    try {
+        p.position = j.at("position").get<double>();
+    } catch (std::exception &e) {
+    }
+}
+
+//---------------------------------------------------------------------------
+typedef struct tagSetOutputSizeRequest : public BaseRequest {
+    int32_t width;
+    int32_t height;
+} SetOutputSizeRequest;
+
+void from_json(const json &j, SetOutputSizeRequest &p) {
+    from_json_base(j, p);
+    p.width  = j.value("width", 0);
+    p.height = j.value("height", 0);
+}
+
+//---------------------------------------------------------------------------
+typedef struct tagGrantCreditRequest : public BaseRequest {
+    int32_t frames;
+} GrantCreditRequest;
+
+void from_json(const json &j, GrantCreditRequest &p) {
+    from_json_base(j, p);
+    p.frames = j.value("frames", 0);
+}
+
+//---------------------------------------------------------------------------
+typedef struct tagWorkerStats {
+    uint64_t executed;
+    uint64_t steals;
+    double utilisation;
+
+    tagWorkerStats(uint64_t executed, uint64_t steals, double utilisation) {
+        this->executed    = executed;
+        this->steals      = steals;
+        this->utilisation = utilisation;
+    }
+} WorkerStats;
+
+void to_json(json &j, const WorkerStats &p) {
+    j["executed"]    = p.executed;
+    j["steals"]      = p.steals;
+    j["utilisation"] = p.utilisation;
+}
+
+// 连接上一种消息(control/audio/video)的压缩统计
+typedef struct tagMessageCompressStats {
+    std::string type;
+    uint64_t compressed;
+    uint64_t uncompressed;
+    double ratio;
+
+    tagMessageCompressStats(const std::string &type, uint64_t compressed, uint64_t uncompressed, double ratio) {
+        this->type         = type;
+        this->compressed   = compressed;
+        this->uncompressed = uncompressed;
+        this->ratio        = ratio;
+    }
+} MessageCompressStats;
+
+void to_json(json &j, const MessageCompressStats &p) {
+    j["type"]         = p.type;
+    j["compressed"]   = p.compressed;
+    j["uncompressed"] = p.uncompressed;
+    j["ratio"]        = p.ratio;
+}
+
+typedef struct tagGetStatsResponse : public BaseResponse {
+    std::vector<WorkerStats> workers;
+    uint64_t decodeWakeups;
+    uint64_t decodedFrames;
+    uint64_t deadlineMisses;
+    int64_t ingestQueuedBytes;
+    uint64_t ingestDroppedBytes;
+    uint64_t ingestReceivedBytes;
+    uint64_t ingestCopiedBytes;
+    uint64_t catchUps;
+    uint64_t catchUpBytes;
+    uint64_t framePoolAllocs;
+    uint64_t framePoolGets;
+    uint64_t codecPoolHits; // 进程的解码上下文池，打开会话时取到空闲上下文的次数
+    uint64_t codecPoolMisses;
+    uint64_t codecPoolWarmed;
+    int32_t codecPoolIdle;
+    double codecPoolHitRate;
+    uint64_t messagePoolHits;
+    uint64_t messagePoolMisses;
+    uint64_t messagePoolDropped;
+    int64_t messagePoolBytes;
+    double videoDecodeUs; // 视频各阶段每帧的平均耗时
+    double videoPrepareUs;
+    double videoPackUs;
+    double videoScaleUs;       // 每个缩放帧的平均缩放耗时
+    double videoBytesPerFrame; // 每帧发送的视频数据字节数
+    uint64_t scaledFrames;
+    uint64_t dropNonRef; // 没有credit时按原因统计的视频丢帧
+    uint64_t dropOverflow;
+    uint64_t dropMailbox;
+    uint64_t creditPauses;
+    int64_t credit;
+    int32_t qualityLevel; // 自适应档位，见QualityLadder::Level
+    uint64_t qualitySwitches;
+    double throughput;    // 最近一秒连接的排空速率，字节/秒
+    uint64_t parallelPacks;
+    uint64_t packBands;
+    uint64_t compressedFrames; // 视频帧分片压缩，全局统计
+    uint64_t compressSkipped;
+    double compressRatio;      // 压缩前后的字节数之比
+    double compressMBps;       // 压缩吞吐(压缩前的字节数)
+    std::vector<MessageCompressStats> messageCompress;
+    int64_t zlibBytes; // 所有zlib上下文占用的内存
+    int64_t zlibPeak;
+    uint64_t zlibRefused;
+    double spareCpu;
+    int64_t probeMs; // 会话打开时探测的耗时
+    int64_t ttffMs;  // 打开到发送第一个视频帧的耗时，-1为还没有发送
+    bool fastOpen;
+    uint64_t accessUnits; // 裸流输入切分出的访问单元数
+
+    tagGetStatsResponse() {
+        cmd                 = "getStats";
+        decodeWakeups       = 0;
+        decodedFrames       = 0;
+        deadlineMisses      = 0;
+        ingestQueuedBytes   = 0;
+        ingestDroppedBytes  = 0;
+        ingestReceivedBytes = 0;
+        ingestCopiedBytes   = 0;
+        catchUps            = 0;
+        catchUpBytes        = 0;
+        framePoolAllocs     = 0;
+        framePoolGets       = 0;
+        codecPoolHits       = 0;
+        codecPoolMisses     = 0;
+        codecPoolWarmed     = 0;
+        codecPoolIdle       = 0;
+        codecPoolHitRate    = 0;
+        messagePoolHits     = 0;
+        messagePoolMisses   = 0;
+        messagePoolDropped  = 0;
+        messagePoolBytes    = 0;
+        videoDecodeUs       = 0;
+        videoPrepareUs      = 0;
+        videoPackUs         = 0;
+        videoScaleUs        = 0;
+        videoBytesPerFrame  = 0;
+        scaledFrames        = 0;
+        dropNonRef          = 0;
+        dropOverflow        = 0;
+        dropMailbox         = 0;
+        creditPauses        = 0;
+        credit              = 0;
+        qualityLevel        = 0;
+        qualitySwitches     = 0;
+        throughput          = 0;
+        parallelPacks       = 0;
+        packBands           = 0;
+        compressedFrames    = 0;
+        compressSkipped     = 0;
+        compressRatio       = 0;
+        compressMBps        = 0;
+        zlibBytes           = 0;
+        zlibPeak            = 0;
+        zlibRefused         = 0;
+        spareCpu            = 0;
+        probeMs             = 0;
+        ttffMs              = -1;
+        fastOpen            = false;
+        accessUnits         = 0;
+    }
+} GetStatsResponse;
+
+void to_json(json &j, const GetStatsResponse &p) {
+    to_json_base(j, p);
+
+    j["workers"]             = p.workers;
+    j["decodeWakeups"]       = p.decodeWakeups;
+    j["decodedFrames"]       = p.decodedFrames;
+    j["deadlineMisses"]      = p.deadlineMisses;
+    j["ingestQueuedBytes"]   = p.ingestQueuedBytes;
+    j["ingestDroppedBytes"]  = p.ingestDroppedBytes;
+    j["ingestReceivedBytes"] = p.ingestReceivedBytes;
+    j["ingestCopiedBytes"]   = p.ingestCopiedBytes;
+    j["catchUps"]            = p.catchUps;
+    j["catchUpBytes"]        = p.catchUpBytes;
+    j["framePoolAllocs"]     = p.framePoolAllocs;
+    j["framePoolGets"]       = p.framePoolGets;
+    j["codecPoolHits"]       = p.codecPoolHits;
+    j["codecPoolMisses"]     = p.codecPoolMisses;
+    j["codecPoolWarmed"]     = p.codecPoolWarmed;
+    j["codecPoolIdle"]       = p.codecPoolIdle;
+    j["codecPoolHitRate"]    = p.codecPoolHitRate;
+    j["messagePoolHits"]     = p.messagePoolHits;
+    j["messagePoolMisses"]   = p.messagePoolMisses;
+    j["messagePoolDropped"]  = p.messagePoolDropped;
+    j["messagePoolBytes"]    = p.messagePoolBytes;
+    j["videoDecodeUs"]       = p.videoDecodeUs;
+    j["videoPrepareUs"]      = p.videoPrepareUs;
+    j["videoPackUs"]         = p.videoPackUs;
+    j["videoScaleUs"]        = p.videoScaleUs;
+    j["videoBytesPerFrame"]  = p.videoBytesPerFrame;
+    j["scaledFrames"]        = p.scaledFrames;
+    j["dropNonRef"]          = p.dropNonRef;
+    j["dropOverflow"]        = p.dropOverflow;
+    j["dropMailbox"]         = p.dropMailbox;
+    j["creditPauses"]        = p.creditPauses;
+    j["credit"]              = p.credit;
+    j["qualityLevel"]        = p.qualityLevel;
+    j["qualitySwitches"]     = p.qualitySwitches;
+    j["throughput"]          = p.throughput;
+    j["parallelPacks"]       = p.parallelPacks;
+    j["packBands"]           = p.packBands;
+    j["compressedFrames"]    = p.compressedFrames;
+    j["compressSkipped"]     = p.compressSkipped;
+    j["compressRatio"]       = p.compressRatio;
+    j["compressMBps"]        = p.compressMBps;
+    j["messageCompress"]     = p.messageCompress;
+    j["zlibBytes"]           = p.zlibBytes;
+    j["zlibPeak"]            = p.zlibPeak;
+    j["zlibRefused"]         = p.zlibRefused;
+    j["spareCpu"]            = p.spareCpu;
+    j["probeMs"]             = p.probeMs;
+    j["ttffMs"]              = p.ttffMs;
+    j["fastOpen"]            = p.fastOpen;
+    j["accessUnits"]         = p.accessUnits;
+}
+
 } // namespace decoder
\ No newline at end of file
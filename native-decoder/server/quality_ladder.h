@@ -0,0 +1,142 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+
+namespace decoder {
+
+/*
+ * 弱网下的自适应输出档位，每个会话一个，只在解码线程中调用(统计可以在其他线程读取)
+ * 按固定间隔统计交给websocket的字节数和连接发送缓冲区的变化:
+ *   排空速率 = 间隔内发送的字节数 - 发送缓冲区的增长，即连接实际的吞吐
+ *   发送缓冲区持续增长超过几帧的大小、或者间隔内有流控丢帧/暂停时视为拥塞
+ * 拥塞时立即降一档；连续若干个间隔没有积压才升一档，升档后很快又拥塞时加倍升档前需要的间隔数(迟滞)
+ * 档位: 原始尺寸 -> 1/2 -> 1/4 -> 1/4只有Y平面，缩放在客户端显示尺寸的基础上进行
+ */
+class QualityLadder {
+public:
+    typedef enum Level {
+        kLevel_Full = 0,
+        kLevel_Half,
+        kLevel_Quarter,
+        kLevel_QuarterLuma, // 只发送Y平面，只有I420输出的客户端使用
+        kLevel_Count,
+    } Level;
+
+    const int64_t kIntervalUs       = 1000 * 1000;
+    const int32_t kCongestedFrames  = 2;  // 发送缓冲区超过几帧的大小并且在增长时视为拥塞
+    const int32_t kMinUpIntervals   = 5;  // 升档前需要连续没有积压的间隔数
+    const int32_t kMaxUpIntervals   = 60;
+    const int32_t kRetreatIntervals = 10; // 升档后这么多个间隔内又拥塞，说明升档过早
+
+    // enabled为false时一直是原始档位；lowest为允许的最低档位
+    void reset(bool enabled, Level lowest) {
+        enabled_     = enabled;
+        lowest_      = lowest;
+        level_       = kLevel_Full;
+        upIntervals_ = kMinUpIntervals;
+        clean_       = 0;
+        intervals_   = 0;
+        lastUp_      = -1;
+        begin_       = 0;
+    }
+
+    Level level() const { return level_; }
+
+    static int32_t divisor(Level level) { return level == kLevel_Full ? 1 : (level == kLevel_Half ? 2 : 4); }
+
+    static bool lumaOnly(Level level) { return level == kLevel_QuarterLuma; }
+
+    /*
+     * 每处理完一帧视频调用一次，返回下一帧使用的档位
+     * sentBytes为这一帧交给websocket的字节数(丢弃/保留时为0)，buffered为连接发送缓冲区中的字节数
+     * congestion为流控累计的丢帧和暂停次数
+     */
+    Level onFrame(int64_t nowUs, size_t sentBytes, size_t buffered, uint64_t congestion) {
+        if (!enabled_) {
+            return level_;
+        }
+        if (begin_ == 0) {
+            startInterval(nowUs, buffered, congestion);
+        }
+        sent_ += sentBytes;
+        frames_ += sentBytes > 0 ? 1 : 0;
+        if (nowUs - begin_ >= kIntervalUs) {
+            evaluate(nowUs, buffered, congestion);
+            startInterval(nowUs, buffered, congestion);
+        }
+        return level_;
+    }
+
+    uint64_t getSwitches() const { return switches_; }
+
+    // 最近一个间隔的排空速率，字节/秒
+    double getThroughput() const { return throughput_; }
+
+private:
+    void startInterval(int64_t nowUs, size_t buffered, uint64_t congestion) {
+        begin_      = nowUs;
+        buffered_   = buffered;
+        congestion_ = congestion;
+        sent_       = 0;
+        frames_     = 0;
+    }
+
+    void evaluate(int64_t nowUs, size_t buffered, uint64_t congestion) {
+        int64_t growth   = (int64_t)buffered - (int64_t)buffered_;
+        size_t frameSize = frames_ > 0 ? sent_ / frames_ : 0;
+        throughput_      = std::max<double>(0, (double)((int64_t)sent_ - growth) * 1000000 / (nowUs - begin_));
+        intervals_++;
+
+        bool congested = congestion > congestion_ || (growth > 0 && buffered > frameSize * kCongestedFrames);
+        if (congested) {
+            clean_ = 0;
+            if (level_ < lowest_) {
+                // 升档后很快又拥塞，下次升档前等待更久
+                if (lastUp_ >= 0 && intervals_ - lastUp_ <= kRetreatIntervals) {
+                    upIntervals_ = std::min(upIntervals_ * 2, kMaxUpIntervals);
+                }
+                switchTo((Level)(level_ + 1));
+            }
+            return;
+        }
+
+        if (buffered > frameSize) {
+            clean_ = 0;
+            return;
+        }
+        if (++clean_ >= upIntervals_ && level_ > kLevel_Full) {
+            // 上次升档后一直稳定，恢复最短的升档等待
+            if (lastUp_ >= 0 && intervals_ - lastUp_ > kMaxUpIntervals) {
+                upIntervals_ = kMinUpIntervals;
+            }
+            switchTo((Level)(level_ - 1));
+            lastUp_ = intervals_;
+            clean_  = 0;
+        }
+    }
+
+    void switchTo(Level level) {
+        level_ = level;
+        switches_++;
+    }
+
+private:
+    bool enabled_ = false;
+    Level lowest_ = kLevel_Quarter;
+    std::atomic<Level> level_{kLevel_Full};
+    int32_t upIntervals_ = kMinUpIntervals;
+    int32_t clean_       = 0;  // 连续没有积压的间隔数
+    int64_t intervals_   = 0;
+    int64_t lastUp_      = -1; // 上次升档时的间隔序号
+    int64_t begin_       = 0;
+    size_t buffered_     = 0;
+    uint64_t congestion_ = 0;
+    size_t sent_         = 0;
+    uint64_t frames_     = 0;
+    std::atomic<uint64_t> switches_{0};
+    std::atomic<double> throughput_{0};
+};
+
+} // namespace decoder
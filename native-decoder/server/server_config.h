@@ -1,16 +1,61 @@
 #include <websocketpp/config/asio_no_tls.hpp>
 #include <websocketpp/server.hpp>
 
-#include <websocketpp/extensions/permessage_deflate/enabled.hpp>
+#include "server/message_pool.h"
+#include "server/permessage_deflate.h"
+
+namespace decoder {
+
+/// Connection message manager, payload buffers are taken from and returned to MessagePool
+/// websocketpp never calls recycle(), the payload is returned by the message_ptr deleter instead
+template <typename message> class PooledConMsgManager : public std::enable_shared_from_this<PooledConMsgManager<message>> {
+public:
+    typedef PooledConMsgManager<message> type;
+    typedef std::shared_ptr<type> ptr;
+    typedef std::weak_ptr<type> weak_ptr;
+    typedef typename message::ptr message_ptr;
+
+    message_ptr get_message() { return get_message(websocketpp::frame::opcode::text, 0); }
+
+    message_ptr get_message(websocketpp::frame::opcode::value op, size_t size) {
+        message *msg = new message(this->shared_from_this(), op, 0);
+        msg->get_raw_payload() = MessagePool::INSTANCE().acquire(size);
+        return message_ptr(msg, [](message *m) {
+            MessagePool::INSTANCE().release(std::move(m->get_raw_payload()));
+            delete m;
+        });
+    }
+
+    bool recycle(message *) { return false; }
+};
+
+/// Endpoint message manager, creates a PooledConMsgManager per connection
+template <typename con_msg_manager> class PooledEndpointMsgManager {
+public:
+    typedef PooledEndpointMsgManager<con_msg_manager> type;
+    typedef typename con_msg_manager::ptr con_msg_man_ptr;
+
+    con_msg_man_ptr get_manager() const { return std::make_shared<con_msg_manager>(); }
+};
+
+} // namespace decoder
 
 namespace websocketpp {
 namespace config {
 
 /// Server config with asio transport and TLS disabled
 struct ServerConfig : public websocketpp::config::asio {
+    /// permessage-deflate only negotiates and inflates, outgoing messages are compressed per message by decoder::MessageCompressor
     static const bool autonegotiate_compression = true;
-    typedef websocketpp::extensions::permessage_deflate::enabled<permessage_deflate_config> permessage_deflate_type;
+    typedef decoder::BoundedPermessageDeflate<permessage_deflate_config> permessage_deflate_type;
+    static const size_t zlib_ceiling = 64 * 1024 * 1024;
     static const int iothrnum = 4;
+
+    /// Message payload buffers are pooled, idle buffers are capped at message_pool_ceiling bytes
+    typedef websocketpp::message_buffer::message<decoder::PooledConMsgManager> message_type;
+    typedef decoder::PooledConMsgManager<message_type> con_msg_manager_type;
+    typedef decoder::PooledEndpointMsgManager<con_msg_manager_type> endpoint_msg_manager_type;
+    static const size_t message_pool_ceiling = 256 * 1024 * 1024;
 };
 } // namespace config
 } // namespace websocketpp
\ No newline at end of file
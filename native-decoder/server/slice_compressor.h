@@ -0,0 +1,222 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <zlib.h>
+
+#include "common/helper/singleton.h"
+#include "common/helper/work_stealing_pool.h"
+#include "server/frame_header.h"
+#include "server/frame_payload.h"
+#include "server/parallel_packer.h"
+#include "server/zlib_budget.h"
+
+namespace decoder {
+
+/*
+ * 视频帧的分片压缩，预先准备好的websocket消息不经过permessage-deflate，视频帧在这里压缩
+ * 打包后的帧数据按固定大小切成分片，每个分片是独立的zlib流，在解码共用的线程池上并行压缩，客户端也可以并行解压
+ * 帧头部不压缩，标志中带FrameHeader::kFlag_Compressed，头部之后的布局(小端):
+ *   0  uint32      分片数n
+ *   4  uint32      解压后的总字节数
+ *   8  uint32[2n]  每个分片解压后和压缩后的字节数
+ *   之后依次是n个分片的zlib数据
+ * 旧版本头部、或者压缩后没有变小(噪声大的画面)时原样发送，不带压缩标志
+ */
+class SliceCompressor {
+public:
+    const size_t kSliceBytes       = 256 * 1024; // 1080p 4:2:0约12个分片
+    const size_t kParallelMinBytes = 512 * 1024;
+    const int32_t kMaxLevel        = 9;
+
+    typedef struct tagStats {
+        uint64_t frames;          // 压缩发送的帧数
+        uint64_t skipped;         // 压缩后没有变小、原样发送的帧数
+        uint64_t rawBytes;        // 压缩前的数据字节数
+        uint64_t compressedBytes; // 压缩后的数据字节数(含分片表)
+        uint64_t compressUs;
+    } Stats;
+
+    static SliceCompressor &INSTANCE() { return common::Singleton<SliceCompressor>::getInstance(); }
+
+    // 打包payload并追加到out的末尾，level为zlib压缩级别(1-9)，0不压缩，返回是否压缩
+    bool appendTo(const FramePayload &payload, std::string &out, int32_t level) {
+        std::string &raw = scratch();
+        raw.clear();
+        ParallelPacker::INSTANCE().appendTo(payload, raw);
+
+        size_t headerSize = payload.header().size();
+        size_t dataSize   = raw.size() - headerSize;
+        if (level <= 0 || dataSize == 0 || !FrameHeader::isBinary(raw.data(), headerSize)) {
+            out.append(raw);
+            return false;
+        }
+
+        int64_t begin = common::WorkStealingPool::nowUs();
+        auto job      = std::make_shared<Job>();
+        job->level    = std::min(level, kMaxLevel);
+
+        // 每个分片先压缩到各自最大长度的位置，全部完成后再紧凑排列
+        size_t count     = (dataSize + kSliceBytes - 1) / kSliceBytes;
+        size_t tableSize = 8 + 8 * count;
+        size_t base      = out.size();
+        size_t offset    = base + headerSize + tableSize;
+        for (size_t i = 0; i < count; i++) {
+            size_t srcBytes = std::min(kSliceBytes, dataSize - i * kSliceBytes);
+            size_t bound    = compressBound(srcBytes);
+            job->slices.push_back(Slice{(const uint8_t *)raw.data() + headerSize + i * kSliceBytes, srcBytes, offset, bound, 0});
+            offset += bound;
+        }
+        out.resize(offset);
+        job->out = (uint8_t *)&out[0];
+
+        auto &pool      = executor();
+        int32_t helpers = dataSize < kParallelMinBytes ? 0 : std::min<int32_t>(pool.size() - 1, (int32_t)count - 1);
+        for (int32_t i = 0; i < helpers; i++) {
+            pool.submit([job]() { job->run(); }, 0);
+        }
+        job->run();
+        job->wait();
+
+        uint8_t *dst   = (uint8_t *)&out[0];
+        uint8_t *table = dst + base + headerSize;
+        size_t pos     = base + headerSize + tableSize;
+        bool ok        = true;
+        FrameHeader::put32(table, (uint32_t)count);
+        FrameHeader::put32(table + 4, (uint32_t)dataSize);
+        for (size_t i = 0; i < count; i++) {
+            auto &s = job->slices[i];
+            ok      = ok && s.dstBytes > 0;
+            memmove(dst + pos, dst + s.dstOffset, s.dstBytes);
+            FrameHeader::put32(table + 8 + 8 * i, (uint32_t)s.srcBytes);
+            FrameHeader::put32(table + 12 + 8 * i, (uint32_t)s.dstBytes);
+            pos += s.dstBytes;
+        }
+
+        size_t compressed = pos - base - headerSize;
+        compressUs_ += common::WorkStealingPool::nowUs() - begin;
+        if (!ok || compressed >= dataSize) {
+            out.resize(base);
+            out.append(raw);
+            skipped_++;
+            return false;
+        }
+
+        out.resize(pos);
+        memcpy(dst + base, raw.data(), headerSize);
+        FrameHeader::addFlags(dst + base, headerSize, FrameHeader::kFlag_Compressed);
+        frames_++;
+        rawBytes_ += dataSize;
+        compressedBytes_ += compressed;
+        return true;
+    }
+
+    Stats getStats() const { return Stats{frames_, skipped_, rawBytes_, compressedBytes_, compressUs_}; }
+
+private:
+    struct Slice {
+        const uint8_t *src;
+        size_t srcBytes;
+        size_t dstOffset; // 在out中的位置
+        size_t dstBound;
+        size_t dstBytes;  // 压缩后的字节数，失败为0
+    };
+
+    // 每个线程一个zlib上下文，分片之间deflateReset复用，级别变化时重建
+    class Deflater {
+    public:
+        ~Deflater() {
+            if (inited_) {
+                deflateEnd(&stream_);
+            }
+        }
+
+        // 返回压缩后的字节数，失败返回0
+        size_t compress(const uint8_t *src, size_t srcBytes, uint8_t *dst, size_t dstBytes, int32_t level) {
+            if (inited_ && level != level_) {
+                deflateEnd(&stream_);
+                inited_ = false;
+            }
+            if (!inited_) {
+                memset(&stream_, 0, sizeof(stream_));
+                ZlibBudget::INSTANCE().bind(stream_, false);
+                if (deflateInit(&stream_, level) != Z_OK) {
+                    return 0;
+                }
+                inited_ = true;
+                level_  = level;
+            } else if (deflateReset(&stream_) != Z_OK) {
+                return 0;
+            }
+
+            stream_.next_in   = (Bytef *)src;
+            stream_.avail_in  = (uInt)srcBytes;
+            stream_.next_out  = (Bytef *)dst;
+            stream_.avail_out = (uInt)dstBytes;
+            return deflate(&stream_, Z_FINISH) == Z_STREAM_END ? stream_.total_out : 0;
+        }
+
+    private:
+        z_stream stream_;
+        bool inited_   = false;
+        int32_t level_ = 0;
+    };
+
+    struct Job {
+        std::vector<Slice> slices;
+        uint8_t *out  = nullptr;
+        int32_t level = Z_BEST_SPEED;
+        std::atomic<size_t> next{0};
+        std::atomic<size_t> done{0};
+        std::mutex mutex;
+        std::condition_variable cond;
+
+        // 领取并压缩剩余的分片，没有剩余时立即返回
+        void run() {
+            size_t i = 0;
+            while ((i = next++) < slices.size()) {
+                Slice &s   = slices[i];
+                s.dstBytes = deflater().compress(s.src, s.srcBytes, out + s.dstOffset, s.dstBound, level);
+                if (++done == slices.size()) {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    cond.notify_all();
+                }
+            }
+        }
+
+        void wait() {
+            std::unique_lock<std::mutex> lock(mutex);
+            cond.wait(lock, [this]() { return done == slices.size(); });
+        }
+    };
+
+    static Deflater &deflater() {
+        thread_local Deflater deflater;
+        return deflater;
+    }
+
+    // 打包后待压缩的帧，每个发送线程一个，容量保留到下一帧
+    static std::string &scratch() {
+        thread_local std::string raw;
+        return raw;
+    }
+
+    // 和解码任务共用同一个线程池
+    static common::WorkStealingPool &executor() { return common::Singleton<common::WorkStealingPool>::getInstance(); }
+
+private:
+    std::atomic<uint64_t> frames_{0};
+    std::atomic<uint64_t> skipped_{0};
+    std::atomic<uint64_t> rawBytes_{0};
+    std::atomic<uint64_t> compressedBytes_{0};
+    std::atomic<uint64_t> compressUs_{0};
+};
+
+} // namespace decoder
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+
+#include <zlib.h>
+
+#include "common/helper/singleton.h"
+
+namespace decoder {
+
+/*
+ * 整个进程的zlib内存上限，所有deflate/inflate上下文通过这里分配并计数
+ * 可选的分配(连接保留的压缩上下文)超过上限时失败，调用方退回到不保留上下文的压缩
+ * 必需的分配(解压、线程的临时压缩上下文)只计数不拒绝，线程数和连接数决定了它们的上限
+ */
+class ZlibBudget {
+public:
+    const size_t kDefaultCeiling = 64 * 1024 * 1024;
+
+    typedef struct tagStats {
+        int64_t bytes;    // 当前分配的字节数
+        int64_t peak;     // 分配过的最大字节数
+        uint64_t refused; // 超过上限被拒绝的可选分配次数
+    } Stats;
+
+    static ZlibBudget &INSTANCE() { return common::Singleton<ZlibBudget>::getInstance(); }
+
+    void setCeiling(size_t ceiling) { ceiling_ = ceiling; }
+
+    // 在deflateInit/inflateInit之前调用，optional为true时超过上限的分配失败
+    void bind(z_stream &stream, bool optional) {
+        stream.zalloc = &ZlibBudget::alloc;
+        stream.zfree  = &ZlibBudget::free;
+        stream.opaque = optional ? (voidpf)&kOptional : (voidpf)&kRequired;
+    }
+
+    Stats getStats() const { return Stats{bytes_, peak_, refused_}; }
+
+private:
+    static constexpr int32_t kOptional = 1;
+    static constexpr int32_t kRequired = 0;
+
+    // 分配的大小记在块的头部，释放时扣除
+    // 先计入再检查上限，可选的分配超过上限时撤回，并发的分配不会同时通过检查而一起越过上限
+    static voidpf alloc(voidpf opaque, uInt items, uInt size) {
+        auto &budget  = INSTANCE();
+        size_t bytes  = (size_t)items * size + sizeof(std::max_align_t);
+        int64_t total = budget.bytes_ += (int64_t)bytes;
+        if (*(const int32_t *)opaque == kOptional && total > (int64_t)budget.ceiling_) {
+            budget.bytes_ -= (int64_t)bytes;
+            budget.refused_++;
+            return Z_NULL;
+        }
+        uint8_t *block = (uint8_t *)malloc(bytes);
+        if (block == nullptr) {
+            budget.bytes_ -= (int64_t)bytes;
+            return Z_NULL;
+        }
+        *(size_t *)block = bytes;
+        int64_t peak     = budget.peak_;
+        while (total > peak && !budget.peak_.compare_exchange_weak(peak, total)) {
+        }
+        return block + sizeof(std::max_align_t);
+    }
+
+    static void free(voidpf /*opaque*/, voidpf address) {
+        uint8_t *block = (uint8_t *)address - sizeof(std::max_align_t);
+        INSTANCE().bytes_ -= *(size_t *)block;
+        ::free(block);
+    }
+
+private:
+    std::atomic<size_t> ceiling_{kDefaultCeiling};
+    std::atomic<int64_t> bytes_{0};
+    std::atomic<int64_t> peak_{0};
+    std::atomic<uint64_t> refused_{0};
+};
+
+} // namespace decoder
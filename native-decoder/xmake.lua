@@ -24,4 +24,18 @@ add_links("avformat", "avcodec", "avutil", "swscale", "swresample", "x264", "x26
 target("native-decoder")
 	set_kind("binary")
     add_files("cmd/*.cc")
-    
\ No newline at end of file
+    
+target("thread-budget-bench")
+    set_kind("binary")
+    set_default(false)
+    add_files("benchmark/thread_budget_bench.cc")
+
+target("pack-bench")
+    set_kind("binary")
+    set_default(false)
+    add_files("benchmark/pack_bench.cc")
+
+target("compress-bench")
+    set_kind("binary")
+    set_default(false)
+    add_files("benchmark/compress_bench.cc")
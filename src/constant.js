@@ -35,6 +35,9 @@ export const kStartDecodingReq = 5
 export const kPauseDecodingReq = 6
 export const kSeekToReq = 7
 export const KDiscardDataReq = 8
+export const kUpdateClockReq = 9
+export const kSetOutputSizeReq = 10
+export const kGrantCreditReq = 11
 
 // Decoder response.
 export const kInitDecoderRsp = 0
@@ -19,13 +19,22 @@ class BaseRequest {
 
 /// ----------------------------------------------------------------------------
 class InitDecoderRequest extends BaseRequest {
-  constructor(fileSize, waitHeaderLength) {
+  constructor(fileSize, waitHeaderLength, codec, extradata, fastOpen, ingestMode) {
     super('initDecoder')
     this.fileSize = fileSize
     this.waitHeaderLength = waitHeaderLength
+    this.codec = codec
+    this.extradata = extradata
+    this.fastOpen = fastOpen
+    this.ingestMode = ingestMode
   }
 }
 
+// How a live stream is fed to the server, must match FFmpegWrapper::IngestMode in native-decoder
+const kIngestDemux = 0
+const kIngestAnnexB = 1
+const kIngestAccessUnit = 2
+
 /// ----------------------------------------------------------------------------
 class UninitDecoderRequest extends BaseRequest {
   constructor(fileSize) {
@@ -36,13 +45,46 @@ class UninitDecoderRequest extends BaseRequest {
 
 /// ----------------------------------------------------------------------------
 class OpenDecoderRequest extends BaseRequest {
-  constructor(hasVideo, hasAudio) {
+  constructor(hasVideo, hasAudio, headerVersion, outputWidth, outputHeight, outputFormats, creditWindow, dropPolicy, adaptiveQuality, compressLevel,
+    openTimeoutMs) {
     super('openDecoder')
     this.hasVideo = hasVideo
     this.hasAudio = hasAudio
+    this.headerVersion = headerVersion
+    this.outputWidth = outputWidth
+    this.outputHeight = outputHeight
+    this.outputFormats = outputFormats
+    this.creditWindow = creditWindow
+    this.dropPolicy = dropPolicy
+    this.adaptiveQuality = adaptiveQuality
+    this.compressLevel = compressLevel
+    this.openTimeoutMs = openTimeoutMs
+  }
+}
+
+/// ----------------------------------------------------------------------------
+// initDecoder, openDecoder and startDecode in one message, the server answers once like openDecoder
+class OpenSessionRequest extends BaseRequest {
+  constructor(init, open, start) {
+    super('openSession')
+    // the server reads the init and open fields from the same message
+    Object.assign(this, init, open)
+    this.cmd = 'openSession'
+    this.start = start
   }
 }
 
+/// ----------------------------------------------------------------------------
+// Frame header versions, must match FrameHeader::Version in native-decoder
+const kHeaderVersionLegacy = 0
+const kHeaderVersionBinary = 1
+
+// Frame header flags, must match FrameHeader in native-decoder
+const kFlagKeyframe = 0x1
+const kFlagRenditionChanged = 0x2
+const kFlagCompressed = 0x4
+const kRenditionShift = 8
+
 /// ----------------------------------------------------------------------------
 class CloseDecoderRequest extends BaseRequest {
   constructor() {
@@ -64,6 +106,37 @@ class StopDecodeRequest extends BaseRequest {
   }
 }
 
+/// ----------------------------------------------------------------------------
+class UpdateClockRequest extends BaseRequest {
+  constructor(position) {
+    super('updateClock')
+    this.position = position
+  }
+}
+
+/// ----------------------------------------------------------------------------
+class SetOutputSizeRequest extends BaseRequest {
+  constructor(width, height) {
+    super('setOutputSize')
+    this.width = width
+    this.height = height
+  }
+}
+
+/// ----------------------------------------------------------------------------
+class GrantCreditRequest extends BaseRequest {
+  constructor(frames) {
+    super('grantCredit')
+    this.frames = frames
+  }
+}
+
+/// ----------------------------------------------------------------------------
+// What the server does with video frames when credit runs out, must match OutputCredit::Policy in native-decoder
+const kDropPolicyNonRef = 0
+const kDropPolicyMailbox = 1
+const kDropPolicyPause = 2
+
 /// ----------------------------------------------------------------------------
 class RequestDataRequest extends BaseRequest {
   constructor(offset, available) {
@@ -74,6 +147,32 @@ class RequestDataRequest extends BaseRequest {
 }
 
 /// ----------------------------------------------------------------------------
+// Sliced video compression, see SliceCompressor in native-decoder. Every slice is an
+// independent zlib stream, all of them are inflated concurrently into one buffer.
+function inflateSlices(data) {
+  const view = new DataView(data.buffer, data.byteOffset, data.byteLength)
+  const count = view.getUint32(0, true)
+  const out = new Uint8Array(view.getUint32(4, true))
+  const jobs = []
+  let src = 8 + count * 8
+  let dst = 0
+  for (let i = 0; i < count; i++) {
+    const rawBytes = view.getUint32(8 + i * 8, true)
+    const zipBytes = view.getUint32(12 + i * 8, true)
+    jobs.push(inflateSlice(data.subarray(src, src + zipBytes), out, dst))
+    src += zipBytes
+    dst += rawBytes
+  }
+  return Promise.all(jobs).then(() => out)
+}
+
+function inflateSlice(slice, out, offset) {
+  const stream = new Blob([slice]).stream().pipeThrough(new DecompressionStream('deflate'))
+  return new Response(stream).arrayBuffer().then((buffer) => {
+    out.set(new Uint8Array(buffer), offset)
+  })
+}
+
 class DecoderStub {
   constructor() {
     this.logger = new Logger('FFmpeg')
@@ -93,18 +192,52 @@ class DecoderStub {
     this.onSeekToSucceed = null
     this.onSeekToFailed = null
 
+    // negotiated in openDecoder
+    this.headerVersion = kHeaderVersionLegacy
+
+    // frames are scaled down to fit the viewport on the server, 0 keeps the original size
+    this.outputWidth = 0
+    this.outputHeight = 0
+
+    // preferred video output formats (I420, NV12, RGBA, Y), the server picks the first one it supports
+    this.outputFormats = ['I420']
+    this.outputFormat = 'I420'
+
+    // video frames the server may send before the player grants more, 0 falls back to the server's send buffer
+    this.creditWindow = 32
+    this.dropPolicy = kDropPolicyPause
+
+    // let the server step the output down (1/2, 1/4, luma only) when the connection is congested
+    this.adaptiveQuality = false
+
+    // zlib level for the server's sliced video compression, 0 sends frames uncompressed, needs DecompressionStream
+    this.compressLevel = 0
+    this.videoChain = Promise.resolve()
+    this.pendingInflates = 0
+
+    // the server probes the stream off its io threads and answers openDecoder when done, 0 uses the server default
+    this.openTimeoutMs = 0
+
+    // live Annex-B streams open from their parameter sets instead of a full probe,
+    // codec (h264/hevc) and base64 parameter sets may be given when the stream is known in advance
+    this.fastOpen = true
+    this.codec = ''
+    this.extradata = ''
+
+    // raw H.264/H.265 sources skip the server's demuxer: kIngestAnnexB for a byte stream,
+    // kIngestAccessUnit when every sendData() carries exactly one access unit
+    this.ingestMode = kIngestDemux
+
     // logger
     this.logger.logInfo('Init ffmpeg decoder')
 
     // websocket
     this.ws = new ReconnectingWebSocket('ws://localhost:9002/decode')
     this.ws.binaryType = 'arraybuffer'
-    this.websocketOpened = false
 
     const self = this
     this.ws.onopen = function() {
-      self.logger.logInfo('open websocket, start to init decoder')
-      self.websocketOpened = true
+      self.logger.logInfo('open websocket')
     }
     this.ws.onclose = function(e) {
       self.logger.logInfo('close')
@@ -124,15 +257,11 @@ class DecoderStub {
   initDecoder(fileSize, waitHeaderLength, onInitDecoderSucceed, onInitDecoderFailed) {
     this.onInitDecoderSucceed = onInitDecoderSucceed
     this.onInitDecoderFailed = onInitDecoderFailed
+    this.sendCommand(this.newInitDecoderRequest(fileSize, waitHeaderLength))
+  }
 
-    let count = 5
-    while ((count--) > 0) {
-      if (this.websocketOpened) {
-        this.sendCommand(new InitDecoderRequest(fileSize, waitHeaderLength))
-        break
-      }
-      this.sleep(100)
-    }
+  newInitDecoderRequest(fileSize, waitHeaderLength) {
+    return new InitDecoderRequest(fileSize, waitHeaderLength, this.codec, this.extradata, this.fastOpen, this.ingestMode)
   }
 
   onTextMessage(msg) {
@@ -153,8 +282,12 @@ class DecoderStub {
         }
         break
       }
-      case 'openDecoder': {
+      case 'openDecoder':
+      case 'openSession': {
         if (data.code === 0) {
+          this.headerVersion = data.headerVersion || kHeaderVersionLegacy
+          this.outputFormat = data.outputFormat || 'I420'
+          this.logger.logInfo(`Decoder opened, probe ${data.probeMs || 0}ms${data.fastOpen ? ' (fast open)' : ''}`)
           if (this.onOpenDecoderSucceed != null) {
             this.onOpenDecoderSucceed(data)
           }
@@ -202,6 +335,11 @@ class DecoderStub {
   }
 
   onBinaryMessage(arrayBuffer) {
+    if (this.headerVersion >= kHeaderVersionBinary) {
+      this.onBinaryFrame(arrayBuffer)
+      return
+    }
+
     const flagLen = 1
     const timestampLen = 16
 
@@ -216,6 +354,53 @@ class DecoderStub {
     }
   }
 
+  onBinaryFrame(arrayBuffer) {
+    // layout: see FrameHeader in native-decoder/server/frame_header.h, little endian
+    const view = new DataView(arrayBuffer)
+    const flag = view.getUint8(0)
+    const headerSize = view.getUint16(2, true)
+    const pts = Number(view.getBigInt64(8, true))
+    const timeBaseNum = view.getInt32(16, true)
+    const timeBaseDen = view.getInt32(20, true)
+    const timestamp = timeBaseDen !== 0 ? pts * timeBaseNum / timeBaseDen : 0
+    const flags = view.getUint32(40, true)
+    const info = {
+      seq: view.getUint32(4, true),
+      pts: pts,
+      decodeUs: Number(view.getBigInt64(24, true)),
+      sendUs: Number(view.getBigInt64(32, true)),
+      recvUs: Date.now() * 1000,
+      keyframe: (flags & kFlagKeyframe) !== 0,
+      // adaptive quality level (0 full, 1 half, 2 quarter, 3 quarter luma only), see QualityLadder::Level
+      rendition: (flags >> kRenditionShift) & 0xff,
+      renditionChanged: (flags & kFlagRenditionChanged) !== 0,
+      format: view.getInt32(44, true)
+    }
+    const dataArray = new Uint8Array(arrayBuffer, headerSize)
+
+    if (flag === 0 && this.onVideo !== null) {
+      info.width = view.getInt32(48, true)
+      info.height = view.getInt32(52, true)
+      info.strides = [view.getInt32(56, true), view.getInt32(60, true), view.getInt32(64, true)]
+      if ((flags & kFlagCompressed) === 0 && this.pendingInflates === 0) {
+        this.onVideo(dataArray, timestamp, info)
+        return
+      }
+      // frames are inflated asynchronously, chain them so they are delivered in order
+      this.pendingInflates++
+      this.videoChain = this.videoChain
+        .then(() => ((flags & kFlagCompressed) !== 0 ? inflateSlices(dataArray) : dataArray))
+        .then((data) => this.onVideo(data, timestamp, info))
+        .catch((e) => this.logger.logError('Inflate video frame failed, ' + e))
+        .then(() => { this.pendingInflates-- })
+    } else if (flag === 1 && this.onAudio != null) {
+      info.sampleRate = view.getInt32(48, true)
+      info.channels = view.getInt32(52, true)
+      info.samples = view.getInt32(56, true)
+      this.onAudio(dataArray, timestamp, info)
+    }
+  }
+
   uninitDecoder() {
     this.sendCommand(new UninitDecoderRequest())
   }
@@ -227,7 +412,27 @@ class DecoderStub {
     this.onAudio = onAudio
     this.onRequestData = onRequestData
 
-    this.sendCommand(new OpenDecoderRequest(hasVideo, hasAudio))
+    this.sendCommand(this.newOpenDecoderRequest(hasVideo, hasAudio))
+  }
+
+  newOpenDecoderRequest(hasVideo, hasAudio) {
+    return new OpenDecoderRequest(hasVideo, hasAudio, kHeaderVersionBinary, this.outputWidth, this.outputHeight,
+      this.outputFormats, this.creditWindow, this.dropPolicy, this.adaptiveQuality,
+      typeof DecompressionStream !== 'undefined' ? this.compressLevel : 0, this.openTimeoutMs)
+  }
+
+  // init, open and (when start is true) start decoding in a single round trip, the first media bytes may be
+  // passed to sendData() right away, the server buffers them while it opens and replies through onOpenDecoderSucceed
+  openSession(fileSize, waitHeaderLength, hasVideo, hasAudio, start, onOpenDecoderSucceed, onOpenDecoderFailed, onVideo, onAudio,
+    onRequestData) {
+    this.onOpenDecoderSucceed = onOpenDecoderSucceed
+    this.onOpenDecoderFailed = onOpenDecoderFailed
+    this.onVideo = onVideo
+    this.onAudio = onAudio
+    this.onRequestData = onRequestData
+
+    this.sendCommand(new OpenSessionRequest(this.newInitDecoderRequest(fileSize, waitHeaderLength),
+      this.newOpenDecoderRequest(hasVideo, hasAudio), start))
   }
 
   closeDecoder() {
@@ -254,11 +459,26 @@ class DecoderStub {
     this.sendCommand(new DiscardDataRequest())
   }
 
+  updateClock(position) {
+    this.sendCommand(new UpdateClockRequest(position))
+  }
+
+  grantCredit(frames) {
+    this.sendCommand(new GrantCreditRequest(frames))
+  }
+
+  setOutputSize(width, height) {
+    this.outputWidth = width
+    this.outputHeight = height
+    this.sendCommand(new SetOutputSizeRequest(width, height))
+  }
+
   seekTo(onSeekToSucceed, onSeekToFailed) {
     this.onSeekToSucceed = onSeekToSucceed
     this.onSeekToFailed = onSeekToFailed
   }
 
+  // messages sent before the websocket is open are queued by ReconnectingWebSocket and flushed in order
   sendCommand(cmdObj) {
     this.ws.send(JSON.stringify(cmdObj))
   }
@@ -266,13 +486,6 @@ class DecoderStub {
   sendBinary(buffer) {
     this.ws.send(new Uint8Array(buffer).buffer)
   }
-
-  sleep(time) {
-    const startTime = new Date().getTime() + parseInt(time, 10)
-    while (new Date().getTime() < startTime) {
-      // --
-    }
-  };
 }
 
 export default DecoderStub
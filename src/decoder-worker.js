@@ -6,7 +6,7 @@ import {
   kAudioFrame, kVideoFrame, kSeekToRsp, kDecodeFinishedEvt,
   kInitDecoderReq, kUninitDecoderReq, kOpenDecoderReq, kCloseDecoderReq,
   kStartDecodingReq, kPauseDecodingReq, kFeedDataReq, kSeekToReq,
-  kOpenDecoderRsp
+  kOpenDecoderRsp, kUpdateClockReq, kSetOutputSizeReq, kGrantCreditReq
 } from './constant'
 
 class Decoder {
@@ -77,19 +77,21 @@ class Decoder {
         }
         self.postMessage(objData)
       },
-      (data, timestamp) => {
+      (data, timestamp, info) => {
         const objData = {
           t: kVideoFrame,
           s: timestamp,
-          d: data
+          d: data,
+          i: info
         }
         self.postMessage(objData, [objData.d.buffer])
       },
-      (data, timestamp) => {
+      (data, timestamp, info) => {
         const objData = {
           t: kAudioFrame,
           s: timestamp,
-          d: data
+          d: data,
+          i: info
         }
         self.postMessage(objData, [objData.d.buffer])
       },
@@ -157,6 +159,18 @@ class Decoder {
     this.ffmpegStub.sendData(data, data.length)
   }
 
+  updateClock(position) {
+    this.ffmpegStub.updateClock(position)
+  }
+
+  grantCredit(frames) {
+    this.ffmpegStub.grantCredit(frames)
+  }
+
+  setOutputSize(width, height) {
+    this.ffmpegStub.setOutputSize(width, height)
+  }
+
   seekTo(ms) {
     const accurateSeek = this.accurateSeek ? 1 : 0
     const ret = this.ffmpegStub.seekTo(ms, accurateSeek)
@@ -194,6 +208,15 @@ class Decoder {
       case kSeekToReq:
         this.seekTo(req.ms)
         break
+      case kUpdateClockReq:
+        this.updateClock(req.s)
+        break
+      case kSetOutputSizeReq:
+        this.setOutputSize(req.w, req.h)
+        break
+      case kGrantCreditReq:
+        this.grantCredit(req.n)
+        break
       default:
         this.logger.logError(`Unsupport messsage ${req.t}`)
     }
@@ -8,7 +8,8 @@ import {
   kOpenDecoderRsp, kVideoFrame, kAudioFrame, kDecodeFinishedEvt,
   kSeekToRsp, kRequestDataEvt, kProtoWebsocket, kStartDecodingReq,
   kCloseDecoderReq, kInitDecoderReq, kPauseDecodingReq, kSeekToReq,
-  kUninitDecoderReq, KDiscardDataReq
+  kUninitDecoderReq, KDiscardDataReq, kUpdateClockReq, kSetOutputSizeReq,
+  kGrantCreditReq
 } from './constant'
 
 // Decoder states.
@@ -24,6 +25,10 @@ const playerStatePausing = 2
 
 // Constant.
 const maxBufferTimeLength = 1.0
+// Credit comes back only as frames are displayed, so buffering has to end before the server's
+// credit window (decoder-stub creditWindow, 32) minus one batch is held in the buffer.
+const maxBufferVideoFrames = 24
+const pixFmtGray8 = 8 // AV_PIX_FMT_GRAY8, luma only output rendition
 const downloadSpeedByteRateCoef = 2.0
 
 // String.prototype.startWith = function (str) {
@@ -54,6 +59,7 @@ class Player {
     this.videoHeight = 0
     this.yLength = 0
     this.uvLength = 0
+    this.lumaFrame = null
     this.beginTimeOffset = 0
     this.decoderState = decoderStateIdle
     this.playerState = playerStateIdle
@@ -87,6 +93,10 @@ class Player {
     this.fetchController = null
     this.streamPauseParam = null
     this.hasAudio = false
+    this.clockReportInterval = 500
+    this.lastClockReportTime = 0
+    this.creditBatch = 8
+    this.pendingCredit = 0
     this.logger = new Logger('Player')
     this.initDownloadWorker(downloadWorkerScript)
     this.initDecodeWorker(decodeWorkerScript)
@@ -427,6 +437,7 @@ class Player {
     this.decoderState = decoderStateIdle
     this.playerState = playerStateIdle
     this.decoding = false
+    this.grantCredit(this.countVideoFrames(), true)
     this.frameBuffer = []
     this.buffering = false
     this.streamReceivedLen = 0
@@ -478,7 +489,8 @@ class Player {
     // Stop download.
     this.stopDownloadTimer()
 
-    // Clear frame buffer.
+    // Clear frame buffer, the dropped frames and the pending credit go back to the server.
+    this.grantCredit(this.countVideoFrames(), true)
     this.frameBuffer.length = 0
 
     // Request decoder to seek.
@@ -504,6 +516,16 @@ class Player {
     }
   }
 
+  // Ask the server to scale frames down to fit the tile, call again when the tile is resized, 0 keeps the original size.
+  setOutputSize(width, height) {
+    const req = {
+      t: kSetOutputSizeReq,
+      w: width,
+      h: height
+    }
+    this.decodeWorker.postMessage(req)
+  }
+
   getState() {
     return this.playerState
   }
@@ -773,6 +795,9 @@ class Player {
   bufferFrame(frame) {
     // If not decoding, it may be frame before seeking, should be discarded.
     if (!this.decoding) {
+      if (frame.t === kVideoFrame) {
+        this.grantCredit(1, false)
+      }
       return
     }
     this.frameBuffer.push(frame)
@@ -781,10 +806,11 @@ class Player {
 
     if (
       this.getBufferTimerLength() >= maxBufferTimeLength ||
+      this.countVideoFrames() >= maxBufferVideoFrames ||
       this.decoderState === decoderStateFinished
     ) {
       if (this.decoding) {
-        this.logger.logInfo('Frame buffer time length >= ' + maxBufferTimeLength + ', pause decoding.')
+        this.logger.logInfo('Frame buffer full, pause decoding.')
         this.pauseDecoding()
       }
       if (this.buffering) {
@@ -838,6 +864,25 @@ class Player {
     this.bufferFrame(frame)
   }
 
+  countVideoFrames() {
+    return this.frameBuffer.filter((frame) => frame.t === kVideoFrame).length
+  }
+
+  grantCredit(frames, flush) {
+    // Server sends video only while it has credit, return it in batches as frames are displayed or dropped,
+    // so a slow renderer holds the credit back.
+    this.pendingCredit += frames
+    if (this.pendingCredit === 0 || (!flush && this.pendingCredit < this.creditBatch)) {
+      return
+    }
+    const req = {
+      t: kGrantCreditReq,
+      n: this.pendingCredit
+    }
+    this.decodeWorker.postMessage(req)
+    this.pendingCredit = 0
+  }
+
   displayVideoFrame(frame) {
     if (this.playerState !== playerStatePlaying) {
       this.logger.logInfo('player status is ' + this.playerState)
@@ -863,11 +908,26 @@ class Player {
 
     if (audioTimestamp <= 0 || delay <= 0) {
       const data = new Uint8Array(frame.d)
-      this.renderVideoFrame(data)
+      this.renderVideoFrame(data, frame.i)
+      this.reportClock(frame.s)
       return true
     }
   }
 
+  reportClock(position) {
+    // Server schedules decoding by the displayed position, report it periodically.
+    const now = Date.now()
+    if (now - this.lastClockReportTime < this.clockReportInterval) {
+      return
+    }
+    this.lastClockReportTime = now
+    const req = {
+      t: kUpdateClockReq,
+      s: position
+    }
+    this.decodeWorker.postMessage(req)
+  }
+
   onSeekToRsp(ret) {
     if (ret !== 0) {
       this.justSeeked = false
@@ -928,6 +988,7 @@ class Player {
         case kVideoFrame:
           if (this.displayVideoFrame(frame)) {
             this.frameBuffer.shift()
+            this.grantCredit(1, false)
           }
           break
         default:
@@ -939,7 +1000,7 @@ class Player {
       }
     }
 
-    if (this.getBufferTimerLength() < maxBufferTimeLength / 2) {
+    if (this.getBufferTimerLength() < maxBufferTimeLength / 2 && this.countVideoFrames() < maxBufferVideoFrames / 2) {
       if (!this.decoding) {
         // this.logger.logInfo('Buffer time length < ' + maxBufferTimeLength / 2 + ', restart decoding.')
         this.startDecoding()
@@ -968,7 +1029,20 @@ class Player {
     this.resume()
   }
 
-  renderVideoFrame(data) {
+  renderVideoFrame(data, info) {
+    // frames may be scaled on the server, follow the size carried in the frame header
+    if (info && info.width > 0 && info.height > 0 && (info.width !== this.videoWidth || info.height !== this.videoHeight)) {
+      this.videoWidth = info.width
+      this.videoHeight = info.height
+      this.yLength = this.videoWidth * this.videoHeight
+      this.uvLength = (this.videoWidth / 2) * (this.videoHeight / 2)
+    }
+    if (info && info.renditionChanged) {
+      this.logger.logInfo('Output rendition ' + info.rendition + ', ' + info.width + 'x' + info.height)
+    }
+    if (info && info.format === pixFmtGray8) {
+      data = this.expandLuma(data)
+    }
     this.webglPlayer.renderFrame(
       data,
       this.videoWidth,
@@ -978,6 +1052,18 @@ class Player {
     )
   }
 
+  expandLuma(data) {
+    // The renderer takes I420, a luma only frame gets neutral chroma planes
+    const size = this.yLength + this.uvLength * 2
+    if (!this.lumaFrame || this.lumaFrame.length !== size) {
+      this.lumaFrame = new Uint8Array(size)
+      this.lumaFrame.fill(128, this.yLength)
+    }
+    this.lumaFrame.set(data.subarray(0, this.yLength))
+    return this.lumaFrame
+  }
+
+
   downloadOneChunk() {
     if (this.downloading || this.isStream) {
       return